@@ -0,0 +1,111 @@
+// Measures the throughput of IncludeScanner and the std::regex which IncludeFileAnalyzer used before.
+//
+// usage: includeScannerBench [source files...]
+// A generated source is used when no file is given.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <regex>
+#include <chrono>
+#include <functional>
+
+#include "includeScanner.h"
+
+using namespace std;
+
+static std::string makeSource(size_t size)
+{
+    // a header which is mostly declarations and comments with a few includes at the top.
+    std::string source =
+        "#pragma once\n"
+        "#include <vector>\n"
+        "#include <string>\n"
+        "#include \"config.h\"\n";
+    std::string const block =
+        "/**\n"
+        " * Returns the value. The old scanner picked #include \"comment.h\" here.\n"
+        " */\n"
+        "template<typename T>\n"
+        "inline T const& value(std::vector<T> const& values, size_t index)\n"
+        "{\n"
+        "    // index must be less than 1'000'000\n"
+        "    static char const* const message = \"#include <string.h>\";\n"
+        "    return values.at(index);\n"
+        "}\n"
+        "\n";
+    while (source.size() < size) {
+        source += block;
+    }
+    return source;
+}
+
+static size_t scanByRegex(std::string const& content)
+{
+    std::regex pattern(R"(#include\s*([<"])([\w./\\]+)[>"])");
+    std::smatch match;
+    size_t count = 0;
+    auto it = content.cbegin(), end = content.cend();
+    while (std::regex_search(it, end, match, pattern)) {
+        it = match[0].second;
+        ++count;
+    }
+    return count;
+}
+
+static size_t scanByScanner(std::string const& content)
+{
+    std::vector<watagashi::IncludeScanner::Include> includes;
+    watagashi::IncludeScanner::sScan(content.data(), content.data() + content.size(), &includes);
+    return includes.size();
+}
+
+static void measure(char const* name, std::vector<std::string> const& sources, std::function<size_t(std::string const&)> const& scan)
+{
+    size_t totalSize = 0;
+    for (auto& source : sources) {
+        totalSize += source.size();
+    }
+
+    // repeat for half a second at least.
+    size_t count = 0;
+    size_t iteration = 0;
+    auto begin = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>::zero();
+    do {
+        count = 0;
+        for (auto& source : sources) {
+            count += scan(source);
+        }
+        ++iteration;
+        elapsed = std::chrono::steady_clock::now() - begin;
+    } while (elapsed.count() < 0.5);
+
+    auto bytesPerSecond = static_cast<double>(totalSize) * iteration / elapsed.count();
+    cout << name << ": " << bytesPerSecond / 1e9 << " GB/s"
+        << " (includes=" << count << ", iteration=" << iteration << ")" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> sources;
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream in(argv[i], std::ios::binary);
+        if (!in) {
+            cerr << "failed to open " << argv[i] << endl;
+            return 1;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        sources.push_back(ss.str());
+    }
+    if (sources.empty()) {
+        sources.push_back(makeSource(4 * 1024 * 1024));
+    }
+
+    measure("regex", sources, scanByRegex);
+    measure("scanner", sources, scanByScanner);
+    return 0;
+}
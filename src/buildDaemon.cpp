@@ -0,0 +1,417 @@
+#include "buildDaemon.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cstdint>
+#include <sstream>
+
+#include "utility.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+extern char** environ;
+#endif
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+#ifndef _WIN32
+static volatile std::sig_atomic_t sIsStopping = 0;
+
+static void onStopSignal(int)
+{
+    sIsStopping = 1;
+}
+
+static bool makeAddress(boost::filesystem::path const& socketPath, sockaddr_un* pOut)
+{
+    auto str = socketPath.string();
+    std::memset(pOut, 0, sizeof(*pOut));
+    pOut->sun_family = AF_UNIX;
+    if (sizeof(pOut->sun_path) <= str.size()) {
+        return false;
+    }
+    std::memcpy(pOut->sun_path, str.c_str(), str.size());
+    return true;
+}
+
+static bool writeAll(int fd, void const* pData, size_t size)
+{
+    auto p = static_cast<char const*>(pData);
+    while (0 < size) {
+        auto n = ::write(fd, p, size);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* pData, size_t size)
+{
+    auto p = static_cast<char*>(pData);
+    while (0 < size) {
+        auto n = ::read(fd, p, size);
+        if (n <= 0) {
+            if (n < 0 && EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Return true when the peer of the connection runs as the user of the daemon.
+static bool isSameUser(int connection)
+{
+#ifdef SO_PEERCRED
+    ucred credentials = {};
+    socklen_t length = sizeof(credentials);
+    if (::getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0) {
+        return false;
+    }
+    return ::geteuid() == credentials.uid;
+#else
+    uid_t uid = 0;
+    gid_t gid = 0;
+    if (::getpeereid(connection, &uid, &gid) < 0) {
+        return false;
+    }
+    return ::geteuid() == uid;
+#endif
+}
+
+// Remove the jobserver of "--jobserver-auth=R,W" from MAKEFLAGS and MFLAGS of the client.
+// The descriptors are of the client, so the daemon would use its own files with the same numbers.
+// A fifo jobserver is kept, since the daemon can open its path too.
+static void removeInheritedJobServer(std::vector<std::string>* pVariables)
+{
+    for (auto& variable : *pVariables) {
+        if (0 != variable.compare(0, 10, "MAKEFLAGS=") && 0 != variable.compare(0, 7, "MFLAGS=")) {
+            continue;
+        }
+        auto equal = variable.find('=');
+        std::istringstream in(variable.substr(equal + 1));
+        std::string result = variable.substr(0, equal + 1);
+        bool isFirst = true;
+        for (std::string word; in >> word;) {
+            bool isFdAuth = (0 == word.compare(0, 17, "--jobserver-auth=") && 0 != word.compare(17, 5, "fifo:"))
+                || 0 == word.compare(0, 16, "--jobserver-fds=");
+            if (isFdAuth) {
+                continue;
+            }
+            result += (isFirst ? "" : " ") + word;
+            isFirst = false;
+        }
+        variable = std::move(result);
+    }
+}
+
+static void setEnvironment(std::vector<std::string> const& variables)
+{
+    ::clearenv();
+    for (auto& variable : variables) {
+        auto equal = variable.find('=');
+        if (std::string::npos == equal || 0 == equal) {
+            continue;
+        }
+        ::setenv(variable.substr(0, equal).c_str(), variable.c_str() + equal + 1, 1);
+    }
+}
+#endif
+
+//--------------------------------------------------------------------------------------
+//
+//  class BuildDaemon
+//
+//--------------------------------------------------------------------------------------
+
+boost::filesystem::path BuildDaemon::sMakeSocketPath(std::string const& configFilepath)
+{
+    auto path = fs::absolute(configFilepath).lexically_normal();
+    path += ".sock";
+    return path;
+}
+
+bool BuildDaemon::sForward(boost::filesystem::path const& socketPath, int argc, char** argv, int* pOutExitCode)
+{
+#ifdef _WIN32
+    (void)socketPath; (void)argc; (void)argv; (void)pOutExitCode;
+    return false;
+#else
+    sockaddr_un address;
+    if (!makeAddress(socketPath, &address)) {
+        return false;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // the working directory, the count of the arguments, the arguments and the environment, each ends with '\0'.
+    std::string payload;
+    boost::system::error_code ec;
+    payload += fs::current_path(ec).string();
+    payload += '\0';
+    payload += std::to_string(argc);
+    payload += '\0';
+    for (int i = 0; i < argc; ++i) {
+        payload += argv[i];
+        payload += '\0';
+    }
+    for (auto p = environ; *p; ++p) {
+        payload += *p;
+        payload += '\0';
+    }
+
+    // the size goes with stdin, stdout and stderr.
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    std::memset(control, 0, sizeof(control));
+    iovec iov = { &size, sizeof(size) };
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    auto pHeader = CMSG_FIRSTHDR(&message);
+    pHeader->cmsg_level = SOL_SOCKET;
+    pHeader->cmsg_type = SCM_RIGHTS;
+    pHeader->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(pHeader), fds, sizeof(fds));
+    cout.flush();
+    cerr.flush();
+    if (::sendmsg(fd, &message, 0) < 0 || !writeAll(fd, payload.data(), payload.size())) {
+        ::close(fd);
+        return false;
+    }
+
+    int32_t exitCode = 1;
+    if (!readAll(fd, &exitCode, sizeof(exitCode))) {
+        cerr << "error: the daemon stopped while running the task." << endl;
+        exitCode = 1;
+    }
+    ::close(fd);
+    *pOutExitCode = exitCode;
+    return true;
+#endif
+}
+
+BuildDaemon::BuildDaemon(boost::filesystem::path const& socketPath)
+    : mSocketPath(socketPath)
+    , mListenFd(-1)
+{}
+
+BuildDaemon::~BuildDaemon()
+{
+#ifndef _WIN32
+    if (0 <= this->mListenFd) {
+        ::close(this->mListenFd);
+        ::unlink(this->mSocketPath.c_str());
+    }
+#endif
+}
+
+bool BuildDaemon::open()
+{
+#ifdef _WIN32
+    cerr << "error: the daemon is not supported on this platform." << endl;
+    return false;
+#else
+    sockaddr_un address;
+    if (!makeAddress(this->mSocketPath, &address)) {
+        cerr << "error: the path of the socket is too long. path=" << this->mSocketPath.string() << endl;
+        return false;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        cerr << "error: failed to create the socket. " << std::strerror(errno) << endl;
+        return false;
+    }
+    // only the user of the daemon may connect, since a client runs any task with the rights of the daemon.
+    auto prevMask = ::umask(0077);
+    Finally restoreMask([&]() { ::umask(prevMask); });
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        // the socket may be left by a daemon which was killed.
+        int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool isListened = 0 == ::connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        ::close(probe);
+        if (isListened || EADDRINUSE != errno
+            || 0 != ::unlink(this->mSocketPath.c_str())
+            || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            cerr << "error: another daemon listens on " << this->mSocketPath.string() << endl;
+            ::close(fd);
+            return false;
+        }
+    }
+    if (::chmod(this->mSocketPath.c_str(), S_IRUSR | S_IWUSR) < 0) {
+        cerr << "error: failed to change the mode of the socket. " << std::strerror(errno) << endl;
+        ::close(fd);
+        ::unlink(this->mSocketPath.c_str());
+        return false;
+    }
+    if (::listen(fd, 16) < 0) {
+        cerr << "error: failed to listen on the socket. " << std::strerror(errno) << endl;
+        ::close(fd);
+        ::unlink(this->mSocketPath.c_str());
+        return false;
+    }
+    this->mListenFd = fd;
+    return true;
+#endif
+}
+
+void BuildDaemon::run(Handler const& handler)
+{
+#ifdef _WIN32
+    (void)handler;
+#else
+    struct sigaction action = {};
+    action.sa_handler = onStopSignal;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    // a client may leave while its task writes to it.
+    ::signal(SIGPIPE, SIG_IGN);
+
+    cout << "daemon: listening on " << this->mSocketPath.string() << endl;
+    while (!sIsStopping) {
+        pollfd pfd = { this->mListenFd, POLLIN, 0 };
+        // the timeout covers the signal which comes before poll().
+        if (::poll(&pfd, 1, 1000) <= 0) {
+            continue;
+        }
+        int connection = ::accept4(this->mListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            continue;
+        }
+        if (!isSameUser(connection)) {
+            cerr << "daemon: refused a client of another user." << endl;
+            ::close(connection);
+            continue;
+        }
+        this->serve_(connection, handler);
+        ::close(connection);
+    }
+    cout << "daemon: stopped" << endl;
+#endif
+}
+
+void BuildDaemon::serve_(int connection, Handler const& handler)
+{
+#ifdef _WIN32
+    (void)connection; (void)handler;
+#else
+    uint32_t size = 0;
+    int fds[3] = { -1, -1, -1 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    iovec iov = { &size, sizeof(size) };
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (::recvmsg(connection, &message, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(size))) {
+        return;
+    }
+    auto pHeader = CMSG_FIRSTHDR(&message);
+    if (!pHeader || SOL_SOCKET != pHeader->cmsg_level || SCM_RIGHTS != pHeader->cmsg_type
+        || CMSG_LEN(sizeof(fds)) != pHeader->cmsg_len) {
+        return;
+    }
+    std::memcpy(fds, CMSG_DATA(pHeader), sizeof(fds));
+    std::string payload(size, '\0');
+    if (!readAll(connection, &payload[0], payload.size())) {
+        for (auto fd : fds) {
+            ::close(fd);
+        }
+        return;
+    }
+
+    std::vector<std::string> words;
+    for (size_t begin = 0; begin < payload.size();) {
+        auto end = payload.find('\0', begin);
+        if (std::string::npos == end) {
+            end = payload.size();
+        }
+        words.emplace_back(payload, begin, end - begin);
+        begin = end + 1;
+    }
+    size_t argc = 2 <= words.size() ? std::strtoul(words[1].c_str(), nullptr, 10) : 0;
+    if (words.size() < 2 + argc) {
+        for (auto fd : fds) {
+            ::close(fd);
+        }
+        return;
+    }
+    auto& workingDirectory = words[0];
+    std::vector<std::string> args(words.begin() + 2, words.begin() + 2 + argc);
+    std::vector<std::string> environment(words.begin() + 2 + argc, words.end());
+    removeInheritedJobServer(&environment);
+
+    std::vector<std::string> daemonEnvironment;
+    for (auto p = environ; *p; ++p) {
+        daemonEnvironment.emplace_back(*p);
+    }
+    boost::system::error_code ec;
+    auto daemonDirectory = fs::current_path(ec);
+
+    // the task and its compilers use the terminal and the environment of the client.
+    cout.flush();
+    cerr.flush();
+    std::fflush(nullptr);
+    int savedFds[3];
+    for (int i = 0; i < 3; ++i) {
+        savedFds[i] = ::fcntl(i, F_DUPFD_CLOEXEC, 3);
+        ::dup2(fds[i], i);
+        ::close(fds[i]);
+    }
+    setEnvironment(environment);
+
+    int32_t exitCode = 1;
+    fs::current_path(workingDirectory, ec);
+    if (ec) {
+        cerr << "error: the daemon can't enter " << workingDirectory << endl;
+    } else {
+        exitCode = handler(args);
+    }
+
+    cout.flush();
+    cerr.flush();
+    std::fflush(nullptr);
+    for (int i = 0; i < 3; ++i) {
+        ::dup2(savedFds[i], i);
+        ::close(savedFds[i]);
+    }
+    setEnvironment(daemonEnvironment);
+    fs::current_path(daemonDirectory, ec);
+
+    writeAll(connection, &exitCode, sizeof(exitCode));
+#endif
+}
+
+}
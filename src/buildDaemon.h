@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <boost/filesystem.hpp>
+
+namespace watagashi
+{
+
+// Serves the tasks of thin clients over a Unix socket, so that a long-lived process keeps
+// the parsed config, the project and the include graph in memory between builds.
+// A client passes its arguments, its working directory and its stdin, stdout and stderr.
+// The daemon runs the task with them, so the output of the task and the compilers goes to the client.
+// The requests are served one by one. Only the user of the daemon may connect.
+// The jobserver pipe of a client isn't passed, so its "--jobserver-auth=R,W" is removed from MAKEFLAGS.
+class BuildDaemon
+{
+    BuildDaemon(BuildDaemon const&) = delete;
+    BuildDaemon& operator=(BuildDaemon const&) = delete;
+
+public:
+    // Run a task with the arguments of the client, and return its exit code.
+    using Handler = std::function<int(std::vector<std::string> const& args)>;
+
+    // Return the socket of the daemon which serves the config file.
+    static boost::filesystem::path sMakeSocketPath(std::string const& configFilepath);
+
+    // Let the daemon run the task of the arguments.
+    // Return false when no daemon listens on the socket, so that the caller runs the task itself.
+    static bool sForward(boost::filesystem::path const& socketPath, int argc, char** argv, int* pOutExitCode);
+
+public:
+    explicit BuildDaemon(boost::filesystem::path const& socketPath);
+    ~BuildDaemon();
+
+    // Return false when another daemon listens on the socket.
+    bool open();
+    // Serve the requests until SIGINT or SIGTERM.
+    void run(Handler const& handler);
+
+private:
+    void serve_(int connection, Handler const& handler);
+
+private:
+    boost::filesystem::path mSocketPath;
+    int mListenFd;
+};
+
+}
@@ -0,0 +1,257 @@
+#include "buildLog.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+
+#include "utility.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sHeader = "# watagashi build log v3";
+
+// compact the log when it has this times more lines than the entries.
+static size_t const sCompactionRatio = 3;
+static size_t const sMinCompactionLineCount = 100;
+
+// <start>\t<end>\t<exit status>\t<output mtime>\t<command hash>\t<peak memory>\t<output filepath>
+static void writeLine(std::ostream& out, std::string const& key, BuildLog::Entry const& entry)
+{
+    char buf[128];
+    std::snprintf(buf, sizeof(buf), "%" PRIu64 "\t%" PRIu64 "\t%d\t%lld\t%016" PRIx64 "\t%zu\t",
+        entry.startTime, entry.endTime, entry.exitStatus,
+        static_cast<long long>(entry.outputMtime), entry.commandHash, entry.peakMemory);
+    out << buf << key << "\n";
+}
+
+char const* const BuildLog::sFilename = ".watagashi_log";
+
+//--------------------------------------------------------------------------------------
+//
+//  class BuildLog
+//
+//--------------------------------------------------------------------------------------
+
+BuildLog::BuildLog(boost::filesystem::path const& filepath)
+    : mFilepath(filepath)
+    , mTotalPeakMemory(0)
+    , mPeakMemoryCount(0)
+    , mTotalDuration(0)
+    , mDurationCount(0)
+{}
+
+BuildLog::~BuildLog()
+{
+    this->close();
+}
+
+bool BuildLog::open()
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    uint64_t validSize = 0;
+    auto lineCount = this->load_(&validSize);
+    bool isRewrite = lineCount < 0
+        || (sMinCompactionLineCount <= static_cast<size_t>(lineCount)
+            && this->mEntries.size() * sCompactionRatio < static_cast<size_t>(lineCount));
+    if (isRewrite && !this->rewrite_()) {
+        return false;
+    }
+    if (!isRewrite) {
+        // cut the line torn by an interrupted build, or the next line would be appended to it.
+        boost::system::error_code ec;
+        if (validSize < fs::file_size(this->mFilepath, ec) && !ec) {
+            fs::resize_file(this->mFilepath, validSize, ec);
+        }
+        if (ec) {
+            cerr << "warning: failed to repair the build log. path=" << this->mFilepath << " " << ec.message() << endl;
+            return false;
+        }
+    }
+
+    this->mOut.open(this->mFilepath.string(), std::ios::app);
+    if (!this->mOut) {
+        cerr << "warning: failed to open the build log. path=" << this->mFilepath << endl;
+        return false;
+    }
+    return true;
+}
+
+void BuildLog::close()
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    if (this->mOut.is_open()) {
+        this->mOut.close();
+    }
+}
+
+bool BuildLog::find(boost::filesystem::path const& outputFilepath, Entry* pOut)const
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    auto it = this->mEntries.find(outputFilepath.generic_string());
+    if (this->mEntries.end() == it) {
+        return false;
+    }
+    *pOut = it->second;
+    return true;
+}
+
+void BuildLog::record(boost::filesystem::path const& outputFilepath, Entry const& entry)
+{
+    auto key = outputFilepath.generic_string();
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    this->add_(key, entry);
+    if (this->mOut.is_open()) {
+        // flush each line so that an interrupted build keeps the ended processes.
+        writeLine(this->mOut, key, entry);
+        this->mOut.flush();
+    }
+}
+
+size_t BuildLog::estimatePeakMemory(boost::filesystem::path const& outputFilepath)const
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    auto it = this->mEntries.find(outputFilepath.generic_string());
+    if (this->mEntries.end() != it && 0 < it->second.peakMemory) {
+        return it->second.peakMemory;
+    }
+    return 0 == this->mPeakMemoryCount ? 0 : this->mTotalPeakMemory / this->mPeakMemoryCount;
+}
+
+size_t BuildLog::estimateDuration(boost::filesystem::path const& outputFilepath)const
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    auto it = this->mEntries.find(outputFilepath.generic_string());
+    if (this->mEntries.end() != it && 0 == it->second.exitStatus) {
+        return it->second.duration();
+    }
+    return 0 == this->mDurationCount ? 0 : this->mTotalDuration / this->mDurationCount;
+}
+
+size_t BuildLog::entryCount()const
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    return this->mEntries.size();
+}
+
+int64_t BuildLog::load_(uint64_t* pOutValidSize)
+{
+    this->mEntries.clear();
+    this->mTotalPeakMemory = 0;
+    this->mPeakMemoryCount = 0;
+    this->mTotalDuration = 0;
+    this->mDurationCount = 0;
+
+    *pOutValidSize = 0;
+    if (!fs::exists(this->mFilepath)) {
+        return -1;
+    }
+    // read at once and parse in place. it is much faster than std::getline() for a large log.
+    auto content = readFile(this->mFilepath);
+    auto headerLength = std::strlen(sHeader);
+    if (content.size() <= headerLength
+        || 0 != content.compare(0, headerLength, sHeader)
+        || '\n' != content[headerLength]) {
+        cerr << "warning: ignore the unknown build log. path=" << this->mFilepath << endl;
+        return -1;
+    }
+
+    *pOutValidSize = headerLength + 1;
+    int64_t lineCount = 0;
+    char* p = &content[headerLength + 1];
+    char* const pEnd = &content[0] + content.size();
+    while (p < pEnd) {
+        auto pLineEnd = static_cast<char*>(std::memchr(p, '\n', pEnd - p));
+        if (!pLineEnd) {
+            // the last line was being written when the build was interrupted.
+            break;
+        }
+        *pLineEnd = '\0';
+        *pOutValidSize = static_cast<uint64_t>(pLineEnd + 1 - &content[0]);
+
+        Entry entry;
+        bool isValid = true;
+        auto parseField = [&](auto parse) {
+            if (isValid) {
+                parse();
+                isValid = '\t' == *p;
+                ++p;
+            }
+        };
+        parseField([&]() { entry.startTime = std::strtoull(p, &p, 10); });
+        parseField([&]() { entry.endTime = std::strtoull(p, &p, 10); });
+        parseField([&]() { entry.exitStatus = static_cast<int>(std::strtol(p, &p, 10)); });
+        parseField([&]() { entry.outputMtime = static_cast<std::time_t>(std::strtoll(p, &p, 10)); });
+        parseField([&]() { entry.commandHash = std::strtoull(p, &p, 16); });
+        parseField([&]() { entry.peakMemory = std::strtoull(p, &p, 10); });
+        if (isValid && p < pLineEnd) {
+            this->add_(std::string(p, pLineEnd), entry);
+        }
+        ++lineCount;
+        p = pLineEnd + 1;
+    }
+    return lineCount;
+}
+
+bool BuildLog::rewrite_()
+{
+    createDirectory(this->mFilepath.parent_path());
+
+    // write to a temporary file and replace the log, so that an interrupted rewrite never breaks it.
+    auto tempFilepath = this->mFilepath;
+    tempFilepath += ".tmp";
+    {
+        std::ofstream out(tempFilepath.string(), std::ios::trunc);
+        out << sHeader << "\n";
+        for (auto& [key, entry] : this->mEntries) {
+            writeLine(out, key, entry);
+        }
+        if (!out) {
+            cerr << "warning: failed to write the build log. path=" << tempFilepath << endl;
+            return false;
+        }
+    }
+    boost::system::error_code ec;
+    fs::rename(tempFilepath, this->mFilepath, ec);
+    if (ec) {
+        cerr << "warning: failed to write the build log. path=" << this->mFilepath << " " << ec.message() << endl;
+        return false;
+    }
+    return true;
+}
+
+void BuildLog::add_(std::string const& key, Entry const& entry)
+{
+    auto [it, isInserted] = this->mEntries.insert({ key, entry });
+    if (!isInserted) {
+        this->remove_(it->second);
+        it->second = entry;
+    }
+    if (0 < entry.peakMemory) {
+        this->mTotalPeakMemory += entry.peakMemory;
+        ++this->mPeakMemoryCount;
+    }
+    if (0 == entry.exitStatus) {
+        this->mTotalDuration += entry.duration();
+        ++this->mDurationCount;
+    }
+}
+
+void BuildLog::remove_(Entry const& entry)
+{
+    if (0 < entry.peakMemory) {
+        this->mTotalPeakMemory -= entry.peakMemory;
+        --this->mPeakMemoryCount;
+    }
+    if (0 == entry.exitStatus) {
+        this->mTotalDuration -= entry.duration();
+        --this->mDurationCount;
+    }
+}
+
+}
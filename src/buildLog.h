@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+#include <ctime>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+
+namespace watagashi
+{
+
+// Records each process of the previous builds, like .ninja_log.
+// The scheduler estimates the cost of a process by it before running the compiler.
+// A process appends a line when it ends, so the log survives an interrupted build.
+// The lines of the same output file are compacted when the log grows.
+class BuildLog
+{
+    BuildLog(BuildLog const&) = delete;
+    BuildLog& operator=(BuildLog const&) = delete;
+
+public:
+    // the file name in the intermediate directory. "clean" keeps it.
+    static char const* const sFilename;
+
+    struct Entry
+    {
+        // the wall-clock time in milliseconds since the epoch.
+        uint64_t startTime = 0;
+        uint64_t endTime = 0;
+        // 0 when all commands succeeded.
+        int exitStatus = 0;
+        // the last write time of the output file after the process. 0 when it doesn't exist.
+        std::time_t outputMtime = 0;
+        // the signature of the compile command. see data::makeCommandSignature().
+        uint64_t commandHash = 0;
+        // the peak resident set size in bytes.
+        size_t peakMemory = 0;
+
+        // Return the duration in milliseconds.
+        size_t duration()const { return static_cast<size_t>(this->endTime - this->startTime); }
+    };
+
+public:
+    explicit BuildLog(boost::filesystem::path const& filepath);
+    ~BuildLog();
+
+    // Load the log and prepare to append to it.
+    // A missing or unknown file starts an empty log. Return false when the log can't be written.
+    bool open();
+    void close();
+
+    bool find(boost::filesystem::path const& outputFilepath, Entry* pOut)const;
+    // Append the entry to the log file.
+    void record(boost::filesystem::path const& outputFilepath, Entry const& entry);
+
+    // Return the recorded peak memory, or the average of all entries for an unknown file.
+    size_t estimatePeakMemory(boost::filesystem::path const& outputFilepath)const;
+    // Return the recorded duration of the last success, or the average of all entries for an unknown file.
+    size_t estimateDuration(boost::filesystem::path const& outputFilepath)const;
+
+    size_t entryCount()const;
+
+private:
+    // Return the count of the lines, or -1 when the file isn't a log of this version.
+    // pOutValidSize receives the size up to the end of the last complete line.
+    int64_t load_(uint64_t* pOutValidSize);
+    bool rewrite_();
+    void add_(std::string const& key, Entry const& entry);
+    void remove_(Entry const& entry);
+
+private:
+    boost::filesystem::path mFilepath;
+    mutable std::mutex mMutex;
+    std::ofstream mOut;
+    std::unordered_map<std::string, Entry> mEntries;
+    size_t mTotalPeakMemory;
+    size_t mPeakMemoryCount;
+    size_t mTotalDuration;
+    size_t mDurationCount;
+};
+
+}
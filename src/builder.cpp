@@ -17,6 +17,21 @@
 #include "utility.h"
 #include "includeFileAnalyzer.h"
 #include "processServer.h"
+#include "jobServer.h"
+#include "buildLog.h"
+#include "dependencyStore.h"
+#include "includeGraphCache.h"
+#include "includeClosureMemo.h"
+#include "objectCache.h"
+#include "remoteCache.h"
+#include "workerClient.h"
+#include "unityBuild.h"
+#include "moduleScanner.h"
+#include "linkManifest.h"
+#include "precompiledHeader.h"
+#ifndef _WIN32
+#include "processReactor.h"
+#endif
 
 #include "data.h"
 
@@ -29,6 +44,8 @@ namespace watagashi
 Builder::Builder(data::Project const& project, ProgramOptions const& options)
     : mProject(project)
     , mOptions(options)
+    , mpIncludeGraphCache(nullptr)
+    , mpRunningProcessServer(nullptr)
 {}
 
 void Builder::addCompiler(data::Compiler const& compiler)
@@ -52,21 +69,219 @@ void Builder::addCompiler(data::Compiler && compiler)
     this->mCompilerMap.insert({ compiler.name, std::move(compiler) });
 }
 
-void runThread(bool& isFinish, ProcessServer& processServer, bool isMainThread)
+void Builder::setIncludeGraphCache(IncludeGraphCache* pIncludeGraphCache)
 {
-    while (!isFinish) {
-        if (auto pProcess = processServer.serveProcess_()) {
-            auto result = pProcess->compile();
-            processServer.notifyEndOfProcess(result);
-            if (Process::BuildResult::Failed == result) {
-                isFinish = true;
+    this->mpIncludeGraphCache = pIncludeGraphCache;
+}
+
+void Builder::cancelCompiles(std::unordered_set<std::string> const& inputFilepaths)const
+{
+    std::lock_guard<std::mutex> lock(this->mRunningMutex);
+    if (!this->mpRunningProcessServer) {
+        return;
+    }
+    this->mpRunningProcessServer->cancelProcesses([&](Process const& process) {
+        return 0 < inputFilepaths.count(fs::absolute(process.inputFilepath).lexically_normal().string());
+    });
+}
+
+void runThread(ProcessServer& processServer, size_t workerIndex)
+{
+    while (auto pProcess = processServer.serveProcess_(workerIndex)) {
+        pProcess->compile();
+        if (pProcess->isDeferred()) {
+            processServer.deferProcess(std::move(pProcess));
+            continue;
+        }
+        processServer.notifyEndOfProcess(*pProcess);
+    }
+}
+
+void runRemoteThread(ProcessServer& processServer, RemoteWorker& worker, size_t workerIndex)
+{
+    WorkerClient client(worker);
+    while (worker.isAvailable) {
+        auto pProcess = processServer.serveProcess_(workerIndex, true);
+        if (!pProcess) {
+            break;
+        }
+        pProcess->compile(&client);
+        if (pProcess->isDeferred()) {
+            processServer.deferProcess(std::move(pProcess));
+            continue;
+        }
+        processServer.notifyEndOfProcess(*pProcess);
+    }
+}
+
+// Return the workers which answer their slot count. The others are warned and skipped.
+std::vector<std::unique_ptr<RemoteWorker>> connectRemoteWorkers(std::string const& addresses, std::string const& token)
+{
+    std::vector<std::unique_ptr<RemoteWorker>> result;
+    if (addresses.empty()) {
+        return result;
+    }
+    for (auto& address : split(addresses, ',')) {
+        auto pWorker = std::make_unique<RemoteWorker>();
+        if (!RemoteWorker::sParse(address, pWorker.get())) {
+            cerr << "warning: the worker must be \"host:port\". address=" << address << endl;
+            continue;
+        }
+        pWorker->token = token;
+        if (!WorkerClient(*pWorker).queryStatus()) {
+            cerr << "warning: the worker " << pWorker->address() << " can't be reached. compile locally instead." << endl;
+            continue;
+        }
+        cout << "worker " << pWorker->address() << ": " << pWorker->slotCount << " slots" << endl;
+        result.push_back(std::move(pWorker));
+    }
+    return result;
+}
+
+#ifndef _WIN32
+void runEventLoop(ProcessServer& processServer, size_t jobCount)
+{
+    ProcessReactor reactor;
+    std::unordered_map<Process*, std::unique_ptr<Process>> runningProcesses;
+
+    auto proceed = [&](std::unique_ptr<Process> pProcess) {
+        std::string command;
+        while (pProcess->proceed(&command)) {
+            if (reactor.launch(command, pProcess.get())) {
+                auto key = pProcess.get();
+                runningProcesses.insert({ key, std::move(pProcess) });
+                return;
             }
-        } else {
-            if (isMainThread) {
-                isFinish = true;
-            } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            pProcess->notifyCommandResult(false);
+        }
+        if (pProcess->isDeferred()) {
+            processServer.deferProcess(std::move(pProcess));
+            return;
+        }
+        processServer.notifyEndOfProcess(*pProcess);
+    };
+
+    while (true) {
+        while (reactor.runningCount() < jobCount) {
+            auto pProcess = processServer.tryServeProcess_();
+            if (!pProcess) {
+                break;
             }
+            proceed(std::move(pProcess));
+        }
+
+        // processes are held back by the jobserver or the system load.
+        // wait for a token of the jobserver and check the system again after a while.
+        int timeout = -1;
+        int wakeupFd = -1;
+        if (!processServer.isAbort() && 0 < processServer.waitingCount() && reactor.runningCount() < jobCount) {
+            timeout = 100;
+            if (processServer.jobServer()) {
+                wakeupFd = processServer.jobServer()->readFd();
+            }
+        }
+        if (0 == reactor.runningCount() && timeout < 0) {
+            if (processServer.isFinish()) {
+                break;
+            }
+            // the remote slots are running, and may give a process back when their worker fails.
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        for (auto& exitInfo : reactor.wait(timeout, wakeupFd)) {
+            auto it = runningProcesses.find(exitInfo.pProcess);
+            auto pProcess = std::move(it->second);
+            runningProcesses.erase(it);
+            pProcess->notifyCommandResult(exitInfo.isSuccess, exitInfo.peakMemory);
+            proceed(std::move(pProcess));
+        }
+    }
+}
+#endif
+
+static data::FileFilter const* findFileFilter(data::Project const& project, fs::path const& inputFilepath)
+{
+    for (auto&& filter : project.fileFilters) {
+        if (matchFilepath(filter.targetKeyward, inputFilepath, project.rootDirectory)) {
+            return &filter;
+        }
+    }
+    return nullptr;
+}
+
+// the unity sources and the precompiled header are compiled with the options of the project,
+// so the targets which a file filter gives other options are compiled alone and without the header.
+static bool hasOwnOptions(data::FileFilter const* pFileFilter)
+{
+    return pFileFilter
+        && (!pFileFilter->compileOptions.empty() || !pFileFilter->includeDirectories.empty()
+            || !pFileFilter->preprocess.empty() || !pFileFilter->postprocess.empty());
+}
+
+static bool isUnityTarget(data::Project const& project, fs::path const& inputFilepath)
+{
+    auto pFileFilter = findFileFilter(project, inputFilepath);
+    return !hasOwnOptions(pFileFilter) && (!pFileFilter || pFileFilter->unity);
+}
+
+// the precompiled header is C++.
+static bool isPrecompiledHeaderTarget(data::Project const& project, fs::path const& inputFilepath)
+{
+    return ".c" != inputFilepath.extension() && !hasOwnOptions(findFileFilter(project, inputFilepath));
+}
+
+// Let the processes which import a module wait for the one which exports it, and give them the BMIs.
+static void connectModules(
+    std::vector<std::unique_ptr<Process>>& processes,
+    std::unordered_map<std::string, ModuleScanner::Unit> const& moduleUnits,
+    ModuleScanner const& moduleScanner)
+{
+    std::unordered_map<std::string, Process*> producers;
+    for (auto& pProcess : processes) {
+        auto it = moduleUnits.find(pProcess->inputFilepath.generic_string());
+        if (moduleUnits.end() == it || it->second.provide.empty()) {
+            continue;
+        }
+        if (!producers.emplace(it->second.provide, pProcess.get()).second) {
+            cerr << "warning: the module is exported twice. module=" << it->second.provide << " path=" << pProcess->inputFilepath.string() << endl;
+            continue;
+        }
+        pProcess->moduleName = it->second.provide;
+        pProcess->moduleFilepath = moduleScanner.makeModuleFilepath(it->second.provide);
+    }
+
+    for (auto& pProcess : processes) {
+        auto it = moduleUnits.find(pProcess->inputFilepath.generic_string());
+        if (moduleUnits.end() == it) {
+            continue;
+        }
+        // the compiler needs the BMIs of the indirect imports too.
+        std::unordered_set<std::string> visited;
+        std::vector<std::string> names(it->second.imports.begin(), it->second.imports.end());
+        while (!names.empty()) {
+            auto name = std::move(names.back());
+            names.pop_back();
+            if (!visited.insert(name).second) {
+                continue;
+            }
+            // the modules of the others like std are left to the compiler.
+            auto producerIt = producers.find(name);
+            if (producers.end() == producerIt || pProcess.get() == producerIt->second) {
+                continue;
+            }
+            auto pProducer = producerIt->second;
+            pProcess->importedModules.emplace_back(name, pProducer->moduleFilepath);
+            pProcess->dependencies.push_back(pProducer);
+            auto& imports = moduleUnits.at(pProducer->inputFilepath.generic_string()).imports;
+            names.insert(names.end(), imports.begin(), imports.end());
+        }
+        // the same order keeps the command signature.
+        std::sort(pProcess->importedModules.begin(), pProcess->importedModules.end());
+        if (pProcess->usesModules()) {
+            // the keys of the caches don't know the BMIs.
+            pProcess->pObjectCache = nullptr;
+            pProcess->pRemoteCache = nullptr;
         }
     }
 }
@@ -82,19 +297,85 @@ void Builder::build()const
     auto& compiler = this->mCompilerMap.find(this->mProject.compiler)->second;
     auto& taskBundle = data::getTaskBundle(compiler, this->mProject.type);
 
+    auto jobCount = static_cast<size_t>(std::max(this->mOptions.threadCount, 1));
+    // create it before running hooks so that they inherit MAKEFLAGS.
+    auto pJobServer = JobServer::sJoinFromEnvironment();
+    if (!pJobServer && this->mOptions.useJobServer) {
+        pJobServer = JobServer::sCreate(jobCount);
+    }
+
+    // the preprocess may generate the sources which the scans below read, so it runs before the others.
     if (!runCommand(this->parseVariables(this->mProject.preprocess, Scope()))) {
         cerr << "Failed preprocess..." << endl;
         return;
     }
 
-    bool isFinish = false;
-    ProcessServer processServer;
-    std::vector<std::thread> threads(this->mOptions.threadCount - 1);
-    for (auto&& t : threads) {
-        t = std::thread(runThread, std::ref(isFinish), std::ref(processServer), false);
+    bool useEventLoop = this->mOptions.useEventLoop;
+#ifdef _WIN32
+    if (useEventLoop) {
+        cerr << "--event-loop is not supported on this platform. use worker threads." << endl;
+        useEventLoop = false;
+    }
+#endif
+
+    BuildLog buildLog(this->mProject.makeIntermediatePath() / BuildLog::sFilename);
+    buildLog.open();
+    DependencyStore dependencyStore(this->mProject.makeIntermediatePath() / DependencyStore::sFilename);
+    dependencyStore.open();
+    // the objects compiled again to the same bytes, like after editing a comment, don't link again.
+    // adding or removing a target changes the objects, so it links.
+    LinkManifest linkManifest(this->mProject.makeIntermediatePath() / LinkManifest::sFilename);
+    linkManifest.load();
+    std::unique_ptr<IncludeGraphCache> pLoadedIncludeGraphCache;
+    auto pIncludeGraphCache = this->mpIncludeGraphCache;
+    if (!pIncludeGraphCache) {
+        pLoadedIncludeGraphCache = std::make_unique<IncludeGraphCache>(this->mProject.makeIntermediatePath() / IncludeGraphCache::sFilename);
+        pLoadedIncludeGraphCache->load();
+        pIncludeGraphCache = pLoadedIncludeGraphCache.get();
+    }
+    IncludeClosureMemo includeClosureMemo;
+    // the cache lives outside the intermediate directory, so "clean" keeps it.
+    std::unique_ptr<ObjectCache> pObjectCache;
+    if (!this->mOptions.objectCacheDirectory.empty()) {
+        pObjectCache = std::make_unique<ObjectCache>(this->mOptions.objectCacheDirectory, this->mOptions.objectCacheSize);
+        if (!pObjectCache->open()) {
+            pObjectCache.reset();
+        }
+    }
+    std::unique_ptr<RemoteCache> pRemoteCache;
+    if (pObjectCache && !this->mOptions.remoteCacheUrl.empty()) {
+        pRemoteCache = std::make_unique<RemoteCache>(this->mOptions.remoteCacheUrl, *pObjectCache, this->mProject.rootDirectory);
+        if (!pRemoteCache->open()) {
+            pRemoteCache.reset();
+        }
+    }
+
+    ProcessServer processServer(useEventLoop ? 1 : jobCount, this->mOptions.schedulerType());
+    processServer.setJobServer(pJobServer.get());
+    processServer.setMaxLoadAverage(this->mOptions.maxLoadAverage);
+    processServer.setBuildLog(&buildLog);
+    processServer.setMemoryLimit(this->mOptions.memoryLimit);
+    std::vector<std::thread> threads(useEventLoop ? 0 : processServer.workerCount());
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i] = std::thread(runThread, std::ref(processServer), i);
+    }
+    // the remote slots are threads besides the local ones, even with --event-loop.
+    auto remoteWorkers = connectRemoteWorkers(this->mOptions.workers, this->mOptions.workersToken);
+    for (auto& pWorker : remoteWorkers) {
+        for (size_t i = 0; i < pWorker->slotCount; ++i) {
+            threads.emplace_back(runRemoteThread, std::ref(processServer), std::ref(*pWorker), threads.size());
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mRunningMutex);
+        this->mpRunningProcessServer = &processServer;
     }
     Finally fin([&]() {
-        isFinish = true;
+        {
+            std::lock_guard<std::mutex> lock(this->mRunningMutex);
+            this->mpRunningProcessServer = nullptr;
+        }
+        processServer.abort();
         for (auto&& t : threads) {
             if (t.joinable()) { t.join(); }
         }
@@ -103,60 +384,172 @@ void Builder::build()const
     createDirectory(this->mProject.makeIntermediatePath());
     std::vector<fs::path> linkTargets;
     linkTargets.reserve(this->mProject.targets.size());
-    for (auto& target : this->mProject.targets) {
-        auto outputFilepath = this->mProject.makeIntermediatePath(target).replace_extension(".o");
-        auto pProcess = std::make_unique<Process>(*this, compiler, this->mProject.rootDirectory/target, outputFilepath);
-        processServer.addProcess(std::move(pProcess));
+    std::vector<std::unique_ptr<Process>> processes;
+    processes.reserve(this->mProject.targets.size());
+    // the sources of the C++20 named modules. they are compiled alone and without the precompiled header,
+    // since the module declaration must come first.
+    std::unique_ptr<ModuleScanner> pModuleScanner;
+    std::unordered_map<std::string, ModuleScanner::Unit> moduleUnits;
+    auto& compileTask = taskBundle.compileObj;
+    if (!compileTask.moduleMapperOption.empty() || !compileTask.moduleFileOption.empty()) {
+        bool useScanDeps = 0 == compiler.name.compare(0, 5, "clang") && !data::findProgram("clang-scan-deps").empty();
+        pModuleScanner = std::make_unique<ModuleScanner>(this->mProject, compileTask, useScanDeps);
+        pModuleScanner->load();
+        for (auto& target : this->mProject.targets) {
+            auto inputFilepath = this->mProject.rootDirectory/target;
+            ModuleScanner::Unit unit;
+            if (".c" != inputFilepath.extension()
+                && pModuleScanner->scan(inputFilepath, findFileFilter(this->mProject, inputFilepath), &unit)
+                && !unit.empty()) {
+                moduleUnits[inputFilepath.generic_string()] = std::move(unit);
+            }
+        }
+        pModuleScanner->save();
+    }
+    auto isModuleUnit = [&](fs::path const& inputFilepath) {
+        return 0 < moduleUnits.count(inputFilepath.generic_string());
+    };
+
+    // the precompiled header is compiled before the targets which include it.
+    std::unique_ptr<PrecompiledHeader> pPrecompiledHeader;
+    if (0.0 < this->mProject.precompiledHeaderRatio) {
+        std::vector<fs::path> inputFilepaths;
+        for (auto& target : this->mProject.targets) {
+            if (isPrecompiledHeaderTarget(this->mProject, this->mProject.rootDirectory/target)
+                && !isModuleUnit(this->mProject.rootDirectory/target)) {
+                inputFilepaths.push_back(this->mProject.rootDirectory/target);
+            }
+        }
+        pPrecompiledHeader = std::make_unique<PrecompiledHeader>(this->mProject, taskBundle.compileObj, this->mProject.precompiledHeaderRatio);
+        if (!pPrecompiledHeader->prepare(inputFilepaths)) {
+            pPrecompiledHeader.reset();
+        } else if (!pPrecompiledHeader->build(&dependencyStore)) {
+            cerr << "warning: failed to compile the precompiled header. compile the targets without it." << endl;
+            pPrecompiledHeader.reset();
+        }
+    }
+
+    auto addProcess = [&](fs::path const& inputFilepath, fs::path const& outputFilepath) {
+        auto pProcess = std::make_unique<Process>(*this, compiler, inputFilepath, outputFilepath);
+        pProcess->pDependencyStore = &dependencyStore;
+        pProcess->pIncludeGraphCache = pIncludeGraphCache;
+        pProcess->pIncludeClosureMemo = &includeClosureMemo;
+        pProcess->pObjectCache = pObjectCache.get();
+        pProcess->pRemoteCache = pRemoteCache.get();
+        if (pPrecompiledHeader && isPrecompiledHeaderTarget(this->mProject, inputFilepath) && !isModuleUnit(inputFilepath)) {
+            pProcess->precompiledHeader = pPrecompiledHeader->headerFilepath();
+            pProcess->precompiledHeaderSignature = pPrecompiledHeader->signature();
+        }
+        processes.push_back(std::move(pProcess));
 
         linkTargets.push_back(outputFilepath);
+    };
+
+    std::vector<fs::path> singleTargets;
+    std::vector<fs::path> unityTargets;
+    for (auto& target : this->mProject.targets) {
+        if (0 < this->mProject.unityCount && isUnityTarget(this->mProject, this->mProject.rootDirectory/target)
+            && !isModuleUnit(this->mProject.rootDirectory/target)) {
+            unityTargets.push_back(target);
+        } else {
+            singleTargets.push_back(target);
+        }
+    }
+    UnityBuild unityBuild(this->mProject, static_cast<size_t>(std::max(this->mProject.unityCount, 1)));
+    if (!unityTargets.empty()) {
+        if (unityBuild.prepare(unityTargets)) {
+            for (auto& unit : unityBuild.units()) {
+                addProcess(unit.sourceFilepath, unit.outputFilepath);
+            }
+            auto& isolatedTargets = unityBuild.isolatedTargets();
+            singleTargets.insert(singleTargets.end(), isolatedTargets.begin(), isolatedTargets.end());
+        } else {
+            cerr << "warning: failed to prepare the unity build. compile each target alone." << endl;
+            singleTargets.insert(singleTargets.end(), unityTargets.begin(), unityTargets.end());
+        }
+    }
+    for (auto& target : singleTargets) {
+        addProcess(this->mProject.rootDirectory/target, this->mProject.makeIntermediatePath(target).replace_extension(".o"));
+    }
+    if (!moduleUnits.empty()) {
+        connectModules(processes, moduleUnits, *pModuleScanner);
     }
 
-    runThread(isFinish, processServer, true);
+    // the link waits for all objects, and runs the link preprocess only when it links.
+    // the cancelled sources are compiled by the next build, so the link is cancelled too.
+    auto outputFilepath = this->mProject.makeOutputFilepath();
+    Scope linkScope;
+    linkScope.outputFilepath = outputFilepath;
+    auto pLink = std::make_unique<Process>(*this, compiler, Process::Type::Link);
+    pLink->outputFilepath = outputFilepath;
+    pLink->linkInputFilepaths = linkTargets;
+    pLink->pLinkManifest = &linkManifest;
+    pLink->hookCommand = this->parseVariables(this->mProject.linkPreprocess, linkScope);
+    for (auto& pProcess : processes) {
+        pLink->dependencies.push_back(pProcess.get());
+    }
+    processes.push_back(std::move(pLink));
+    processServer.addProcesses(std::move(processes));
+    processServer.closeProcess();
+
+#ifndef _WIN32
+    if (useEventLoop) {
+        runEventLoop(processServer, jobCount);
+    }
+#endif
+    processServer.waitForFinish();
     for (auto&& t : threads) {
         t.join();
     }
     threads.clear();
-
-    auto outputPath = this->mProject.makeOutputFilepath();
-    bool isLink = (0 == processServer.failedCount() && 1 <= processServer.successCount());
-    isLink |= !fs::exists(outputPath) && processServer.failedCount() <= 0;
-    if (isLink) {
-        auto outputFilepath = this->mProject.makeOutputFilepath();
-        createDirectory(outputFilepath.parent_path());
-        Scope scope;
-        scope.outputFilepath = outputFilepath;
-        if (!runCommand(this->parseVariables(this->mProject.linkPreprocess, scope))) {
-            cerr << "Failed link preprocess..." << endl;
-            return;
-        }
-
-        auto linkCmd = data::makeLinkCommand(taskBundle.linkObjs, outputFilepath, linkTargets, this->mProject);
-        cout << "running: " << linkCmd << endl;
-        if (!runCommand(linkCmd)) {
-            cerr << "Failed to link." << endl;
-            return;
-        }
-    } else {
-        cout << "skip link" << endl;
+    buildLog.close();
+    dependencyStore.close();
+    pIncludeGraphCache->save();
+    if (pRemoteCache) {
+        // the uploads finish before the eviction of the object cache.
+        pRemoteCache->close();
+        auto stats = pRemoteCache->stats();
+        cout << "remote cache: " << stats.hitCount << " hits, " << stats.missCount << " misses, "
+            << stats.uploadCount << " uploaded, " << stats.errorCount << " errors" << endl;
+    }
+    if (pObjectCache) {
+        pObjectCache->close();
+        auto stats = pObjectCache->stats();
+        auto total = pObjectCache->totalStats();
+        cout << "object cache: " << stats.hitCount << " hits, " << stats.missCount << " misses, " << stats.storeCount << " stored"
+            << " (total " << total.hitCount << " hits, " << total.missCount << " misses, "
+            << total.size / (1024 * 1024) << "MB, " << total.evictCount << " evicted)" << endl;
     }
 
-    if (!runCommand(this->parseVariables(this->mProject.postprocess, Scope()))) {
+    // the postprocess runs after a failed or cancelled compile too, so it isn't a node of the graph.
+    // it doesn't run after the link or the link preprocess failed.
+    if (processServer.failedCount() == processServer.failedCompileCount()
+        && !runCommand(this->parseVariables(this->mProject.postprocess, Scope()))) {
         cerr << "Failed postprocess..." << endl;
         return;
     }
+    if (0 < processServer.failedCount()) {
+        cerr << "Failed to build..." << endl;
+        return;
+    }
     cout << "!! Complete build !!" << endl;
 }
 
 void Builder::clean()const
 {
     boost::system::error_code ec;
-    {// remove all intermediate files
+    {// remove all intermediate files except the build log
         auto path = this->mProject.makeIntermediatePath();
         if (fs::exists(path)) {
-            fs::remove_all(path, ec);
-            if (boost::system::errc::success != ec) {
-                AWESOME_THROW(std::runtime_error)
-                    << "Failed to remove intermediate directory";
+            for (auto& entry : fs::directory_iterator(path)) {
+                if (BuildLog::sFilename == entry.path().filename()) {
+                    continue;
+                }
+                fs::remove_all(entry.path(), ec);
+                if (boost::system::errc::success != ec) {
+                    AWESOME_THROW(std::runtime_error)
+                        << "Failed to remove intermediate directory";
+                }
             }
         }
     }
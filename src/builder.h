@@ -4,6 +4,8 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <unordered_set>
 #include <boost/filesystem.hpp>
 
 #include "programOptions.h"
@@ -16,6 +18,7 @@ namespace watagashi
 {
 struct ProgramOptions;
 class ProcessServer;
+class IncludeGraphCache;
 
 namespace data
 {
@@ -41,8 +44,14 @@ public:
 
     void addCompiler(data::Compiler const& compiler);
     void addCompiler(data::Compiler && compiler);
+    // Use the include graph kept by the daemon between builds instead of loading it each build.
+    // The builder still saves it, so that the builds without the daemon share it.
+    void setIncludeGraphCache(IncludeGraphCache* pIncludeGraphCache);
 
     void build()const;
+    // Cancel the running compiles of the sources in the build, so that the next build compiles their new contents.
+    // The sources are absolute and normal paths. Any thread may call it.
+    void cancelCompiles(std::unordered_set<std::string> const& inputFilepaths)const;
     void clean()const;
     void rebuild()const;
     void listupFiles()const;
@@ -59,6 +68,9 @@ private:
     data::Project const& mProject;
     ProgramOptions const& mOptions;
     std::unordered_map<std::string, data::Compiler> mCompilerMap;
+    IncludeGraphCache* mpIncludeGraphCache;
+    mutable std::mutex mRunningMutex;
+    mutable ProcessServer* mpRunningProcessServer;
 };
 
 }
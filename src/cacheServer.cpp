@@ -0,0 +1,251 @@
+// watagashi-cache-server: a minimal server of --remote-cache.
+// It keeps "/.../ac/<key>" and "/.../cas/<digest>" as files in a directory, and never removes them.
+// The keys are SHA-256, and an object is stored only when its content has the digest.
+// It listens on the loopback unless --listen is given. Listen on a trusted network only,
+// since it has no authentication and any client may replace the manifests.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <unistd.h>
+
+#include "sha256.h"
+
+using namespace std;
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace fs = boost::filesystem;
+
+// objects are a few MB at most, and a large one with debug information is a few hundred MB.
+static uint64_t const sMaxBodySize = 256ull * 1024 * 1024;
+// a connection which sends nothing for this long is closed, so it doesn't keep its session.
+static auto const sIdleTimeout = std::chrono::seconds(60);
+
+static std::atomic<size_t> sTemporaryIndex(0);
+
+//--------------------------------------------------------------------------------------
+//
+//  class Sessions
+//
+//--------------------------------------------------------------------------------------
+
+// Limits the connections served at once, since each has a thread.
+class Sessions
+{
+public:
+    explicit Sessions(size_t count)
+        : mCount(count)
+    {}
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(this->mMutex);
+        this->mCV.wait(lock, [&]() { return 0 < this->mCount; });
+        --this->mCount;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mMutex);
+            ++this->mCount;
+        }
+        this->mCV.notify_one();
+    }
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCV;
+    size_t mCount;
+};
+
+// Map "/prefix/ac/<hex>" to "directory/ac/<hex>". Return false for the other targets.
+static bool makeEntryPath(fs::path const& directory, boost::string_view target, fs::path* pOutPath)
+{
+    auto slash = target.rfind('/');
+    if (boost::string_view::npos == slash || 0 == slash) {
+        return false;
+    }
+    auto key = target.substr(slash + 1);
+    auto kindBegin = target.rfind('/', slash - 1);
+    auto kind = boost::string_view::npos == kindBegin ? target.substr(0, slash) : target.substr(kindBegin + 1, slash - kindBegin - 1);
+    if (("ac" != kind && "cas" != kind) || !watagashi::Sha256::sIsDigest(key.to_string())) {
+        return false;
+    }
+    *pOutPath = directory / kind.to_string() / key.to_string();
+    return true;
+}
+
+static http::response<http::string_body> handleRequest(fs::path const& directory, http::request<http::string_body>& req)
+{
+    http::response<http::string_body> res(http::status::ok, req.version());
+    res.keep_alive(req.keep_alive());
+
+    fs::path entryPath;
+    if (!makeEntryPath(directory, req.target(), &entryPath)) {
+        res.result(http::status::bad_request);
+        res.prepare_payload();
+        return res;
+    }
+
+    switch (req.method()) {
+    case http::verb::get:
+    case http::verb::head:
+    {
+        std::ifstream in(entryPath.string(), std::ios::binary);
+        if (!in) {
+            res.result(http::status::not_found);
+            break;
+        }
+        res.body().assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        break;
+    }
+    case http::verb::put:
+    {
+        // nobody can put an object to the digest of another.
+        if ("cas" == entryPath.parent_path().filename() && watagashi::Sha256::sHash(req.body()) != entryPath.filename().string()) {
+            res.result(http::status::bad_request);
+            break;
+        }
+        // write a temporary file and rename it, so that a reader never sees a half written entry.
+        auto temporaryPath = directory / "tmp" / (std::to_string(::getpid()) + "." + std::to_string(sTemporaryIndex++) + ".tmp");
+        {
+            std::ofstream out(temporaryPath.string(), std::ios::binary | std::ios::trunc);
+            out.write(req.body().data(), req.body().size());
+            if (!out) {
+                res.result(http::status::insufficient_storage);
+                break;
+            }
+        }
+        boost::system::error_code ec;
+        fs::rename(temporaryPath, entryPath, ec);
+        if (ec) {
+            fs::remove(temporaryPath, ec);
+            res.result(http::status::internal_server_error);
+            break;
+        }
+        res.result(http::status::created);
+        break;
+    }
+    default:
+        res.result(http::status::method_not_allowed);
+        break;
+    }
+    if (http::verb::head == req.method()) {
+        auto size = res.body().size();
+        res.body().clear();
+        res.content_length(size);
+    } else {
+        res.prepare_payload();
+    }
+    return res;
+}
+
+// Serve the connection on its own io_context. The timeout of the stream applies only to the async operations.
+static void runSession(fs::path const& directory, Sessions& sessions, std::unique_ptr<asio::io_context> pIoContext, asio::ip::tcp::socket socket)
+{
+    beast::tcp_stream stream(std::move(socket));
+    beast::flat_buffer buffer;
+    beast::error_code ec;
+    auto run = [&]() {
+        pIoContext->restart();
+        pIoContext->run();
+    };
+    while (true) {
+        http::request_parser<http::string_body> parser;
+        parser.body_limit(sMaxBodySize);
+        stream.expires_after(sIdleTimeout);
+        http::async_read(stream, buffer, parser, [&](beast::error_code const& e, size_t) { ec = e; });
+        run();
+        if (ec) {
+            break;
+        }
+        auto req = parser.release();
+        auto res = handleRequest(directory, req);
+        stream.expires_after(sIdleTimeout);
+        http::async_write(stream, res, [&](beast::error_code const& e, size_t) { ec = e; });
+        run();
+        if (ec || !res.keep_alive()) {
+            break;
+        }
+    }
+    stream.socket().shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+    stream.close();
+    sessions.release();
+}
+
+int main(int argc, char** argv)
+{
+    namespace po = boost::program_options;
+
+    std::string listen;
+    unsigned short port = 0;
+    size_t maxConnectionCount = 0;
+    std::string directoryStr;
+    po::options_description options(
+        R"(Usage) watagashi-cache-server --directory <dir> [--listen <address>] [--port <port>])" "\n"
+        R"(serve the directory as the remote cache of "watagashi --remote-cache http://host:port".)"
+    );
+    options.add_options()
+        ("help,h", "show this.")
+        ("listen", po::value<std::string>(&listen)->default_value("127.0.0.1"), "listen address. listen on a trusted network only, since any client may write.")
+        ("port", po::value<unsigned short>(&port)->default_value(8080), "listen port.")
+        ("max-connections", po::value<size_t>(&maxConnectionCount)->default_value(64), "count of the connections served at once. the others wait.")
+        ("directory,d", po::value<std::string>(&directoryStr), "directory which keeps the entries.")
+    ;
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, options), vm);
+        po::notify(vm);
+        if (vm.count("help") || directoryStr.empty()) {
+            cout << options << endl;
+            return vm.count("help") ? 0 : 1;
+        }
+    } catch (std::exception& e) {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+
+    fs::path directory(directoryStr);
+    boost::system::error_code ec;
+    for (auto kind : { "ac", "cas", "tmp" }) {
+        fs::create_directories(directory / kind, ec);
+        if (ec) {
+            cerr << "error: can't create the directory. path=" << (directory / kind).string() << endl;
+            return 1;
+        }
+    }
+
+    Sessions sessions(std::max<size_t>(1, maxConnectionCount));
+    try {
+        asio::io_context ioContext;
+        asio::ip::tcp::acceptor acceptor(ioContext, asio::ip::tcp::endpoint(asio::ip::make_address(listen), port));
+        cout << "watagashi-cache-server: listening on " << acceptor.local_endpoint() << endl;
+        while (true) {
+            sessions.acquire();
+            auto pSessionContext = std::make_unique<asio::io_context>();
+            asio::ip::tcp::socket socket(*pSessionContext);
+            acceptor.accept(socket);
+            std::thread(runSession, directory, std::ref(sessions), std::move(pSessionContext), std::move(socket)).detach();
+        }
+    } catch (std::exception& e) {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
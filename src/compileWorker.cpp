@@ -0,0 +1,419 @@
+// watagashi-worker: compiles the preprocessed sources sent by "watagashi --workers".
+// It listens on the loopback unless --listen is given, and a request must have the token of --token-file,
+// which is required for the other addresses. The command runs without a shell, only when it starts with
+// one of the allowed compilers exactly and has only the options which change the code generation
+// or the diagnostics, so a request can't run other programs or touch the files of the worker.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_set>
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace fs = boost::filesystem;
+
+extern char** environ;
+
+// the placeholders of WorkerClient.
+static char const* const sInputPlaceholderC = "watagashi-worker-input.i";
+static char const* const sInputPlaceholderCpp = "watagashi-worker-input.ii";
+static char const* const sOutputPlaceholder = "watagashi-worker-output.o";
+
+// preprocessed sources are a few MB at most.
+static uint64_t const sMaxBodySize = 1024ull * 1024 * 1024;
+
+//--------------------------------------------------------------------------------------
+//
+//  class Slots
+//
+//--------------------------------------------------------------------------------------
+
+// Limits the compilers running at once, even when several builders share the worker.
+class Slots
+{
+public:
+    explicit Slots(size_t count)
+        : mCount(count)
+    {}
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(this->mMutex);
+        this->mCV.wait(lock, [&]() { return 0 < this->mCount; });
+        --this->mCount;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mMutex);
+            ++this->mCount;
+        }
+        this->mCV.notify_one();
+    }
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCV;
+    size_t mCount;
+};
+
+struct Config
+{
+    fs::path temporaryDirectory;
+    size_t slotCount = 1;
+    std::unordered_set<std::string> allowedCompilers;
+    // empty accepts any request. only on the loopback.
+    std::string token;
+};
+
+static std::atomic<size_t> sRequestIndex(0);
+
+// Split the command like the shell does for the commands which makeCompileCommand() makes.
+// boost::filesystem::path quotes the paths by '"' and escapes by '&'.
+static bool splitArguments(std::string const& command, std::vector<std::string>* pOut)
+{
+    pOut->clear();
+    std::string arg;
+    bool hasArg = false;
+    char quote = '\0';
+    for (size_t i = 0; i < command.size(); ++i) {
+        auto c = command[i];
+        if ('\0' != quote) {
+            if ('"' == quote && '&' == c && i + 1 < command.size()) {
+                arg += command[++i];
+            } else if (quote == c) {
+                quote = '\0';
+            } else {
+                arg += c;
+            }
+            continue;
+        }
+        if (' ' == c || '\t' == c) {
+            if (hasArg) {
+                pOut->push_back(std::move(arg));
+                arg.clear();
+                hasArg = false;
+            }
+            continue;
+        }
+        // the shell would expand them, and the command never needs them.
+        if (std::string::npos != std::string("|;<>`$\\").find(c)) {
+            return false;
+        }
+        if ('"' == c || '\'' == c) {
+            quote = c;
+        } else {
+            arg += c;
+        }
+        hasArg = true;
+    }
+    if (hasArg) {
+        pOut->push_back(std::move(arg));
+    }
+    return '\0' == quote && !pOut->empty();
+}
+
+static bool startsWith(std::string const& str, char const* prefix)
+{
+    return 0 == str.compare(0, std::char_traits<char>::length(prefix), prefix);
+}
+
+// Return true for the options which only change the code generation or the diagnostics.
+// The others may run programs or read and write the files of the worker, like -wrapper, -specs=, -B,
+// -fplugin=, -Wl, and @file, so they are rejected.
+static bool isAllowedOption(std::string const& arg)
+{
+    static char const* const sDeniedPrefixes[] = {
+        "-fplugin", "-fmodule", "-fdump", "-fprofile", "-fauto-profile", "-fcreate-profile",
+        "-fcoverage", "-fopt-info", "-fcallgraph-info", "-ftime-trace", "-fsave-optimization-record",
+        "-fsanitize-blacklist", "-fsanitize-ignorelist", "-fsanitize-coverage-allowlist",
+        "-fsanitize-coverage-ignorelist", "-fxray-attr-list", "-fxray-always-instrument",
+        "-fxray-never-instrument", "-fuse-ld", "-fcrash-diagnostics", "-fembed-offload-object",
+        "-Wl,", "-Wa,", "-Wp,", "-mllvm",
+    };
+    for (auto prefix : sDeniedPrefixes) {
+        if (startsWith(arg, prefix)) {
+            return false;
+        }
+    }
+    if (startsWith(arg, "-f")) {
+        // the values of the allowed ones are never paths.
+        auto equal = arg.find('=');
+        return std::string::npos == equal || std::string::npos == arg.find('/', equal);
+    }
+    return startsWith(arg, "-D")
+        || startsWith(arg, "-U")
+        || startsWith(arg, "-I")
+        || startsWith(arg, "-std=")
+        || startsWith(arg, "-O")
+        || startsWith(arg, "-W")
+        || startsWith(arg, "-g")
+        || startsWith(arg, "-m")
+        || startsWith(arg, "-pedantic")
+        || "-c" == arg
+        || "-w" == arg
+        || "-pthread" == arg;
+}
+
+// Check the arguments after the compiler and replace the placeholders with the files in directory.
+// Return false when the command has an option which isn't allowed, or doesn't have exactly one input and output.
+static bool replaceArguments(std::vector<std::string>& args, fs::path const& directory, fs::path* pOutInputPath)
+{
+    size_t inputCount = 0;
+    size_t outputCount = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        auto& arg = args[i];
+        if (sInputPlaceholderC == arg || sInputPlaceholderCpp == arg) {
+            *pOutInputPath = directory / arg;
+            arg = pOutInputPath->string();
+            ++inputCount;
+        } else if ("-o" == arg) {
+            if (args.size() <= i + 1 || sOutputPlaceholder != args[i + 1]) {
+                return false;
+            }
+            ++i;
+            args[i] = (directory / args[i]).string();
+            ++outputCount;
+        } else if ("-D" == arg || "-U" == arg || "-I" == arg) {
+            // the value is the next argument.
+            if (args.size() <= i + 1) {
+                return false;
+            }
+            ++i;
+        } else if ("-x" == arg) {
+            static std::unordered_set<std::string> const sLanguages = { "c", "c++", "cpp-output", "c++-cpp-output" };
+            if (args.size() <= i + 1 || 0 == sLanguages.count(args[i + 1])) {
+                return false;
+            }
+            ++i;
+        } else if (!isAllowedOption(arg)) {
+            return false;
+        }
+    }
+    return 1 == inputCount && 1 == outputCount;
+}
+
+// Compare in a constant time, so the time doesn't tell how much of the token matched.
+static bool isSameToken(std::string const& a, std::string const& b)
+{
+    unsigned char diff = a.size() == b.size() ? 0 : 1;
+    for (size_t i = 0; i < a.size(); ++i) {
+        diff |= static_cast<unsigned char>(a[i] ^ (i < b.size() ? b[i] : 0));
+    }
+    return 0 == diff;
+}
+
+// Run the compiler with the output to messagePath. Return true when it succeeded.
+static bool runCompiler(std::vector<std::string>& args, fs::path const& messagePath)
+{
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, messagePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    pid_t pid;
+    auto error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (0 != error) {
+        std::ofstream(messagePath.string(), std::ios::app) << "watagashi-worker: failed to run '" << argv[0] << "'.\n";
+        return false;
+    }
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0) {
+        if (EINTR != errno) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && 0 == WEXITSTATUS(status);
+}
+
+static std::string readAll(fs::path const& filepath)
+{
+    std::ifstream in(filepath.string(), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static http::status compile(Config const& config, Slots& slots, std::string const& request, std::string* pOutBody)
+{
+    auto newline = request.find('\n');
+    if (std::string::npos == newline) {
+        return http::status::bad_request;
+    }
+    std::vector<std::string> args;
+    if (!splitArguments(request.substr(0, newline), &args)) {
+        return http::status::bad_request;
+    }
+    // the compiler is run through PATH of the worker, so a path sent by the builder isn't trusted.
+    if (0 == config.allowedCompilers.count(args[0])) {
+        return http::status::forbidden;
+    }
+
+    auto directory = config.temporaryDirectory / ("watagashi-worker." + std::to_string(::getpid()) + "." + std::to_string(sRequestIndex++));
+    fs::path inputPath;
+    if (!replaceArguments(args, directory, &inputPath)) {
+        return http::status::forbidden;
+    }
+    boost::system::error_code ec;
+    fs::create_directories(directory, ec);
+    if (ec) {
+        return http::status::internal_server_error;
+    }
+    {
+        std::ofstream out(inputPath.string(), std::ios::binary | std::ios::trunc);
+        out.write(request.data() + newline + 1, request.size() - newline - 1);
+        if (!out) {
+            fs::remove_all(directory, ec);
+            return http::status::insufficient_storage;
+        }
+    }
+
+    auto messagePath = directory / "message.txt";
+    slots.acquire();
+    bool isSuccess = runCompiler(args, messagePath);
+    slots.release();
+
+    auto message = readAll(messagePath);
+    *pOutBody = std::to_string(message.size()) + "\n" + message;
+    if (isSuccess) {
+        *pOutBody += readAll(directory / sOutputPlaceholder);
+    }
+    fs::remove_all(directory, ec);
+    return isSuccess ? http::status::ok : http::status::unprocessable_entity;
+}
+
+static void runSession(Config const& config, Slots& slots, asio::ip::tcp::socket socket)
+{
+    beast::flat_buffer buffer;
+    beast::error_code ec;
+    while (true) {
+        http::request_parser<http::string_body> parser;
+        parser.body_limit(sMaxBodySize);
+        http::read(socket, buffer, parser, ec);
+        if (ec) {
+            break;
+        }
+        auto req = parser.release();
+        http::response<http::string_body> res(http::status::ok, req.version());
+        res.keep_alive(req.keep_alive());
+        if (!config.token.empty() && !isSameToken("Bearer " + config.token, std::string(req[http::field::authorization]))) {
+            res.result(http::status::unauthorized);
+        } else if (http::verb::get == req.method() && "/status" == req.target()) {
+            res.body() = "slots " + std::to_string(config.slotCount) + "\n";
+        } else if (http::verb::post == req.method() && "/compile" == req.target()) {
+            res.result(compile(config, slots, req.body(), &res.body()));
+        } else {
+            res.result(http::status::not_found);
+        }
+        res.prepare_payload();
+        http::write(socket, res, ec);
+        if (ec || !res.keep_alive()) {
+            break;
+        }
+    }
+    socket.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+}
+
+int main(int argc, char** argv)
+{
+    namespace po = boost::program_options;
+
+    std::string listen;
+    unsigned short port = 0;
+    size_t jobCount = 0;
+    std::string allowed;
+    std::string tokenFilepath;
+    std::string temporaryDirectory;
+    po::options_description options(
+        R"(Usage) watagashi-worker [--listen <address>] [--port <port>] [--token-file <path>] [--jobs <count>])" "\n"
+        R"(compile the preprocessed sources sent by "watagashi --workers host:port".)"
+    );
+    options.add_options()
+        ("help,h", "show this.")
+        ("listen", po::value<std::string>(&listen)->default_value("127.0.0.1"), "listen address. an address other than the loopback needs --token-file.")
+        ("port", po::value<unsigned short>(&port)->default_value(3633), "listen port.")
+        ("token-file", po::value<std::string>(&tokenFilepath), R"(file of the token which the builders must send. give the same file to "watagashi --workers-token-file".)")
+        ("jobs,j", po::value<size_t>(&jobCount)->default_value(0), "count of the compilers running at once. 0 is the count of CPUs.")
+        ("allow", po::value<std::string>(&allowed)->default_value("cc,c++,gcc,g++,clang,clang++"), "comma separated compilers which the builders may run. the command must start with one of them exactly, and it is found in PATH of the worker.")
+        ("temporary-directory", po::value<std::string>(&temporaryDirectory)->default_value(fs::temp_directory_path().string()), "directory of the sources and the objects while compiling.")
+    ;
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, options), vm);
+        po::notify(vm);
+        if (vm.count("help")) {
+            cout << options << endl;
+            return 0;
+        }
+    } catch (std::exception& e) {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+
+    Config config;
+    config.temporaryDirectory = temporaryDirectory;
+    config.slotCount = 0 < jobCount ? jobCount : std::max(1u, std::thread::hardware_concurrency());
+    std::istringstream allowedStream(allowed);
+    for (std::string compiler; std::getline(allowedStream, compiler, ',');) {
+        if (!compiler.empty()) {
+            config.allowedCompilers.insert(compiler);
+        }
+    }
+    if (!tokenFilepath.empty()) {
+        std::ifstream in(tokenFilepath);
+        std::getline(in, config.token);
+        if (config.token.empty()) {
+            cerr << "error: failed to read the token. path=" << tokenFilepath << endl;
+            return 1;
+        }
+    }
+    Slots slots(config.slotCount);
+
+    try {
+        auto address = asio::ip::make_address(listen);
+        if (!address.is_loopback() && config.token.empty()) {
+            cerr << "error: --listen " << listen << " needs --token-file." << endl;
+            return 1;
+        }
+        asio::io_context ioContext;
+        asio::ip::tcp::acceptor acceptor(ioContext, asio::ip::tcp::endpoint(address, port));
+        cout << "watagashi-worker: listening on " << acceptor.local_endpoint()
+            << " with " << config.slotCount << " slots" << endl;
+        while (true) {
+            asio::ip::tcp::socket socket(ioContext);
+            acceptor.accept(socket);
+            std::thread(runSession, std::cref(config), std::ref(slots), std::move(socket)).detach();
+        }
+    } catch (std::exception& e) {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
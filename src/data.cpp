@@ -1,10 +1,16 @@
 #include "data.h"
 
+#include <iostream>
+#include <mutex>
+#include <cstdlib>
+#include <unordered_map>
 #include <boost/bimap.hpp>
 #include <boost/assign.hpp>
 
 #include "exception.hpp"
 #include "includeFileAnalyzer.h"
+#include "dependencyStore.h"
+#include "linkManifest.h"
 
 namespace watagashi::data
 {
@@ -17,10 +23,44 @@ namespace watagashi::data
 static TaskProcess::Result runBuildInPocess(std::string const& content, TaskProcess::RunData const& data)
 {
     if ("checkUpdate" == content) {
-        return IncludeFileAnalyzer::sCheckUpdateTime(data.inputFilepath, data.outputFilepath, data.includeDirectories)
+        if (data.commandSignature != data.prevCommandSignature) {
+            return TaskProcess::Result::Success;
+        }
+        // the dependencies from the depfile need only stat(). scan the sources when the object has no depfile yet.
+        if (data.pDependencyStore) {
+            switch (data.pDependencyStore->check(data.outputFilepath, data.pIncludeClosureMemo)) {
+            case DependencyStore::State::UpToDate: return TaskProcess::Result::Skip;
+            case DependencyStore::State::Outdated: return TaskProcess::Result::Success;
+            default: break;
+            }
+        }
+        return IncludeFileAnalyzer::sCheckUpdateTime(data.inputFilepath, data.outputFilepath, data.includeDirectories, data.pIncludeGraphCache, data.pIncludeClosureMemo)
             ? TaskProcess::Result::Success
             : TaskProcess::Result::Skip;
     }
+    if ("checkLink" == content) {
+        if (data.pLinkManifest
+            && !data.pLinkManifest->isOutdated(data.outputFilepath, data.commandSignature, data.linkInputFilepaths)) {
+            // keep the new metadata of the objects so that they aren't hashed again.
+            data.pLinkManifest->save(data.outputFilepath);
+            std::cout << "skip link" << std::endl;
+            return TaskProcess::Result::Skip;
+        }
+        return TaskProcess::Result::Success;
+    }
+    if ("recordLink" == content) {
+        if (data.pLinkManifest) {
+            data.pLinkManifest->save(data.outputFilepath);
+        }
+        return TaskProcess::Result::Success;
+    }
+    if ("readDepfile" == content) {
+        if (data.pDependencyStore && !data.depfilePath.empty()
+            && !data.pDependencyStore->recordDepfile(data.outputFilepath, data.depfilePath)) {
+            std::cerr << "warning: the compiler didn't write the depfile. path=" << data.depfilePath << std::endl;
+        }
+        return TaskProcess::Result::Success;
+    }
 
     AWESOME_THROW(std::invalid_argument) << "unknown content... content=" << content;
     return TaskProcess::Result::Failed;
@@ -67,7 +107,8 @@ std::string makeCompileCommand(
     boost::filesystem::path const& outputFilepath,
     std::unordered_set<std::string> const& options,
     std::unordered_set<boost::filesystem::path> const& includeDirectories,
-    FileFilter const* pFileFilter)
+    FileFilter const* pFileFilter,
+    boost::filesystem::path const& precompiledHeader)
 {
     std::stringstream cmd;
     cmd << task.command;
@@ -89,6 +130,11 @@ std::string makeCompileCommand(
     }
     cmd << " " << outputFilepath;
 
+    // depfile option
+    if (!task.depfileOption.empty()) {
+        cmd << " " << task.depfileOption << " " << makeDepfilePath(outputFilepath);
+    }
+
     // options
     for (auto& op : options) {
         cmd << " " << op;
@@ -99,6 +145,11 @@ std::string makeCompileCommand(
         cmd << " -I" << dir;
     }
 
+    // precompiled header
+    if (!task.pchOption.empty() && !precompiledHeader.empty()) {
+        cmd << " " << task.pchOption << " " << precompiledHeader;
+    }
+
     if (pFileFilter) {
         // options
         for (auto& op : pFileFilter->compileOptions) {
@@ -124,9 +175,10 @@ std::string makeCompileCommand(
     boost::filesystem::path const& inputFilepath,
     boost::filesystem::path const& outputFilepath,
     Project const& project,
-    FileFilter const* pFileFilter)
+    FileFilter const* pFileFilter,
+    boost::filesystem::path const& precompiledHeader)
 {
-    return makeCompileCommand(task, inputFilepath, outputFilepath, project.compileOptions, project.includeDirectories, pFileFilter);
+    return makeCompileCommand(task, inputFilepath, outputFilepath, project.compileOptions, project.includeDirectories, pFileFilter, precompiledHeader);
 }
 
 std::string makeLinkCommand(
@@ -245,6 +297,31 @@ Task&& Task::setOptionSuffix(std::string&& options_)
     return std::move(*this);
 }
 
+Task&& Task::setDepfileOption(std::string&& option_)
+{
+    this->depfileOption = std::move(option_);
+    return std::move(*this);
+}
+
+Task&& Task::setPchOption(std::string&& option_)
+{
+    this->pchOption = std::move(option_);
+    return std::move(*this);
+}
+
+Task&& Task::setModuleOptions(std::string&& outputOption_, std::string&& fileOption_)
+{
+    this->moduleOutputOption = std::move(outputOption_);
+    this->moduleFileOption = std::move(fileOption_);
+    return std::move(*this);
+}
+
+Task&& Task::setModuleMapperOption(std::string&& option_)
+{
+    this->moduleMapperOption = std::move(option_);
+    return std::move(*this);
+}
+
 Task&& Task::setPreprocesses(std::vector<TaskProcess>&& processes_)
 {
     this->preprocesses = std::move(processes_);
@@ -378,6 +455,83 @@ boost::filesystem::path Project::makeIntermediatePath(boost::filesystem::path co
 //
 //--------------------------------------------------------------------------------------
 
+boost::filesystem::path makeDepfilePath(boost::filesystem::path const& outputFilepath)
+{
+    auto path = outputFilepath;
+    return path.replace_extension(".d");
+}
+
+boost::filesystem::path findProgram(std::string const& name)
+{
+    namespace fs = boost::filesystem;
+    boost::system::error_code ec;
+    if (std::string::npos != name.find_first_of("/\\")) {
+        return fs::absolute(name);
+    }
+#ifdef _WIN32
+    char const delimiter = ';';
+    std::vector<std::string> const extensions = { "", ".exe", ".bat", ".cmd" };
+#else
+    char const delimiter = ':';
+    std::vector<std::string> const extensions = { "" };
+#endif
+    auto pPath = std::getenv("PATH");
+    for (auto& dir : split(pPath ? pPath : "", delimiter)) {
+        for (auto& extension : extensions) {
+            auto filepath = fs::path(dir.empty() ? "." : dir) / (name + extension);
+            if (fs::is_regular_file(filepath, ec)) {
+                return filepath;
+            }
+        }
+    }
+    return {};
+}
+
+uint64_t makeCommandSignature(std::string const& command)
+{
+    namespace fs = boost::filesystem;
+
+    std::vector<std::string> args;
+    if (!splitCommandArguments(command, &args) || args.empty()) {
+        args = split(command, ' ');
+    }
+    auto program = args.empty() ? std::string() : args.front();
+
+    // resolve each program once for each PATH, which the daemon changes for each client.
+    // the cache lives as long as the daemon or the watch task, so the resolved program is stat()ed
+    // on every use and an upgraded compiler is noticed.
+    struct ProgramIdentity
+    {
+        fs::path filepath;
+        FileStat stat;
+        std::string identity;
+    };
+    static std::mutex sMutex;
+    static std::unordered_map<std::string, ProgramIdentity> sIdentityCache;
+    auto pPath = std::getenv("PATH");
+    auto key = program + '\0' + (pPath ? pPath : "");
+    std::string identity;
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        auto it = sIdentityCache.find(key);
+        FileStat stat;
+        bool isChanged = sIdentityCache.end() == it
+            || (!it->second.filepath.empty() && (!statFile(it->second.filepath, &stat) || stat != it->second.stat));
+        if (isChanged) {
+            ProgramIdentity entry;
+            entry.filepath = findProgram(program);
+            entry.identity = program;
+            if (!entry.filepath.empty() && statFile(entry.filepath, &entry.stat)) {
+                entry.identity = entry.filepath.string() + "\n" + std::to_string(entry.stat.size)
+                    + "\n" + std::to_string(entry.stat.mtime) + "\n" + std::to_string(entry.stat.inode);
+            }
+            it = sIdentityCache.insert_or_assign(key, std::move(entry)).first;
+        }
+        identity = it->second.identity;
+    }
+    return hashString(command, hashString(identity));
+}
+
 TaskBundle const& getTaskBundle(Compiler const& compiler, Project::Type type)
 {
     switch (type) {
@@ -8,6 +8,14 @@
 
 #include "utility.h"
 
+namespace watagashi
+{
+class DependencyStore;
+class IncludeGraphCache;
+class IncludeClosureMemo;
+class LinkManifest;
+}
+
 namespace watagashi::data
 {
 
@@ -28,6 +36,19 @@ struct TaskProcess
         boost::filesystem::path inputFilepath;
         boost::filesystem::path outputFilepath;
         std::unordered_set<boost::filesystem::path> includeDirectories;
+        // "checkUpdate" runs the compiler when the signature differs from the one of the last successful build.
+        uint64_t commandSignature = 0;
+        uint64_t prevCommandSignature = 0;
+        // "readDepfile" records the depfile to the store and "checkUpdate" looks up it.
+        boost::filesystem::path depfilePath;
+        DependencyStore* pDependencyStore = nullptr;
+        // "checkUpdate" scans the sources through it when the object has no depfile.
+        IncludeGraphCache* pIncludeGraphCache = nullptr;
+        // shares the stats and the include closures among the processes of the build.
+        IncludeClosureMemo* pIncludeClosureMemo = nullptr;
+        // "checkLink" skips the link when the objects are the same as the last link, and "recordLink" records them.
+        LinkManifest* pLinkManifest = nullptr;
+        std::vector<boost::filesystem::path> linkInputFilepaths;
     };
 
     Type type;
@@ -47,6 +68,17 @@ struct Task
     std::string outputOption;
     std::string optionPrefix;
     std::string optionSuffix;
+    // the option to write the depfile like "-MMD -MF". the depfile path follows it.
+    std::string depfileOption;
+    // the option to include a header first like "-include". the compiler uses its precompiled one next to it.
+    std::string pchOption;
+    // the options for the C++20 named modules. see ModuleScanner.
+    // moduleOutputOption writes the BMI of the exported module like "-fmodule-output=", and
+    // moduleFileOption reads the BMI of an imported module like "-fmodule-file=". the path and "<name>=<path>" follow them.
+    std::string moduleOutputOption;
+    std::string moduleFileOption;
+    // the option to give both by a file of "<name> <path>" lines like "-fmodule-mapper=". it is used instead when it isn't empty.
+    std::string moduleMapperOption;
 
     std::vector<TaskProcess> preprocesses;
     std::vector<TaskProcess> postprocesses;
@@ -57,6 +89,10 @@ struct Task
     Task&& setInputAndOutputOption(std::string const& input, std::string const& output);
     Task&& setOptionPrefix(std::string&& options);
     Task&& setOptionSuffix(std::string&& options);
+    Task&& setDepfileOption(std::string&& option);
+    Task&& setPchOption(std::string&& option);
+    Task&& setModuleOptions(std::string&& outputOption, std::string&& fileOption);
+    Task&& setModuleMapperOption(std::string&& option);
     Task&& setPreprocesses(std::vector<TaskProcess>&& processes);
     Task&& setPostprocesses(std::vector<TaskProcess>&& processes);
 
@@ -98,6 +134,8 @@ struct FileFilter
     std::unordered_set<std::string> compileOptions;
     std::unordered_set<boost::filesystem::path> includeDirectories;
 
+    // false compiles the matched files alone in the unity build.
+    bool unity = true;
 };
 
 struct Project
@@ -123,6 +161,10 @@ struct Project
 
     std::unordered_set<boost::filesystem::path> targets;
     std::vector<FileFilter> fileFilters;
+    // the count of the unity sources for each extension. 0 compiles each target alone.
+    int unityCount = 0;
+    // precompile the headers which this fraction of the targets include. 0 precompiles nothing.
+    double precompiledHeaderRatio = 0.0;
 
     // for compile
     std::unordered_set<std::string> compileOptions;
@@ -156,14 +198,17 @@ std::string makeCompileCommand(
     boost::filesystem::path const& outputFilepath,
     std::unordered_set<std::string> const& options,
     std::unordered_set<boost::filesystem::path> const& includeDirectories,
-    FileFilter const* pFileFilter);
+    FileFilter const* pFileFilter,
+    boost::filesystem::path const& precompiledHeader = boost::filesystem::path());
 
+// The command includes the precompiled header first when it isn't empty.
 std::string makeCompileCommand(
     Task const& task,
     boost::filesystem::path const& inputFilepath,
     boost::filesystem::path const& outputFilepath,
     Project const& project,
-    FileFilter const* pFileFilter);
+    FileFilter const* pFileFilter,
+    boost::filesystem::path const& precompiledHeader = boost::filesystem::path());
 
 std::string makeLinkCommand(
     Task const& task,
@@ -179,6 +224,15 @@ std::string makeLinkCommand(
     std::vector<boost::filesystem::path> const& targets,
     Project const& project);
 
+boost::filesystem::path makeDepfilePath(boost::filesystem::path const& outputFilepath);
+
+// Return the path of the program which the command runs by the name. empty when it isn't found in PATH.
+boost::filesystem::path findProgram(std::string const& name);
+
+// Return the hash of the command and the identity of its program, the resolved path, size, mtime and inode,
+// so that updating the compiler changes it too, even while the daemon or the watch task keeps running.
+uint64_t makeCommandSignature(std::string const& command);
+
 TaskBundle const& getTaskBundle(Compiler const& compiler, Project::Type type);
 
 }
\ No newline at end of file
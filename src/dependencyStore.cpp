@@ -0,0 +1,337 @@
+#include "dependencyStore.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#include "utility.h"
+#include "includeClosureMemo.h"
+#include "fileView.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sHeader = "# watagashi deps v1";
+
+// compact the store when it has this times more lines than the paths and the objects.
+static size_t const sCompactionRatio = 3;
+static size_t const sMinCompactionLineCount = 1000;
+
+char const* const DependencyStore::sFilename = ".watagashi_deps";
+
+//--------------------------------------------------------------------------------------
+//
+//  class DependencyStore
+//
+//--------------------------------------------------------------------------------------
+
+bool DependencyStore::sParseDepfile(boost::filesystem::path const& depfilePath, std::vector<std::string>* pOut)
+{
+    FileView view;
+    if (!view.open(depfilePath)) {
+        return false;
+    }
+    auto content = view.str();
+
+    // "target: dep1 dep2" continues to the next line by '\' at the end of the line.
+    // a space in a path is escaped by '\' and '$' by "$$".
+    std::vector<std::string> words;
+    std::string word;
+    auto pushWord = [&]() {
+        if (!word.empty()) {
+            words.push_back(std::move(word));
+            word.clear();
+        }
+    };
+    for (size_t i = 0; i < content.size(); ++i) {
+        auto c = content[i];
+        if ('\\' == c && i + 1 < content.size()) {
+            auto next = content[i + 1];
+            if ('\n' == next || '\r' == next) {
+                // line continuation
+                pushWord();
+                ++i;
+                if ('\r' == next && i + 1 < content.size() && '\n' == content[i + 1]) {
+                    ++i;
+                }
+                continue;
+            }
+            if (' ' == next || '#' == next || '\\' == next) {
+                word += next;
+                ++i;
+                continue;
+            }
+        }
+        if ('$' == c && i + 1 < content.size() && '$' == content[i + 1]) {
+            word += '$';
+            ++i;
+            continue;
+        }
+        if (' ' == c || '\t' == c || '\n' == c || '\r' == c) {
+            pushWord();
+            continue;
+        }
+        word += c;
+    }
+    pushWord();
+
+    pOut->clear();
+    for (auto& w : words) {
+        // skip the targets. "C:\path" of Windows has ':' in the middle, so only the last one marks a target.
+        if (':' == w.back()) {
+            continue;
+        }
+        pOut->push_back(std::move(w));
+    }
+    return true;
+}
+
+DependencyStore::DependencyStore(boost::filesystem::path const& filepath)
+    : mFilepath(filepath)
+{}
+
+DependencyStore::~DependencyStore()
+{
+    this->close();
+}
+
+bool DependencyStore::open()
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    uint64_t validSize = 0;
+    auto lineCount = this->load_(&validSize);
+    bool isRewrite = lineCount < 0
+        || (sMinCompactionLineCount <= static_cast<size_t>(lineCount)
+            && (this->mPaths.size() + this->mDependencies.size()) * sCompactionRatio < static_cast<size_t>(lineCount));
+    if (isRewrite && !this->rewrite_()) {
+        return false;
+    }
+    if (!isRewrite) {
+        // cut the line torn by an interrupted build, or the next line would be appended to it.
+        boost::system::error_code ec;
+        if (validSize < fs::file_size(this->mFilepath, ec) && !ec) {
+            fs::resize_file(this->mFilepath, validSize, ec);
+        }
+        if (ec) {
+            cerr << "warning: failed to repair the dependency store. path=" << this->mFilepath << " " << ec.message() << endl;
+            return false;
+        }
+    }
+
+    this->mOut.open(this->mFilepath.string(), std::ios::app);
+    if (!this->mOut) {
+        cerr << "warning: failed to open the dependency store. path=" << this->mFilepath << endl;
+        return false;
+    }
+    return true;
+}
+
+void DependencyStore::close()
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    if (this->mOut.is_open()) {
+        this->mOut.close();
+    }
+}
+
+bool DependencyStore::find(boost::filesystem::path const& outputFilepath, std::vector<std::string>* pOut)const
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    auto it = this->mDependencies.find(outputFilepath.generic_string());
+    if (this->mDependencies.end() == it) {
+        return false;
+    }
+    pOut->clear();
+    pOut->reserve(it->second.size());
+    for (auto id : it->second) {
+        pOut->push_back(this->mPaths[id]);
+    }
+    return true;
+}
+
+void DependencyStore::record(boost::filesystem::path const& outputFilepath, std::vector<std::string> const& dependencies)
+{
+    auto key = outputFilepath.generic_string();
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    std::ostream* pOut = this->mOut.is_open() ? &this->mOut : nullptr;
+
+    std::vector<uint32_t> ids;
+    ids.reserve(dependencies.size());
+    for (auto& dependency : dependencies) {
+        ids.push_back(this->pathId_(dependency, pOut));
+    }
+    if (pOut) {
+        *pOut << "d\t" << key << "\t";
+        for (size_t i = 0; i < ids.size(); ++i) {
+            *pOut << (0 == i ? "" : " ") << ids[i];
+        }
+        // flush each record so that an interrupted build keeps the compiled objects.
+        *pOut << "\n" << std::flush;
+    }
+    this->mDependencies[key] = std::move(ids);
+}
+
+bool DependencyStore::recordDepfile(boost::filesystem::path const& outputFilepath, boost::filesystem::path const& depfilePath)
+{
+    std::vector<std::string> dependencies;
+    if (!sParseDepfile(depfilePath, &dependencies)) {
+        return false;
+    }
+    this->record(outputFilepath, dependencies);
+    boost::system::error_code ec;
+    fs::remove(depfilePath, ec);
+    return true;
+}
+
+DependencyStore::State DependencyStore::check(boost::filesystem::path const& outputFilepath, IncludeClosureMemo* pMemo)const
+{
+    std::vector<std::string> dependencies;
+    if (!this->find(outputFilepath, &dependencies)) {
+        return State::Unknown;
+    }
+
+    auto stat = [pMemo](std::string const& filepath, FileStat* pOut) {
+        return pMemo ? pMemo->stat(filepath, pOut) : statFile(filepath, pOut);
+    };
+    FileStat outputStat;
+    if (!stat(outputFilepath.string(), &outputStat)) {
+        return State::Outdated;
+    }
+    for (auto& dependency : dependencies) {
+        FileStat dependencyStat;
+        // a removed header is outdated too. the compiler tells whether it is still needed.
+        if (!stat(dependency, &dependencyStat) || outputStat.mtime < dependencyStat.mtime) {
+            return State::Outdated;
+        }
+    }
+    return State::UpToDate;
+}
+
+int64_t DependencyStore::load_(uint64_t* pOutValidSize)
+{
+    this->mPaths.clear();
+    this->mPathIds.clear();
+    this->mDependencies.clear();
+
+    *pOutValidSize = 0;
+    if (!fs::exists(this->mFilepath)) {
+        return -1;
+    }
+    auto content = readFile(this->mFilepath);
+    auto headerLength = std::strlen(sHeader);
+    if (content.size() <= headerLength
+        || 0 != content.compare(0, headerLength, sHeader)
+        || '\n' != content[headerLength]) {
+        cerr << "warning: ignore the unknown dependency store. path=" << this->mFilepath << endl;
+        return -1;
+    }
+
+    // p\t<path>                    defines the path of the next id.
+    // d\t<output>\t<id> <id> ...   records the dependencies of the output.
+    *pOutValidSize = headerLength + 1;
+    int64_t lineCount = 0;
+    char* p = &content[headerLength + 1];
+    char* const pEnd = &content[0] + content.size();
+    while (p < pEnd) {
+        auto pLineEnd = static_cast<char*>(std::memchr(p, '\n', pEnd - p));
+        if (!pLineEnd) {
+            // the last line was being written when the build was interrupted.
+            break;
+        }
+        *pLineEnd = '\0';
+        *pOutValidSize = static_cast<uint64_t>(pLineEnd + 1 - &content[0]);
+        ++lineCount;
+
+        if (pLineEnd - p < 2 || '\t' != p[1]) {
+            p = pLineEnd + 1;
+            continue;
+        }
+        if ('p' == p[0]) {
+            std::string path(p + 2, pLineEnd);
+            this->mPathIds.insert({ path, static_cast<uint32_t>(this->mPaths.size()) });
+            this->mPaths.push_back(std::move(path));
+        } else if ('d' == p[0]) {
+            auto pTab = static_cast<char*>(std::memchr(p + 2, '\t', pLineEnd - (p + 2)));
+            if (pTab) {
+                std::vector<uint32_t> ids;
+                bool isValid = true;
+                for (char* q = pTab + 1; q < pLineEnd; ) {
+                    char* pNext = nullptr;
+                    auto id = std::strtoul(q, &pNext, 10);
+                    if (q == pNext || this->mPaths.size() <= id) {
+                        isValid = false;
+                        break;
+                    }
+                    ids.push_back(static_cast<uint32_t>(id));
+                    q = pNext;
+                    while (' ' == *q) {
+                        ++q;
+                    }
+                }
+                if (isValid) {
+                    this->mDependencies[std::string(p + 2, pTab)] = std::move(ids);
+                }
+            }
+        }
+        p = pLineEnd + 1;
+    }
+    return lineCount;
+}
+
+bool DependencyStore::rewrite_()
+{
+    createDirectory(this->mFilepath.parent_path());
+
+    // renumber only the paths which are still used.
+    auto paths = std::move(this->mPaths);
+    this->mPaths.clear();
+    this->mPathIds.clear();
+
+    auto tempFilepath = this->mFilepath;
+    tempFilepath += ".tmp";
+    {
+        std::ofstream out(tempFilepath.string(), std::ios::trunc);
+        out << sHeader << "\n";
+        for (auto& [key, ids] : this->mDependencies) {
+            for (auto& id : ids) {
+                id = this->pathId_(paths[id], &out);
+            }
+            out << "d\t" << key << "\t";
+            for (size_t i = 0; i < ids.size(); ++i) {
+                out << (0 == i ? "" : " ") << ids[i];
+            }
+            out << "\n";
+        }
+        if (!out) {
+            cerr << "warning: failed to write the dependency store. path=" << tempFilepath << endl;
+            return false;
+        }
+    }
+    boost::system::error_code ec;
+    fs::rename(tempFilepath, this->mFilepath, ec);
+    if (ec) {
+        cerr << "warning: failed to write the dependency store. path=" << this->mFilepath << " " << ec.message() << endl;
+        return false;
+    }
+    return true;
+}
+
+uint32_t DependencyStore::pathId_(std::string const& path, std::ostream* pOut)
+{
+    auto it = this->mPathIds.find(path);
+    if (this->mPathIds.end() != it) {
+        return it->second;
+    }
+    auto id = static_cast<uint32_t>(this->mPaths.size());
+    this->mPaths.push_back(path);
+    this->mPathIds.insert({ path, id });
+    if (pOut) {
+        *pOut << "p\t" << path << "\n";
+    }
+    return id;
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+
+namespace watagashi
+{
+
+class IncludeClosureMemo;
+
+// Keeps the dependencies which the compiler wrote to the depfile (-MMD -MF) of each object,
+// so that the up-to-date check needs only stat() of them instead of scanning the sources.
+// Like BuildLog, an object appends its record when it is compiled, and the file is compacted when it grows.
+class DependencyStore
+{
+    DependencyStore(DependencyStore const&) = delete;
+    DependencyStore& operator=(DependencyStore const&) = delete;
+
+public:
+    // the file name in the intermediate directory.
+    static char const* const sFilename;
+
+    enum class State {
+        Unknown,
+        UpToDate,
+        Outdated,
+    };
+
+    // Parse the depfile of the make syntax. The targets are not included.
+    static bool sParseDepfile(boost::filesystem::path const& depfilePath, std::vector<std::string>* pOut);
+
+public:
+    explicit DependencyStore(boost::filesystem::path const& filepath);
+    ~DependencyStore();
+
+    // Load the store and prepare to append to it.
+    bool open();
+    void close();
+
+    bool find(boost::filesystem::path const& outputFilepath, std::vector<std::string>* pOut)const;
+    void record(boost::filesystem::path const& outputFilepath, std::vector<std::string> const& dependencies);
+    // Parse the depfile and record it. The depfile is removed after it is recorded.
+    bool recordDepfile(boost::filesystem::path const& outputFilepath, boost::filesystem::path const& depfilePath);
+
+    // Compare the last write time of the output with the recorded dependencies.
+    // Return State::Unknown when nothing is recorded for the output.
+    // The memo shares the stats of the dependencies among the outputs of a build.
+    State check(boost::filesystem::path const& outputFilepath, IncludeClosureMemo* pMemo = nullptr)const;
+
+private:
+    // pOutValidSize receives the size up to the end of the last complete line.
+    int64_t load_(uint64_t* pOutValidSize);
+    bool rewrite_();
+    uint32_t pathId_(std::string const& path, std::ostream* pOut);
+
+private:
+    boost::filesystem::path mFilepath;
+    mutable std::mutex mMutex;
+    std::ofstream mOut;
+    // the paths are shared by many objects, so each is stored once.
+    std::vector<std::string> mPaths;
+    std::unordered_map<std::string, uint32_t> mPathIds;
+    std::unordered_map<std::string, std::vector<uint32_t>> mDependencies;
+};
+
+}
@@ -0,0 +1,143 @@
+#include "fileView.h"
+
+#include <fstream>
+#include <cerrno>
+
+#include "utility.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+//=============================================================================
+//
+//    class FileView
+//
+//=============================================================================
+
+size_t const FileView::sMinMapSize = 64 * 1024;
+
+FileView::FileView()
+    : mpData(nullptr)
+    , mSize(0)
+    , mpMapped(nullptr)
+{}
+
+FileView::~FileView()
+{
+    this->close();
+}
+
+bool FileView::open(boost::filesystem::path const& filepath)
+{
+    this->close();
+
+#ifdef _WIN32
+    std::ifstream in(filepath.string(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    boost::system::error_code ec;
+    auto fileSize = static_cast<size_t>(fs::file_size(filepath, ec));
+    if (ec) {
+        return false;
+    }
+    this->mBuffer.resize(fileSize);
+    in.read(this->mBuffer.data(), fileSize);
+    this->mpData = this->mBuffer.data();
+    this->mSize = static_cast<size_t>(in.gcount());
+    return true;
+#else
+    auto fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    Finally closeFd([fd]() { ::close(fd); });
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        return false;
+    }
+    auto fileSize = static_cast<size_t>(st.st_size);
+    if (0 == fileSize) {
+        return true;
+    }
+
+    if (sMinMapSize <= fileSize) {
+        auto p = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != p) {
+            ::madvise(p, fileSize, MADV_SEQUENTIAL);
+            this->mpMapped = p;
+            this->mpData = static_cast<char const*>(p);
+            this->mSize = fileSize;
+            return true;
+        }
+        // read it when the file system can't map. (some FUSE and network file systems)
+    }
+
+    if (this->mBuffer.size() < fileSize) {
+        this->mBuffer.resize(fileSize);
+    }
+    size_t readSize = 0;
+    while (readSize < fileSize) {
+        auto result = ::pread(fd, this->mBuffer.data() + readSize, fileSize - readSize, static_cast<off_t>(readSize));
+        if (result < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+        if (0 == result) {
+            // the file was truncated after fstat().
+            break;
+        }
+        readSize += static_cast<size_t>(result);
+    }
+    this->mpData = this->mBuffer.data();
+    this->mSize = readSize;
+    return true;
+#endif
+}
+
+void FileView::close()
+{
+#ifndef _WIN32
+    if (this->mpMapped) {
+        ::munmap(this->mpMapped, this->mSize);
+        this->mpMapped = nullptr;
+    }
+#endif
+    // keep the capacity of mBuffer for the next file.
+    this->mpData = nullptr;
+    this->mSize = 0;
+}
+
+char const* FileView::data()const
+{
+    return this->mpData;
+}
+
+size_t FileView::size()const
+{
+    return this->mSize;
+}
+
+boost::string_view FileView::str()const
+{
+    return boost::string_view(this->mpData, this->mSize);
+}
+
+bool FileView::isMapped()const
+{
+    return nullptr != this->mpMapped;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <boost/filesystem.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace watagashi
+{
+
+// The read-only content of a file without copying it into a std::string.
+// A large file is memory-mapped and a small one is read into a buffer, which the next open() reuses.
+// So keep a FileView and open files one after another to read many files without allocation.
+class FileView
+{
+    FileView(FileView const&) = delete;
+    FileView& operator=(FileView const&) = delete;
+
+public:
+    // a file smaller than this is read because mmap costs more than copying it.
+    static size_t const sMinMapSize;
+
+public:
+    FileView();
+    ~FileView();
+
+    // Return false when failed to open the file. The previous content is closed anyway.
+    bool open(boost::filesystem::path const& filepath);
+    void close();
+
+    // These are valid until the next open() or close().
+    char const* data()const;
+    size_t size()const;
+    boost::string_view str()const;
+    bool isMapped()const;
+
+private:
+    char const* mpData;
+    size_t mSize;
+    // the address of mmap. nullptr when the content is in mBuffer.
+    void* mpMapped;
+    std::vector<char> mBuffer;
+};
+
+}
@@ -0,0 +1,154 @@
+#include "fileWatcher.h"
+
+#include <iostream>
+#include <cstring>
+
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+//--------------------------------------------------------------------------------------
+//
+//  class FileWatcher
+//
+//--------------------------------------------------------------------------------------
+
+FileWatcher::FileWatcher()
+    : mFd(-1)
+{}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (0 <= this->mFd) {
+        ::close(this->mFd);
+    }
+#endif
+}
+
+bool FileWatcher::open()
+{
+#ifdef __linux__
+    this->mFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->mFd < 0) {
+        cerr << "error: failed to initialize inotify. " << std::strerror(errno) << endl;
+        return false;
+    }
+    return true;
+#else
+    cerr << "error: watching files is supported on Linux only." << endl;
+    return false;
+#endif
+}
+
+bool FileWatcher::addDirectory(boost::filesystem::path const& directory)
+{
+#ifdef __linux__
+    auto path = fs::absolute(directory).lexically_normal();
+    if (0 < this->mWatches.count(path.string())) {
+        return true;
+    }
+    // editors save by a rename as well as by a write.
+    uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    int wd = ::inotify_add_watch(this->mFd, path.c_str(), mask);
+    if (wd < 0) {
+        if (ENOSPC == errno) {
+            cerr << "warning: too many watches. raise fs.inotify.max_user_watches. path=" << path.string() << endl;
+        }
+        return false;
+    }
+    this->mDirectories[wd] = path;
+    this->mWatches[path.string()] = wd;
+    return true;
+#else
+    (void)directory;
+    return false;
+#endif
+}
+
+void FileWatcher::clear()
+{
+#ifdef __linux__
+    for (auto& [wd, path] : this->mDirectories) {
+        ::inotify_rm_watch(this->mFd, wd);
+    }
+#endif
+    this->mDirectories.clear();
+    this->mWatches.clear();
+}
+
+bool FileWatcher::wait(int timeoutMilliseconds, int quietMilliseconds, std::vector<Event>* pOut)
+{
+    pOut->clear();
+#ifdef __linux__
+    pollfd pfd = { this->mFd, POLLIN, 0 };
+    if (::poll(&pfd, 1, timeoutMilliseconds) <= 0) {
+        return false;
+    }
+    this->read_(pOut);
+    // debounce
+    while (0 < quietMilliseconds && 0 < ::poll(&pfd, 1, quietMilliseconds)) {
+        this->read_(pOut);
+    }
+#else
+    (void)timeoutMilliseconds;
+    (void)quietMilliseconds;
+#endif
+    return !pOut->empty();
+}
+
+bool FileWatcher::read_(std::vector<Event>* pOut)
+{
+#ifdef __linux__
+    alignas(inotify_event) char buffer[64 * 1024];
+    bool isRead = false;
+    while (true) {
+        auto size = ::read(this->mFd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            break;
+        }
+        isRead = true;
+        for (char* p = buffer; p < buffer + size;) {
+            auto pEvent = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + pEvent->len;
+
+            if (pEvent->mask & IN_Q_OVERFLOW) {
+                // the changes are lost, so the caller must check everything.
+                pOut->push_back({ fs::path(), true });
+                continue;
+            }
+            if (pEvent->mask & IN_IGNORED) {
+                // the directory was removed.
+                auto it = this->mDirectories.find(pEvent->wd);
+                if (this->mDirectories.end() != it) {
+                    this->mWatches.erase(it->second.string());
+                    this->mDirectories.erase(it);
+                }
+                continue;
+            }
+            auto it = this->mDirectories.find(pEvent->wd);
+            if (this->mDirectories.end() == it || 0 == pEvent->len) {
+                continue;
+            }
+            Event event;
+            event.path = it->second / pEvent->name;
+            event.isStructural = 0 != (pEvent->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO));
+            pOut->push_back(std::move(event));
+        }
+    }
+    return isRead;
+#else
+    (void)pOut;
+    return false;
+#endif
+}
+
+}
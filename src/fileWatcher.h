@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace watagashi
+{
+
+// Watches the files in directories by inotify. Linux only.
+class FileWatcher
+{
+    FileWatcher(FileWatcher const&) = delete;
+    FileWatcher& operator=(FileWatcher const&) = delete;
+
+public:
+    struct Event
+    {
+        // the absolute and normal path of the file.
+        boost::filesystem::path path;
+        // true when the file was created, removed or renamed, false when it was written.
+        bool isStructural = false;
+    };
+
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    bool open();
+    // Watch the files directly in the directory. Adding the same directory again does nothing.
+    bool addDirectory(boost::filesystem::path const& directory);
+    // Remove all watches.
+    void clear();
+
+    // Wait for a change until the timeout, -1 is forever, and collect the changes which follow it
+    // until nothing changes for quietMilliseconds, so that a burst of saves is one change.
+    // Return false when nothing changed.
+    bool wait(int timeoutMilliseconds, int quietMilliseconds, std::vector<Event>* pOut);
+
+private:
+    bool read_(std::vector<Event>* pOut);
+
+private:
+    int mFd;
+    std::unordered_map<int, boost::filesystem::path> mDirectories;
+    std::unordered_map<std::string, int> mWatches;
+};
+
+}
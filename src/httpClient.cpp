@@ -0,0 +1,192 @@
+#include "httpClient.h"
+
+#include <chrono>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+
+namespace watagashi
+{
+
+// objects are a few MB at most. a larger body is an error of the server.
+static uint64_t const sMaxBodySize = 1024ull * 1024 * 1024;
+
+//--------------------------------------------------------------------------------------
+//
+//  class HttpClient
+//
+//--------------------------------------------------------------------------------------
+
+struct HttpClient::Impl
+{
+    std::string host;
+    std::string port;
+    std::chrono::milliseconds timeout;
+    std::string authorization;
+    asio::io_context ioContext;
+    beast::tcp_stream stream;
+    beast::flat_buffer buffer;
+    bool isConnected;
+
+    Impl(std::string const& host, std::string const& port, int timeoutMilliseconds)
+        : host(host)
+        , port(port)
+        , timeout(timeoutMilliseconds)
+        , stream(ioContext)
+        , isConnected(false)
+    {}
+
+    bool connect()
+    {
+        if (this->isConnected) {
+            return true;
+        }
+        beast::error_code ec;
+        asio::ip::tcp::resolver resolver(this->ioContext);
+        auto endpoints = resolver.resolve(this->host, this->port, ec);
+        if (ec) {
+            return false;
+        }
+        this->stream.expires_after(this->timeout);
+        this->stream.async_connect(endpoints, [&](beast::error_code const& e, asio::ip::tcp::endpoint const&) { ec = e; });
+        this->run();
+        if (ec) {
+            this->disconnect();
+            return false;
+        }
+        this->stream.socket().set_option(asio::ip::tcp::no_delay(true), ec);
+        this->isConnected = true;
+        return true;
+    }
+
+    // Run the started operations to the end. The timeout of the stream applies only to the async operations,
+    // so they are cancelled at the deadline even when the server stops responding.
+    void run()
+    {
+        this->ioContext.restart();
+        this->ioContext.run();
+    }
+
+    void disconnect()
+    {
+        beast::error_code ec;
+        this->stream.socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        this->stream.close();
+        this->buffer.clear();
+        this->isConnected = false;
+    }
+
+    int request(http::verb method, std::string const& target, std::string const& body, std::string* pOutBody)
+    {
+        // the server may have closed the kept connection, so retry once with a new one.
+        for (int retry = 0; retry < 2; ++retry) {
+            bool isReused = this->isConnected;
+            if (!this->connect()) {
+                return 0;
+            }
+
+            http::request<http::string_body> req(method, target, 11);
+            req.set(http::field::host, this->host);
+            req.keep_alive(true);
+            if (!this->authorization.empty()) {
+                req.set(http::field::authorization, this->authorization);
+            }
+            if (http::verb::get != method) {
+                req.body() = body;
+                req.prepare_payload();
+            }
+
+            beast::error_code ec;
+            http::response_parser<http::string_body> parser;
+            parser.body_limit(sMaxBodySize);
+            this->stream.expires_after(this->timeout);
+            http::async_write(this->stream, req, [&](beast::error_code const& e, size_t) {
+                ec = e;
+                if (!ec) {
+                    http::async_read(this->stream, this->buffer, parser, [&](beast::error_code const& readError, size_t) { ec = readError; });
+                }
+            });
+            this->run();
+            if (ec) {
+                this->disconnect();
+                // a server which didn't answer in time isn't waited again.
+                if (isReused && beast::error::timeout != ec) {
+                    continue;
+                }
+                return 0;
+            }
+
+            auto res = parser.release();
+            if (!res.keep_alive()) {
+                this->disconnect();
+            }
+            if (pOutBody) {
+                *pOutBody = std::move(res.body());
+            }
+            return static_cast<int>(res.result_int());
+        }
+        return 0;
+    }
+};
+
+bool HttpClient::sParseUrl(std::string const& url, std::string* pOutHost, std::string* pOutPort, std::string* pOutPrefix)
+{
+    static std::string const sScheme = "http://";
+    if (0 != url.compare(0, sScheme.size(), sScheme)) {
+        return false;
+    }
+    auto hostBegin = sScheme.size();
+    auto pathBegin = url.find('/', hostBegin);
+    auto authority = url.substr(hostBegin, std::string::npos == pathBegin ? std::string::npos : pathBegin - hostBegin);
+    auto colon = authority.rfind(':');
+    if (std::string::npos == colon) {
+        *pOutHost = authority;
+        *pOutPort = "80";
+    } else {
+        *pOutHost = authority.substr(0, colon);
+        *pOutPort = authority.substr(colon + 1);
+    }
+    *pOutPrefix = std::string::npos == pathBegin ? "" : url.substr(pathBegin);
+    while (!pOutPrefix->empty() && '/' == pOutPrefix->back()) {
+        pOutPrefix->pop_back();
+    }
+    return !pOutHost->empty() && !pOutPort->empty();
+}
+
+HttpClient::HttpClient(std::string const& host, std::string const& port, int timeoutMilliseconds)
+    : mpImpl(std::make_unique<Impl>(host, port, timeoutMilliseconds))
+{}
+
+HttpClient::~HttpClient()
+{
+    if (this->mpImpl->isConnected) {
+        this->mpImpl->disconnect();
+    }
+}
+
+void HttpClient::setBearerToken(std::string const& token)
+{
+    this->mpImpl->authorization = token.empty() ? "" : "Bearer " + token;
+}
+
+int HttpClient::get(std::string const& target, std::string* pOutBody)
+{
+    return this->mpImpl->request(http::verb::get, target, "", pOutBody);
+}
+
+int HttpClient::put(std::string const& target, std::string const& body)
+{
+    return this->mpImpl->request(http::verb::put, target, body, nullptr);
+}
+
+int HttpClient::post(std::string const& target, std::string const& body, std::string* pOutBody)
+{
+    return this->mpImpl->request(http::verb::post, target, body, pOutBody);
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+namespace watagashi
+{
+
+// A blocking HTTP/1.1 client which keeps one connection to the server alive.
+// A request fails when the server doesn't answer within the timeout.
+// It isn't thread-safe, so each thread has its own client.
+class HttpClient
+{
+    HttpClient(HttpClient const&) = delete;
+    HttpClient& operator=(HttpClient const&) = delete;
+
+public:
+    // Split "http://host:port/prefix" into the parts. Return false for the other schemes.
+    static bool sParseUrl(std::string const& url, std::string* pOutHost, std::string* pOutPort, std::string* pOutPrefix);
+
+public:
+    HttpClient(std::string const& host, std::string const& port, int timeoutMilliseconds);
+    ~HttpClient();
+
+    // Send "Authorization: Bearer <token>" with every request. empty sends nothing.
+    void setBearerToken(std::string const& token);
+
+    // Return the status code, or 0 when the server can't be reached.
+    int get(std::string const& target, std::string* pOutBody);
+    int put(std::string const& target, std::string const& body);
+    int post(std::string const& target, std::string const& body, std::string* pOutBody);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> mpImpl;
+};
+
+}
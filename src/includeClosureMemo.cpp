@@ -0,0 +1,101 @@
+#include "includeClosureMemo.h"
+
+#include <mutex>
+
+namespace watagashi
+{
+
+//--------------------------------------------------------------------------------------
+//
+//  class IncludeClosureMemo
+//
+//--------------------------------------------------------------------------------------
+
+uint32_t IncludeClosureMemo::fileId(std::string const& filepath)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(this->mMutex);
+        auto it = this->mPathIds.find(filepath);
+        if (this->mPathIds.end() != it) {
+            return it->second;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(this->mMutex);
+    auto [it, isInserted] = this->mPathIds.insert({ filepath, static_cast<uint32_t>(this->mPaths.size()) });
+    if (isInserted) {
+        this->mPaths.push_back(filepath);
+    }
+    return it->second;
+}
+
+std::string IncludeClosureMemo::filepath(uint32_t id)const
+{
+    std::shared_lock<std::shared_mutex> lock(this->mMutex);
+    return this->mPaths.at(id);
+}
+
+bool IncludeClosureMemo::stat(uint32_t id, FileStat* pOut)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(this->mMutex);
+        auto it = this->mStats.find(id);
+        if (this->mStats.end() != it) {
+            *pOut = it->second.stat;
+            return it->second.isExist;
+        }
+    }
+    // stat() without the lock. another thread may stat the same file, but the result is the same.
+    StatEntry entry;
+    entry.isExist = statFile(this->filepath(id), &entry.stat);
+
+    std::unique_lock<std::shared_mutex> lock(this->mMutex);
+    auto it = this->mStats.insert({ id, entry }).first;
+    *pOut = it->second.stat;
+    return it->second.isExist;
+}
+
+bool IncludeClosureMemo::stat(std::string const& filepath, FileStat* pOut)
+{
+    return this->stat(this->fileId(filepath), pOut);
+}
+
+bool IncludeClosureMemo::contentHash(uint32_t id, uint64_t* pOut)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(this->mMutex);
+        auto it = this->mContentHashes.find(id);
+        if (this->mContentHashes.end() != it) {
+            *pOut = it->second;
+            return true;
+        }
+    }
+    // hash without the lock like stat().
+    uint64_t hash = 0;
+    if (!hashFile(this->filepath(id), &hash)) {
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mMutex);
+    *pOut = this->mContentHashes.insert({ id, hash }).first->second;
+    return true;
+}
+
+bool IncludeClosureMemo::contentHash(std::string const& filepath, uint64_t* pOut)
+{
+    return this->contentHash(this->fileId(filepath), pOut);
+}
+
+std::shared_ptr<IncludeClosureMemo::Closure const> IncludeClosureMemo::findClosure(uint32_t id, uint64_t includeDirectoriesHash)const
+{
+    std::shared_lock<std::shared_mutex> lock(this->mMutex);
+    auto it = this->mClosures.find({ id, includeDirectoriesHash });
+    return this->mClosures.end() == it ? nullptr : it->second;
+}
+
+void IncludeClosureMemo::addClosure(uint32_t id, uint64_t includeDirectoriesHash, std::shared_ptr<Closure const> pClosure)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mMutex);
+    this->mClosures.insert({ { id, includeDirectoriesHash }, std::move(pClosure) });
+}
+
+}
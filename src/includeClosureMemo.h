@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <shared_mutex>
+#include <cstdint>
+#include <unordered_map>
+
+#include "utility.h"
+
+namespace watagashi
+{
+
+// Shares the include analysis among all processes of a build. It is thread-safe.
+// A header which many sources include is stat'ed, hashed and its closure is walked once per build.
+class IncludeClosureMemo
+{
+    IncludeClosureMemo(IncludeClosureMemo const&) = delete;
+    IncludeClosureMemo& operator=(IncludeClosureMemo const&) = delete;
+
+public:
+    struct Closure
+    {
+        // the file and all files it includes transitively.
+        std::vector<uint32_t> fileIds;
+        // the newest last write time in the closure.
+        int64_t maxMtime = 0;
+    };
+
+public:
+    IncludeClosureMemo() = default;
+
+    // The paths are interned, so a closure holds ids instead of strings.
+    uint32_t fileId(std::string const& filepath);
+    std::string filepath(uint32_t id)const;
+
+    // Return false when the file doesn't exist.
+    bool stat(uint32_t id, FileStat* pOut);
+    bool stat(std::string const& filepath, FileStat* pOut);
+    // Return false when the file can't be read. Each file is hashed once per build.
+    bool contentHash(uint32_t id, uint64_t* pOut);
+    bool contentHash(std::string const& filepath, uint64_t* pOut);
+
+    // The closure depends on the include directories which resolve <...>.
+    std::shared_ptr<Closure const> findClosure(uint32_t id, uint64_t includeDirectoriesHash)const;
+    void addClosure(uint32_t id, uint64_t includeDirectoriesHash, std::shared_ptr<Closure const> pClosure);
+
+private:
+    struct StatEntry
+    {
+        bool isExist;
+        FileStat stat;
+    };
+
+    struct ClosureKey
+    {
+        uint32_t id;
+        uint64_t includeDirectoriesHash;
+
+        bool operator==(ClosureKey const& right)const {
+            return this->id == right.id && this->includeDirectoriesHash == right.includeDirectoriesHash;
+        }
+    };
+
+    struct ClosureKeyHash
+    {
+        size_t operator()(ClosureKey const& key)const {
+            return std::hash<uint64_t>()(key.includeDirectoriesHash ^ (static_cast<uint64_t>(key.id) * 0x9e3779b97f4a7c15ull));
+        }
+    };
+
+private:
+    mutable std::shared_mutex mMutex;
+    std::vector<std::string> mPaths;
+    std::unordered_map<std::string, uint32_t> mPathIds;
+    std::unordered_map<uint32_t, StatEntry> mStats;
+    // the files which failed to be read have no entry and are retried.
+    std::unordered_map<uint32_t, uint64_t> mContentHashes;
+    std::unordered_map<ClosureKey, std::shared_ptr<Closure const>, ClosureKeyHash> mClosures;
+};
+
+}
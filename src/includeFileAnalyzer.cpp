@@ -1,10 +1,16 @@
 #include "includeFileAnalyzer.h"
 
 #include <iostream>
-#include <regex>
-#include <boost/range/algorithm/for_each.hpp>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 
 #include "exception.hpp"
+#include "utility.h"
+#include "includeGraphCache.h"
+#include "includeClosureMemo.h"
+#include "includeScanner.h"
+#include "fileView.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -18,115 +24,198 @@ namespace watagashi
 //
 //=============================================================================
 
+// Return the resolved paths of the files which the source includes directly.
 template<typename Container>
-void analysis(
-    std::unordered_set<std::string>* pInOut,
+std::vector<std::string> scanIncludes(
     boost::filesystem::path const& sourceFilePath,
-    Container& includeDirectories)
+    Container const& includeDirectories)
 {
-    std::ifstream in(sourceFilePath.string());
-    if (in.bad()) {
+    // a worker scans the files one by one, so its view reuses the buffer for all of them.
+    thread_local FileView tFileView;
+    if (!tFileView.open(sourceFilePath)) {
         AWESOME_THROW(std::invalid_argument) << "Failed to open " << sourceFilePath.string() << "...";
     }
 
-    std::unordered_set<std::string> foundIncludeFiles;
-
-    auto fileSize = fs::file_size(sourceFilePath);
-    std::string fileContent;
-    fileContent.resize(fileSize);
-    in.read(&fileContent[0], fileSize);
-
-    std::regex pattern(R"(#include\s*([<"])([\w./\\]+)[>"])");
-    std::smatch match;
-    auto it = fileContent.cbegin(), end = fileContent.cend();
-    while (std::regex_search(it, end, match, pattern)) {
-        it = match[0].second;
-        switch (match[1].str()[0]) {
-        case '<':
-        {
+    std::vector<std::string> foundIncludeFiles;
+
+    std::vector<IncludeScanner::Include> includes;
+    IncludeScanner::sScan(tFileView.data(), tFileView.data() + tFileView.size(), &includes);
+    tFileView.close();
+    for (auto& include : includes) {
+        if (include.isAngled) {
             for (auto& includeDir : includeDirectories) {
-                auto path = fs::absolute(includeDir) / match[2].str();
+                auto path = fs::absolute(includeDir) / include.path;
                 if (!fs::exists(path)) {
                     continue;
                 }
-                auto pathStr = path.string();
-                if (pInOut->count(pathStr)) {
-                    continue;
-                }
-                foundIncludeFiles.insert(pathStr);
-                pInOut->insert(pathStr);
+                foundIncludeFiles.push_back(path.string());
                 break;
             }
-            break;
-        }
-        case '"':
-        {
-            auto path = fs::absolute(sourceFilePath.parent_path() / match[2].str());
+        } else {
+            auto path = fs::absolute(sourceFilePath.parent_path() / include.path);
             if (!fs::exists(path)) {
-                break;
+                continue;
             }
-            auto pathStr = path.string();
-            if (pInOut->count(pathStr)) {
-                break;
-            }
-            foundIncludeFiles.insert(pathStr);
-            pInOut->insert(pathStr);
-            break;
+            foundIncludeFiles.push_back(path.string());
         }
-        default:
-            break;
+    }
+    return foundIncludeFiles;
+}
+
+template<typename Container>
+uint64_t hashIncludeDirectories(Container const& includeDirectories)
+{
+    // the order of unordered_set isn't stable, so sort them.
+    std::vector<std::string> dirs;
+    for (auto& dir : includeDirectories) {
+        dirs.push_back(fs::path(dir).string());
+    }
+    std::sort(dirs.begin(), dirs.end());
+    uint64_t hash = hashString("");
+    for (auto& dir : dirs) {
+        hash = hashString(dir + "\n", hash);
+    }
+    return hash;
+}
+
+template<typename Container>
+std::vector<std::string> directIncludes(
+    std::string const& filepath,
+    FileStat const& stat,
+    Container const& includeDirectories,
+    IncludeGraphCache* pCache,
+    uint64_t includeDirectoriesHash)
+{
+    // rescan only the files changed since the last build.
+    std::vector<std::string> includeFiles;
+    if (!pCache || !pCache->find(filepath, includeDirectoriesHash, stat, &includeFiles)) {
+        includeFiles = scanIncludes(filepath, includeDirectories);
+        if (pCache) {
+            pCache->record(filepath, includeDirectoriesHash, stat, includeFiles);
         }
     }
+    return includeFiles;
+}
 
-    fileContent.clear();
-    fileContent.shrink_to_fit();
+template<typename Container>
+struct ClosureContext
+{
+    Container const& includeDirectories;
+    IncludeGraphCache* pCache;
+    IncludeClosureMemo* pMemo;
+    uint64_t includeDirectoriesHash;
+    // the files being walked on this thread and their depth.
+    std::unordered_map<uint32_t, size_t> walkingDepths;
+};
+
+// Merge the closure of the file into pOut and return the smallest depth of the walking files which it reached.
+// A file in an include cycle doesn't know its whole closure until the walk returns to the first file of the cycle,
+// so only the files which didn't reach shallower ones are memoized.
+template<typename Container>
+size_t analysis(
+    IncludeClosureMemo::Closure* pOut,
+    std::unordered_set<uint32_t>* pOutIds,
+    uint32_t fileId,
+    size_t depth,
+    ClosureContext<Container>& context)
+{
+    auto merge = [&](IncludeClosureMemo::Closure const& closure) {
+        for (auto id : closure.fileIds) {
+            if (pOutIds->insert(id).second) {
+                pOut->fileIds.push_back(id);
+            }
+        }
+        pOut->maxMtime = std::max(pOut->maxMtime, closure.maxMtime);
+    };
+
+    auto noDepth = std::numeric_limits<size_t>::max();
+    if (auto pClosure = context.pMemo->findClosure(fileId, context.includeDirectoriesHash)) {
+        merge(*pClosure);
+        return noDepth;
+    }
+    auto walkingIt = context.walkingDepths.find(fileId);
+    if (context.walkingDepths.end() != walkingIt) {
+        // the include cycle. the walking file adds the rest.
+        return walkingIt->second;
+    }
+    context.walkingDepths.insert({ fileId, depth });
+
+    IncludeClosureMemo::Closure closure;
+    std::unordered_set<uint32_t> closureIds;
+    closure.fileIds.push_back(fileId);
+    closureIds.insert(fileId);
+
+    FileStat stat;
+    auto filepath = context.pMemo->filepath(fileId);
+    size_t reachedDepth = noDepth;
+    if (context.pMemo->stat(fileId, &stat)) {
+        closure.maxMtime = stat.mtime;
+        auto includeFiles = directIncludes(filepath, stat, context.includeDirectories, context.pCache, context.includeDirectoriesHash);
+        for (auto& includeFile : includeFiles) {
+            auto includeId = context.pMemo->fileId(includeFile);
+            if (closureIds.count(includeId)) {
+                continue;
+            }
+            reachedDepth = std::min(reachedDepth, analysis(&closure, &closureIds, includeId, depth + 1, context));
+        }
+    } else {
+        // a removed file is always newer than the output.
+        closure.maxMtime = std::numeric_limits<int64_t>::max();
+    }
+    context.walkingDepths.erase(fileId);
 
-    boost::range::for_each(
-        foundIncludeFiles,
-        [&](const fs::path& path) {
-        analysis(pInOut, path, includeDirectories);
-    });
+    merge(closure);
+    if (depth <= reachedDepth) {
+        context.pMemo->addClosure(fileId, context.includeDirectoriesHash, std::make_shared<IncludeClosureMemo::Closure const>(std::move(closure)));
+        return noDepth;
+    }
+    return reachedDepth;
 }
 
 template<typename Container>
 bool checkUpdateTime(
     boost::filesystem::path const& inputFilepath,
     boost::filesystem::path const& outputFilepath,
-    Container const& includeDirectories)
+    Container const& includeDirectories,
+    IncludeGraphCache* pCache,
+    IncludeClosureMemo* pMemo)
 {
-    if (fs::exists(outputFilepath)) {
-        std::unordered_set<std::string> includeFiles;
-        analysis(&includeFiles, inputFilepath, includeDirectories);
-        includeFiles.insert(inputFilepath.string());
-
-        bool isCompile = false;
-        for (auto&& filepath : includeFiles) {
-            if (fs::last_write_time(outputFilepath) < fs::last_write_time(filepath)) {
-                isCompile = true;
-                break;
-            }
-        }
-        if (!isCompile) {
-            return false;
-        }
+    // without the memo of the build, the closures are shared only in this call.
+    IncludeClosureMemo localMemo;
+    if (!pMemo) {
+        pMemo = &localMemo;
     }
-    return true;
+
+    FileStat outputStat;
+    if (!pMemo->stat(outputFilepath.string(), &outputStat)) {
+        return true;
+    }
+
+    ClosureContext<Container> context{ includeDirectories, pCache, pMemo, hashIncludeDirectories(includeDirectories), {} };
+    IncludeClosureMemo::Closure closure;
+    std::unordered_set<uint32_t> closureIds;
+    analysis(&closure, &closureIds, pMemo->fileId(inputFilepath.string()), 0, context);
+    return outputStat.mtime < closure.maxMtime;
 }
 
 bool IncludeFileAnalyzer::sCheckUpdateTime(
     boost::filesystem::path const& inputFilepath,
     boost::filesystem::path const& outputFilepath,
-    std::vector<std::string> const& includeDirectories)
+    std::vector<std::string> const& includeDirectories,
+    IncludeGraphCache* pCache,
+    IncludeClosureMemo* pMemo)
 {
-    return checkUpdateTime(inputFilepath, outputFilepath, includeDirectories);
+    return checkUpdateTime(inputFilepath, outputFilepath, includeDirectories, pCache, pMemo);
 }
 
 bool IncludeFileAnalyzer::sCheckUpdateTime(
     boost::filesystem::path const& inputFilepath,
     boost::filesystem::path const& outputFilepath,
-    std::unordered_set<boost::filesystem::path> const& includeDirectories)
+    std::unordered_set<boost::filesystem::path> const& includeDirectories,
+    IncludeGraphCache* pCache,
+    IncludeClosureMemo* pMemo)
 {
-    return checkUpdateTime(inputFilepath, outputFilepath, includeDirectories);
+    return checkUpdateTime(inputFilepath, outputFilepath, includeDirectories, pCache, pMemo);
 }
 
 
@@ -8,18 +8,25 @@
 namespace watagashi
 {
 
+class IncludeGraphCache;
+class IncludeClosureMemo;
+
 class IncludeFileAnalyzer
 {
 public:
     static bool sCheckUpdateTime(
         boost::filesystem::path const& inputFilepath,
         boost::filesystem::path const& outputFilepath,
-        std::vector<std::string> const& includeDirectories);
+        std::vector<std::string> const& includeDirectories,
+        IncludeGraphCache* pCache = nullptr,
+        IncludeClosureMemo* pMemo = nullptr);
 
     static bool sCheckUpdateTime(
         boost::filesystem::path const& inputFilepath,
         boost::filesystem::path const& outputFilepath,
-        std::unordered_set<boost::filesystem::path> const& includeDirectories);
+        std::unordered_set<boost::filesystem::path> const& includeDirectories,
+        IncludeGraphCache* pCache = nullptr,
+        IncludeClosureMemo* pMemo = nullptr);
 
 public:
     IncludeFileAnalyzer() = delete;
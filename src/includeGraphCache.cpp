@@ -0,0 +1,171 @@
+#include "includeGraphCache.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sHeader = "# watagashi includes v1";
+
+char const* const IncludeGraphCache::sFilename = ".watagashi_includes";
+
+//--------------------------------------------------------------------------------------
+//
+//  class IncludeGraphCache
+//
+//--------------------------------------------------------------------------------------
+
+std::string IncludeGraphCache::sMakeKey(std::string const& filepath, uint64_t includeDirectoriesHash)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%016" PRIx64 "\t", includeDirectoriesHash);
+    return buf + filepath;
+}
+
+IncludeGraphCache::IncludeGraphCache(boost::filesystem::path const& filepath)
+    : mFilepath(filepath)
+    , mIsDirty(false)
+{}
+
+bool IncludeGraphCache::load()
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    this->mEntries.clear();
+    this->mIsDirty = false;
+
+    if (!fs::exists(this->mFilepath)) {
+        return true;
+    }
+    auto content = readFile(this->mFilepath);
+    auto headerLength = std::strlen(sHeader);
+    if (content.size() <= headerLength
+        || 0 != content.compare(0, headerLength, sHeader)
+        || '\n' != content[headerLength]) {
+        cerr << "warning: ignore the unknown include cache. path=" << this->mFilepath << endl;
+        this->mIsDirty = true;
+        return false;
+    }
+
+    // <mtime>\t<size>\t<inode>\t<include directories hash>\t<filepath>[\t<include>]...
+    char* p = &content[headerLength + 1];
+    char* const pEnd = &content[0] + content.size();
+    while (p < pEnd) {
+        auto pLineEnd = static_cast<char*>(std::memchr(p, '\n', pEnd - p));
+        if (!pLineEnd) {
+            break;
+        }
+        *pLineEnd = '\0';
+
+        Entry entry;
+        entry.stat.mtime = std::strtoll(p, &p, 10);
+        bool isValid = '\t' == *p;
+        if (isValid) {
+            entry.stat.size = std::strtoull(p + 1, &p, 10);
+            isValid = '\t' == *p;
+        }
+        if (isValid) {
+            entry.stat.inode = std::strtoull(p + 1, &p, 10);
+            isValid = '\t' == *p;
+        }
+        // the key is the hash and the filepath.
+        char* pKey = p + 1;
+        char* pKeyEnd = nullptr;
+        if (isValid) {
+            auto pTab = static_cast<char*>(std::memchr(pKey, '\t', pLineEnd - pKey));
+            pKeyEnd = pTab ? static_cast<char*>(std::memchr(pTab + 1, '\t', pLineEnd - (pTab + 1))) : nullptr;
+            isValid = nullptr != pTab;
+            if (!pKeyEnd) {
+                pKeyEnd = pLineEnd;
+            }
+        }
+        if (isValid) {
+            for (char* q = pKeyEnd; q < pLineEnd; ) {
+                auto pInclude = q + 1;
+                auto pIncludeEnd = static_cast<char*>(std::memchr(pInclude, '\t', pLineEnd - pInclude));
+                if (!pIncludeEnd) {
+                    pIncludeEnd = pLineEnd;
+                }
+                entry.includes.emplace_back(pInclude, pIncludeEnd);
+                q = pIncludeEnd;
+            }
+            this->mEntries[std::string(pKey, pKeyEnd)] = std::move(entry);
+        }
+        p = pLineEnd + 1;
+    }
+    return true;
+}
+
+bool IncludeGraphCache::save()const
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    if (!this->mIsDirty) {
+        return true;
+    }
+    createDirectory(this->mFilepath.parent_path());
+
+    // write to a temporary file and replace the cache, so that an interrupted build never breaks it.
+    auto tempFilepath = this->mFilepath;
+    tempFilepath += ".tmp";
+    {
+        std::ofstream out(tempFilepath.string(), std::ios::trunc);
+        out << sHeader << "\n";
+        for (auto& [key, entry] : this->mEntries) {
+            out << entry.stat.mtime << "\t" << entry.stat.size << "\t" << entry.stat.inode << "\t" << key;
+            for (auto& include : entry.includes) {
+                out << "\t" << include;
+            }
+            out << "\n";
+        }
+        if (!out) {
+            cerr << "warning: failed to write the include cache. path=" << tempFilepath << endl;
+            return false;
+        }
+    }
+    boost::system::error_code ec;
+    fs::rename(tempFilepath, this->mFilepath, ec);
+    if (ec) {
+        cerr << "warning: failed to write the include cache. path=" << this->mFilepath << " " << ec.message() << endl;
+        return false;
+    }
+    return true;
+}
+
+bool IncludeGraphCache::find(
+    std::string const& filepath,
+    uint64_t includeDirectoriesHash,
+    FileStat const& stat,
+    std::vector<std::string>* pOut)const
+{
+    auto key = sMakeKey(filepath, includeDirectoriesHash);
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    auto it = this->mEntries.find(key);
+    if (this->mEntries.end() == it || stat != it->second.stat) {
+        return false;
+    }
+    *pOut = it->second.includes;
+    return true;
+}
+
+void IncludeGraphCache::record(
+    std::string const& filepath,
+    uint64_t includeDirectoriesHash,
+    FileStat const& stat,
+    std::vector<std::string> const& includes)
+{
+    auto key = sMakeKey(filepath, includeDirectoriesHash);
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    auto& entry = this->mEntries[key];
+    entry.stat = stat;
+    entry.includes = includes;
+    this->mIsDirty = true;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+
+#include "utility.h"
+
+namespace watagashi
+{
+
+// Keeps the resolved direct includes of each file which IncludeFileAnalyzer scanned,
+// so that the next build rescans only the files whose metadata changed.
+// A file is keyed by its path and the include directories which resolved it.
+class IncludeGraphCache
+{
+    IncludeGraphCache(IncludeGraphCache const&) = delete;
+    IncludeGraphCache& operator=(IncludeGraphCache const&) = delete;
+
+public:
+    // the file name in the intermediate directory.
+    static char const* const sFilename;
+
+public:
+    explicit IncludeGraphCache(boost::filesystem::path const& filepath);
+
+    // A missing or unknown file is an empty cache.
+    bool load();
+    // Write the cache when it was changed.
+    bool save()const;
+
+    // Return true with the includes when the file is cached with the same metadata.
+    bool find(
+        std::string const& filepath,
+        uint64_t includeDirectoriesHash,
+        FileStat const& stat,
+        std::vector<std::string>* pOut)const;
+    void record(
+        std::string const& filepath,
+        uint64_t includeDirectoriesHash,
+        FileStat const& stat,
+        std::vector<std::string> const& includes);
+
+private:
+    struct Entry
+    {
+        FileStat stat;
+        std::vector<std::string> includes;
+    };
+
+    static std::string sMakeKey(std::string const& filepath, uint64_t includeDirectoriesHash);
+
+private:
+    boost::filesystem::path mFilepath;
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, Entry> mEntries;
+    bool mIsDirty;
+};
+
+}
@@ -0,0 +1,275 @@
+#include "includeScanner.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define WATAGASHI_INCLUDE_SCANNER_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace watagashi
+{
+
+//=============================================================================
+//
+//    class IncludeScanner
+//
+//=============================================================================
+
+static bool isIdentifierChar(char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || '_' == c;
+}
+
+static bool isSpace(char c)
+{
+    return ' ' == c || '\t' == c || '\r' == c || '\f' == c || '\v' == c;
+}
+
+// the characters which may start a directive, a comment or a literal.
+static bool isSpecialChar(char c)
+{
+    return '#' == c || '/' == c || '"' == c || '\'' == c;
+}
+
+#ifdef WATAGASHI_INCLUDE_SCANNER_SSE2
+static int countTrailingZero(unsigned int mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+static char const* findSpecialChar(char const* p, char const* pEnd)
+{
+#ifdef WATAGASHI_INCLUDE_SCANNER_SSE2
+    // compare 16 bytes at once. most of a source is neither a directive, a comment nor a literal.
+    auto const hash = _mm_set1_epi8('#');
+    auto const slash = _mm_set1_epi8('/');
+    auto const quote = _mm_set1_epi8('"');
+    auto const apostrophe = _mm_set1_epi8('\'');
+    for (; 16 <= pEnd - p; p += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+        auto match = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, hash), _mm_cmpeq_epi8(chunk, slash)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, apostrophe)));
+        auto mask = static_cast<unsigned int>(_mm_movemask_epi8(match));
+        if (0 != mask) {
+            return p + countTrailingZero(mask);
+        }
+    }
+#endif
+    for (; p < pEnd; ++p) {
+        if (isSpecialChar(*p)) {
+            return p;
+        }
+    }
+    return pEnd;
+}
+
+static char const* findLastChar(char const* pBegin, char const* pEnd, char c)
+{
+#ifdef __GLIBC__
+    return static_cast<char const*>(memrchr(pBegin, c, pEnd - pBegin));
+#else
+    for (auto p = pEnd; pBegin < p; --p) {
+        if (c == p[-1]) {
+            return p - 1;
+        }
+    }
+    return nullptr;
+#endif
+}
+
+// '#' starts a directive only when it is the first character of the line.
+static bool isLineHead(char const* pBegin, char const* p)
+{
+    while (pBegin < p && isSpace(p[-1])) {
+        --p;
+    }
+    return pBegin == p || '\n' == p[-1];
+}
+
+static char const* skipLineComment(char const* p, char const* pEnd)
+{
+    while (p < pEnd) {
+        auto pNewLine = static_cast<char const*>(std::memchr(p, '\n', pEnd - p));
+        if (!pNewLine) {
+            return pEnd;
+        }
+        // '\' at the end of the line continues the comment.
+        auto q = pNewLine;
+        if (p < q && '\r' == q[-1]) {
+            --q;
+        }
+        if (p < q && '\\' == q[-1]) {
+            p = pNewLine + 1;
+            continue;
+        }
+        return pNewLine + 1;
+    }
+    return pEnd;
+}
+
+static char const* skipBlockComment(char const* p, char const* pEnd)
+{
+    while (p < pEnd) {
+        auto pStar = static_cast<char const*>(std::memchr(p, '*', pEnd - p));
+        if (!pStar || pEnd <= pStar + 1) {
+            return pEnd;
+        }
+        if ('/' == pStar[1]) {
+            return pStar + 2;
+        }
+        p = pStar + 1;
+    }
+    return pEnd;
+}
+
+static char const* skipQuoted(char const* p, char const* pEnd, char quote)
+{
+    for (; p < pEnd; ++p) {
+        if ('\\' == *p) {
+            ++p;
+            continue;
+        }
+        // an unterminated literal ends at the end of the line.
+        if (quote == *p || '\n' == *p) {
+            return p + 1;
+        }
+    }
+    return pEnd;
+}
+
+// R"(...)" and the encoding prefixes of it.
+static bool isRawStringPrefix(char const* pBegin, char const* pQuote)
+{
+    auto p = pQuote;
+    while (pBegin < p && isIdentifierChar(p[-1])) {
+        --p;
+    }
+    auto isPrefix = [&](char const* prefix) {
+        auto length = std::strlen(prefix);
+        return static_cast<size_t>(pQuote - p) == length && 0 == std::memcmp(p, prefix, length);
+    };
+    return isPrefix("R") || isPrefix("uR") || isPrefix("UR") || isPrefix("LR") || isPrefix("u8R");
+}
+
+static char const* skipRawString(char const* p, char const* pEnd)
+{
+    // the delimiter is up to 16 characters before '('.
+    auto pDelimiter = p;
+    for (; p < pEnd && '(' != *p; ++p) {
+        if (16 <= p - pDelimiter || ')' == *p || '\\' == *p || '"' == *p || '\n' == *p || isSpace(*p)) {
+            return skipQuoted(pDelimiter, pEnd, '"');
+        }
+    }
+    auto delimiterLength = static_cast<size_t>(p - pDelimiter);
+    while (p < pEnd) {
+        auto pParen = static_cast<char const*>(std::memchr(p, ')', pEnd - p));
+        if (!pParen) {
+            return pEnd;
+        }
+        auto pClose = pParen + 1 + delimiterLength;
+        if (pClose < pEnd && '"' == *pClose && 0 == std::memcmp(pParen + 1, pDelimiter, delimiterLength)) {
+            return pClose + 1;
+        }
+        p = pParen + 1;
+    }
+    return pEnd;
+}
+
+// the digit separator of C++14 like 1'000'000 isn't a character literal.
+static bool isDigitSeparator(char const* pBegin, char const* pApostrophe)
+{
+    auto p = pApostrophe;
+    while (pBegin < p && (isIdentifierChar(p[-1]) || '\'' == p[-1] || '.' == p[-1])) {
+        --p;
+    }
+    return p < pApostrophe && '0' <= *p && *p <= '9';
+}
+
+// Read the directive after '#' and return the position to continue scanning.
+static char const* readDirective(char const* p, char const* pEnd, std::vector<IncludeScanner::Include>* pOut)
+{
+    while (p < pEnd && isSpace(*p)) {
+        ++p;
+    }
+    static char const keyword[] = "include";
+    auto keywordLength = sizeof(keyword) - 1;
+    if (static_cast<size_t>(pEnd - p) <= keywordLength
+        || 0 != std::memcmp(p, keyword, keywordLength)
+        || isIdentifierChar(p[keywordLength])) {
+        return p;
+    }
+    p += keywordLength;
+    while (p < pEnd && isSpace(*p)) {
+        ++p;
+    }
+    if (pEnd <= p || ('<' != *p && '"' != *p)) {
+        // #include MACRO can't be resolved without the preprocessor.
+        return p;
+    }
+    auto isAngled = '<' == *p;
+    auto close = isAngled ? '>' : '"';
+    auto pPath = p + 1;
+    for (auto q = pPath; q < pEnd && '\n' != *q; ++q) {
+        if (close == *q) {
+            if (pPath < q) {
+                pOut->push_back({ isAngled, std::string(pPath, q) });
+            }
+            return q + 1;
+        }
+    }
+    return pPath;
+}
+
+void IncludeScanner::sScan(char const* pBegin, char const* pEnd, std::vector<Include>* pOut)
+{
+    // no directive follows the line of the last '#'.
+    auto pLastHash = findLastChar(pBegin, pEnd, '#');
+    if (!pLastHash) {
+        return;
+    }
+    auto pStop = static_cast<char const*>(std::memchr(pLastHash, '\n', pEnd - pLastHash));
+    if (!pStop) {
+        pStop = pEnd;
+    }
+
+    auto p = pBegin;
+    while ((p = findSpecialChar(p, pStop)) < pStop) {
+        switch (*p) {
+        case '#':
+            p = isLineHead(pBegin, p) ? readDirective(p + 1, pStop, pOut) : p + 1;
+            break;
+        case '/':
+            if (p + 1 < pStop && '/' == p[1]) {
+                p = skipLineComment(p + 2, pStop);
+            } else if (p + 1 < pStop && '*' == p[1]) {
+                p = skipBlockComment(p + 2, pStop);
+            } else {
+                ++p;
+            }
+            break;
+        case '"':
+            p = isRawStringPrefix(pBegin, p) ? skipRawString(p + 1, pStop) : skipQuoted(p + 1, pStop, '"');
+            break;
+        case '\'':
+            p = isDigitSeparator(pBegin, p) ? p + 1 : skipQuoted(p + 1, pStop, '\'');
+            break;
+        default:
+            ++p;
+            break;
+        }
+    }
+}
+
+}
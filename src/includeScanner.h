@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace watagashi
+{
+
+// Finds the #include directives in a C/C++ source without std::regex.
+// It skips to the characters which may start a directive, a comment or a literal,
+// so that "#include" in comments and string literals (raw strings too) is ignored.
+// It stops at the line of the last '#' because no directive follows it.
+class IncludeScanner
+{
+public:
+    struct Include
+    {
+        // true for <...>, false for "...".
+        bool isAngled;
+        std::string path;
+    };
+
+    static void sScan(char const* pBegin, char const* pEnd, std::vector<Include>* pOut);
+
+public:
+    IncludeScanner() = delete;
+    ~IncludeScanner() = delete;
+};
+
+}
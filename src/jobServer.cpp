@@ -0,0 +1,269 @@
+#include "jobServer.h"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+using namespace std;
+
+namespace watagashi
+{
+
+#ifndef _WIN32
+static bool isValidFd(int fd)
+{
+    return 0 <= fd && 0 <= ::fcntl(fd, F_GETFD);
+}
+
+// Open a new file description of the pipe so that O_NONBLOCK doesn't affect the other processes.
+static int reopenNonBlocking(int fd, int flags)
+{
+    auto path = "/proc/self/fd/" + std::to_string(fd);
+    return ::open(path.c_str(), flags | O_NONBLOCK | O_CLOEXEC);
+}
+
+static std::vector<std::string> splitMakeflags(char const* makeflags)
+{
+    std::vector<std::string> result;
+    std::istringstream in(makeflags ? makeflags : "");
+    std::string word;
+    while (in >> word) {
+        result.push_back(word);
+    }
+    return result;
+}
+#endif
+
+//--------------------------------------------------------------------------------------
+//
+//  class JobServer
+//
+//--------------------------------------------------------------------------------------
+
+std::unique_ptr<JobServer> JobServer::sJoinFromEnvironment()
+{
+#ifdef _WIN32
+    return nullptr;
+#else
+    std::string auth;
+    for (auto& word : splitMakeflags(std::getenv("MAKEFLAGS"))) {
+        for (auto prefix : { "--jobserver-auth=", "--jobserver-fds=" }) {
+            if (0 == word.compare(0, std::strlen(prefix), prefix)) {
+                auth = word.substr(std::strlen(prefix));
+            }
+        }
+    }
+    if (auth.empty()) {
+        return nullptr;
+    }
+
+    std::unique_ptr<JobServer> pResult(new JobServer());
+    pResult->mIsClient = true;
+    if (0 == auth.compare(0, 5, "fifo:")) {
+        auto path = auth.substr(5);
+        pResult->mReadFd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (pResult->mReadFd < 0) {
+            cerr << "warning: failed to open jobserver fifo '" << path << "'. " << std::strerror(errno) << endl;
+            return nullptr;
+        }
+        pResult->mWriteFd = pResult->mReadFd;
+        pResult->mIsNonBlocking = true;
+        return pResult;
+    }
+
+    int readFd = -1, writeFd = -1;
+    if (2 != std::sscanf(auth.c_str(), "%d,%d", &readFd, &writeFd)
+        || !isValidFd(readFd) || !isValidFd(writeFd)) {
+        cerr << "warning: jobserver unavailable. add '+' to the parent make rule. auth=" << auth << endl;
+        return nullptr;
+    }
+    pResult->mReadFd = reopenNonBlocking(readFd, O_RDONLY);
+    pResult->mIsNonBlocking = 0 <= pResult->mReadFd;
+    if (!pResult->mIsNonBlocking) {
+        pResult->mReadFd = ::fcntl(readFd, F_DUPFD_CLOEXEC, 0);
+    }
+    pResult->mWriteFd = ::fcntl(writeFd, F_DUPFD_CLOEXEC, 0);
+    return pResult;
+#endif
+}
+
+std::unique_ptr<JobServer> JobServer::sCreate(size_t jobCount)
+{
+#ifdef _WIN32
+    (void)jobCount;
+    return nullptr;
+#else
+    std::unique_ptr<JobServer> pResult(new JobServer());
+    pResult->mIsClient = false;
+    if (::pipe(pResult->mPipeFds) < 0) {
+        cerr << "warning: failed to create jobserver. " << std::strerror(errno) << endl;
+        return nullptr;
+    }
+    std::string tokens(jobCount <= 1 ? 0 : jobCount - 1, '+');
+    if (!tokens.empty() && ::write(pResult->mPipeFds[1], tokens.data(), tokens.size()) < 0) {
+        cerr << "warning: failed to create jobserver. " << std::strerror(errno) << endl;
+        return nullptr;
+    }
+
+    pResult->mReadFd = reopenNonBlocking(pResult->mPipeFds[0], O_RDONLY);
+    pResult->mIsNonBlocking = 0 <= pResult->mReadFd;
+    if (!pResult->mIsNonBlocking) {
+        pResult->mReadFd = ::fcntl(pResult->mPipeFds[0], F_DUPFD_CLOEXEC, 0);
+    }
+    pResult->mWriteFd = ::fcntl(pResult->mPipeFds[1], F_DUPFD_CLOEXEC, 0);
+
+    auto pMakeflags = std::getenv("MAKEFLAGS");
+    pResult->mHasPrevMakeflags = nullptr != pMakeflags;
+    pResult->mPrevMakeflags = pMakeflags ? pMakeflags : "";
+
+    std::string makeflags;
+    for (auto& word : splitMakeflags(pMakeflags)) {
+        if (0 == word.compare(0, 2, "-j")
+            || 0 == word.compare(0, 17, "--jobserver-auth=")
+            || 0 == word.compare(0, 16, "--jobserver-fds=")) {
+            continue;
+        }
+        makeflags += word + " ";
+    }
+    auto fds = std::to_string(pResult->mPipeFds[0]) + "," + std::to_string(pResult->mPipeFds[1]);
+    makeflags += "-j" + std::to_string(jobCount) + " --jobserver-auth=" + fds;
+    ::setenv("MAKEFLAGS", makeflags.c_str(), 1);
+    return pResult;
+#endif
+}
+
+JobServer::JobServer()
+    : mReadFd(-1)
+    , mWriteFd(-1)
+    , mIsNonBlocking(false)
+    , mIsClient(true)
+    , mIsBroken(false)
+    , mPipeFds{ -1, -1 }
+    , mHasPrevMakeflags(false)
+    , mIsImplicitSlotUsed(false)
+{}
+
+JobServer::~JobServer()
+{
+#ifndef _WIN32
+    for (auto token : this->mTokens) {
+        if (::write(this->mWriteFd, &token, 1) < 0) {
+            break;
+        }
+    }
+
+    std::vector<int> fds = { this->mReadFd, this->mWriteFd, this->mPipeFds[0], this->mPipeFds[1] };
+    if (this->mReadFd == this->mWriteFd) {
+        fds[1] = -1;
+    }
+    for (auto fd : fds) {
+        if (0 <= fd) {
+            ::close(fd);
+        }
+    }
+
+    if (!this->mIsClient) {
+        if (this->mHasPrevMakeflags) {
+            ::setenv("MAKEFLAGS", this->mPrevMakeflags.c_str(), 1);
+        } else {
+            ::unsetenv("MAKEFLAGS");
+        }
+    }
+#endif
+}
+
+bool JobServer::acquire(int timeoutMilliseconds)
+{
+#ifdef _WIN32
+    (void)timeoutMilliseconds;
+    return true;
+#else
+    using namespace std::chrono;
+    auto const limit = steady_clock::now() + milliseconds(timeoutMilliseconds);
+    while (!this->tryAcquire()) {
+        int waitTime = -1;
+        if (0 <= timeoutMilliseconds) {
+            auto rest = duration_cast<milliseconds>(limit - steady_clock::now()).count();
+            if (rest <= 0) {
+                return false;
+            }
+            waitTime = static_cast<int>(rest);
+        }
+        pollfd pfd = { this->mReadFd, POLLIN, 0 };
+        ::poll(&pfd, 1, waitTime);
+    }
+    return true;
+#endif
+}
+
+bool JobServer::tryAcquire()
+{
+    bool isUsed = false;
+    if (this->mIsImplicitSlotUsed.compare_exchange_strong(isUsed, true)) {
+        return true;
+    }
+    if (this->mIsBroken) {
+        return true;
+    }
+
+#ifdef _WIN32
+    return true;
+#else
+    if (!this->mIsNonBlocking) {
+        pollfd pfd = { this->mReadFd, POLLIN, 0 };
+        if (::poll(&pfd, 1, 0) <= 0) {
+            return false;
+        }
+    }
+
+    char token;
+    auto r = ::read(this->mReadFd, &token, 1);
+    if (1 == r) {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        this->mTokens.push_back(token);
+        return true;
+    }
+    if (0 == r || (r < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)) {
+        cerr << "warning: lost the jobserver. run jobs without it." << endl;
+        this->mIsBroken = true;
+        return true;
+    }
+    return false;
+#endif
+}
+
+void JobServer::release()
+{
+#ifndef _WIN32
+    {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        if (!this->mTokens.empty()) {
+            auto token = this->mTokens.back();
+            this->mTokens.pop_back();
+            while (::write(this->mWriteFd, &token, 1) < 0 && EINTR == errno) {}
+            return;
+        }
+    }
+#endif
+    this->mIsImplicitSlotUsed = false;
+}
+
+int JobServer::readFd()const
+{
+    return this->mReadFd;
+}
+
+bool JobServer::isClient()const
+{
+    return this->mIsClient;
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+namespace watagashi
+{
+
+// Share job slots with GNU make and other watagashi processes by the make jobserver protocol.
+// A process always owns one implicit slot, and reads a token from the jobserver for each other slot.
+class JobServer
+{
+    JobServer(JobServer const&) = delete;
+    JobServer& operator=(JobServer const&) = delete;
+
+public:
+    // Join the jobserver described by "--jobserver-auth" in MAKEFLAGS.
+    // Return nullptr when MAKEFLAGS has no usable jobserver.
+    static std::unique_ptr<JobServer> sJoinFromEnvironment();
+
+    // Create a jobserver which has jobCount slots and export it to MAKEFLAGS,
+    // so nested make or watagashi invocations and hooks share the slots.
+    static std::unique_ptr<JobServer> sCreate(size_t jobCount);
+
+public:
+    ~JobServer();
+
+    // Block until a slot is acquired or timeout. -1 is infinite.
+    bool acquire(int timeoutMilliseconds);
+    bool tryAcquire();
+    void release();
+
+    // This becomes readable when a token may be acquired.
+    int readFd()const;
+    bool isClient()const;
+
+private:
+    JobServer();
+
+private:
+    int mReadFd;
+    int mWriteFd;
+    bool mIsNonBlocking;
+    bool mIsClient;
+    std::atomic<bool> mIsBroken;
+
+    // the pipe which the child processes inherit. only a server has it.
+    int mPipeFds[2];
+    std::string mPrevMakeflags;
+    bool mHasPrevMakeflags;
+
+    std::atomic<bool> mIsImplicitSlotUsed;
+    std::mutex mMutex;
+    std::vector<char> mTokens;
+};
+
+}
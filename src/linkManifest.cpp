@@ -0,0 +1,130 @@
+#include "linkManifest.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <unordered_map>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sHeader = "# watagashi link v1";
+
+char const* const LinkManifest::sFilename = ".watagashi_link";
+
+//--------------------------------------------------------------------------------------
+//
+//  class LinkManifest
+//
+//--------------------------------------------------------------------------------------
+
+LinkManifest::LinkManifest(boost::filesystem::path const& filepath)
+    : mFilepath(filepath)
+    , mCommandSignature(0)
+{}
+
+bool LinkManifest::load()
+{
+    this->mCommandSignature = 0;
+    this->mOutputStat = FileStat();
+    this->mInputs.clear();
+
+    std::ifstream in(this->mFilepath.string());
+    std::string line;
+    if (!std::getline(in, line) || sHeader != line) {
+        return false;
+    }
+    // <command signature>\t<output mtime>\t<output size>\t<output inode>
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    auto fields = split(line, '\t');
+    if (fields.size() < 4) {
+        return false;
+    }
+    this->mCommandSignature = std::strtoull(fields[0].c_str(), nullptr, 16);
+    this->mOutputStat.mtime = std::strtoll(fields[1].c_str(), nullptr, 10);
+    this->mOutputStat.size = std::strtoull(fields[2].c_str(), nullptr, 10);
+    this->mOutputStat.inode = std::strtoull(fields[3].c_str(), nullptr, 10);
+    // <mtime>\t<size>\t<inode>\t<hash>\t<object filepath>
+    while (std::getline(in, line)) {
+        fields = split(line, '\t');
+        if (fields.size() < 5) {
+            continue;
+        }
+        Input input;
+        input.stat.mtime = std::strtoll(fields[0].c_str(), nullptr, 10);
+        input.stat.size = std::strtoull(fields[1].c_str(), nullptr, 10);
+        input.stat.inode = std::strtoull(fields[2].c_str(), nullptr, 10);
+        input.hash = std::strtoull(fields[3].c_str(), nullptr, 16);
+        input.filepath = fields[4];
+        this->mInputs.push_back(std::move(input));
+    }
+    return true;
+}
+
+bool LinkManifest::isOutdated(
+    boost::filesystem::path const& outputFilepath,
+    uint64_t commandSignature,
+    std::vector<boost::filesystem::path> const& inputFilepaths)
+{
+    FileStat outputStat;
+    bool isOutdated = !statFile(outputFilepath, &outputStat)
+        || outputStat != this->mOutputStat
+        || commandSignature != this->mCommandSignature
+        || inputFilepaths.size() != this->mInputs.size();
+
+    std::unordered_map<std::string, Input const*> prevInputs;
+    for (auto& input : this->mInputs) {
+        prevInputs[input.filepath] = &input;
+    }
+    // the order of the objects changes the output too.
+    std::vector<Input> inputs(inputFilepaths.size());
+    for (size_t i = 0; i < inputFilepaths.size(); ++i) {
+        auto& input = inputs[i];
+        input.filepath = inputFilepaths[i].generic_string();
+        if (!statFile(inputFilepaths[i], &input.stat)) {
+            this->mInputs.clear();
+            return true;
+        }
+        auto it = prevInputs.find(input.filepath);
+        if (prevInputs.end() != it && input.stat == it->second->stat) {
+            input.hash = it->second->hash;
+        } else if (!hashFile(inputFilepaths[i], &input.hash)) {
+            this->mInputs.clear();
+            return true;
+        }
+        isOutdated = isOutdated || this->mInputs[i].filepath != input.filepath || this->mInputs[i].hash != input.hash;
+    }
+
+    this->mCommandSignature = commandSignature;
+    this->mInputs = std::move(inputs);
+    return isOutdated;
+}
+
+bool LinkManifest::save(boost::filesystem::path const& outputFilepath)const
+{
+    FileStat outputStat;
+    if (!statFile(outputFilepath, &outputStat)) {
+        return false;
+    }
+    createDirectory(this->mFilepath.parent_path());
+    std::ofstream out(this->mFilepath.string(), std::ios::trunc);
+    out << sHeader << "\n";
+    out << toHexString(this->mCommandSignature) << "\t"
+        << outputStat.mtime << "\t" << outputStat.size << "\t" << outputStat.inode << "\n";
+    for (auto& input : this->mInputs) {
+        out << input.stat.mtime << "\t" << input.stat.size << "\t" << input.stat.inode << "\t"
+            << toHexString(input.hash) << "\t" << input.filepath << "\n";
+    }
+    if (!out) {
+        cerr << "warning: failed to write the link manifest. path=" << this->mFilepath << endl;
+        return false;
+    }
+    return true;
+}
+
+}
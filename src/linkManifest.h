@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/filesystem.hpp>
+
+#include "utility.h"
+
+namespace watagashi
+{
+
+// Records the objects which the last link read and the hashes of their contents, like the restat of ninja.
+// The link is skipped when the output, the command and the list of the objects are the same and
+// every object has the same content, so an object compiled again to the same bytes doesn't link again.
+// The hash of an object is reused while its metadata is the same.
+class LinkManifest
+{
+    LinkManifest(LinkManifest const&) = delete;
+    LinkManifest& operator=(LinkManifest const&) = delete;
+
+public:
+    // the file name in the intermediate directory.
+    static char const* const sFilename;
+
+public:
+    explicit LinkManifest(boost::filesystem::path const& filepath);
+
+    // A missing or unknown file is an empty manifest, which links.
+    bool load();
+    // Return true when the output must be linked again. It hashes the objects whose metadata changed.
+    bool isOutdated(
+        boost::filesystem::path const& outputFilepath,
+        uint64_t commandSignature,
+        std::vector<boost::filesystem::path> const& inputFilepaths);
+    // Record the output and the objects which isOutdated() checked.
+    bool save(boost::filesystem::path const& outputFilepath)const;
+
+private:
+    struct Input
+    {
+        std::string filepath;
+        FileStat stat;
+        uint64_t hash = 0;
+    };
+
+private:
+    boost::filesystem::path mFilepath;
+    uint64_t mCommandSignature;
+    FileStat mOutputStat;
+    std::vector<Input> mInputs;
+};
+
+}
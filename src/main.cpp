@@ -1,4 +1,8 @@
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
 
 #include <boost/filesystem.hpp>
 #include <boost/range/algorithm/for_each.hpp>
@@ -9,6 +13,11 @@
 #include "programOptions.h"
 #include "exception.hpp"
 #include "includeFileAnalyzer.h"
+#include "includeGraphCache.h"
+#include "buildDaemon.h"
+#include "fileWatcher.h"
+#include "dependencyStore.h"
+#include "unityBuild.h"
 #include "data.h"
 #include "parser/parser.h"
 #include "parser/value.h"
@@ -18,7 +27,18 @@ using namespace std;
 using namespace watagashi;
 namespace fs = boost::filesystem;
 
-static data::Project createProject(parser::Value const& externObj, watagashi::ProgramOptions const& options);
+// the directories which createProject() walked and their stats. a new or removed file changes them.
+using DirectoryStats = std::vector<std::pair<fs::path, FileStat>>;
+
+static data::Project createProject(parser::Value const& externObj, watagashi::ProgramOptions const& options, DirectoryStats* pOutDirectories = nullptr);
+static int runTask(
+    watagashi::ProgramOptions const& options,
+    parser::Value const& configData,
+    data::Project const& project,
+    IncludeGraphCache* pIncludeGraphCache = nullptr);
+static int runDaemon(watagashi::ProgramOptions const& options);
+static int runWatch(watagashi::ProgramOptions const& options);
+static void prepareBuilder(Builder& builder, parser::Value const& configData, IncludeGraphCache* pIncludeGraphCache);
 static void setBuilder(Builder &builder, parser::Value const& configData);
 static void definedBuildInData(parser::Value& externObj);
 static data::Compiler createClangCppCompiler();
@@ -36,6 +56,20 @@ int main(int argn, char** args)
         }
         auto taskType = options.taskType();
 
+        if (ProgramOptions::TaskType::Daemon == taskType) {
+            return runDaemon(options);
+        }
+        if (ProgramOptions::TaskType::Watch == taskType) {
+            return runWatch(options);
+        }
+        if (options.useDaemon) {
+            int exitCode = 0;
+            if (BuildDaemon::sForward(BuildDaemon::sMakeSocketPath(options.configFilepath), argn, args, &exitCode)) {
+                return exitCode;
+            }
+            cerr << "warning: no daemon serves '" << options.configFilepath << "'. run the task in this process." << endl;
+        }
+
         parser::ParserDesc desc;
         definedBuildInData(desc.externObj);
         auto parseResult = parser::parse(boost::filesystem::path(options.configFilepath), desc);
@@ -51,29 +85,472 @@ int main(int argn, char** args)
         }
 
         data::Project project = createProject(configData, options);
-        Builder builder(project, options);
-        setBuilder(builder, configData);
-        builder.addCompiler(createClangCppCompiler());
-        builder.addCompiler(createGccCppCompiler());
+        return runTask(options, configData, project);
+    } catch (...) {
+        ExceptionHandlerSetter::terminate();
+        return 1;
+    }
+
+    return 0;
+}
+
+int runTask(
+    watagashi::ProgramOptions const& options,
+    parser::Value const& configData,
+    data::Project const& project,
+    IncludeGraphCache* pIncludeGraphCache)
+{
+    Builder builder(project, options);
+    prepareBuilder(builder, configData, pIncludeGraphCache);
 
+    switch (options.taskType()) {
+    case ProgramOptions::TaskType::Build:       builder.build(); break;
+    case ProgramOptions::TaskType::Clean:       builder.clean(); break;
+    case ProgramOptions::TaskType::Rebuild:     builder.rebuild(); break;
+    case ProgramOptions::TaskType::ListupFiles: builder.listupFiles(); break;
+    case ProgramOptions::TaskType::Install:     builder.install(); break;
+    default:
+        cerr << "unknwon task type..." << endl;
+        return 1;
+    }
+    return 0;
+}
+
+void prepareBuilder(Builder& builder, parser::Value const& configData, IncludeGraphCache* pIncludeGraphCache)
+{
+    setBuilder(builder, configData);
+    builder.addCompiler(createClangCppCompiler());
+    builder.addCompiler(createGccCppCompiler());
+    builder.setIncludeGraphCache(pIncludeGraphCache);
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class DaemonState
+//
+//--------------------------------------------------------------------------------------
+
+// Keeps the parsed configs and the projects between the requests of the daemon.
+// A config is parsed again when the file changes, and a project is created again
+// when the config or one of the directories of its targets changes.
+class DaemonState
+{
+public:
+    int runTask(std::vector<std::string> const& args);
+
+private:
+    struct Config
+    {
+        FileStat stat;
+        uint64_t generation = 0;
+        // the values refer to the definitions in the desc.
+        parser::ParserDesc desc;
+        parser::ParseResult result;
+    };
+
+    struct ProjectEntry
+    {
+        uint64_t configGeneration = 0;
+        data::Project project;
+        DirectoryStats directories;
+        // valid while the files keep their stats, so it outlives the project.
+        std::unique_ptr<IncludeGraphCache> pIncludeGraphCache;
+    };
+
+    Config const& loadConfig_(std::string const& configFilepath);
+    ProjectEntry& loadProject_(Config const& config, std::string const& configKey, ProgramOptions const& options);
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<Config>> mConfigs;
+    std::unordered_map<std::string, std::unique_ptr<ProjectEntry>> mProjects;
+    uint64_t mGeneration = 0;
+};
+
+int DaemonState::runTask(std::vector<std::string> const& args)
+{
+    auto argsCopy = args;
+    std::vector<char*> argv;
+    for (auto& arg : argsCopy) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    try {
+        auto options = watagashi::ProgramOptions();
+        if (!options.parse(static_cast<int>(argsCopy.size()), argv.data())) {
+            return 0;
+        }
+        if (ProgramOptions::TaskType::Daemon == options.taskType()) {
+            cerr << "error: the daemon is already running." << endl;
+            return 1;
+        }
+        if (ProgramOptions::TaskType::Watch == options.taskType()) {
+            cerr << "error: the daemon can't run the watch task. run it without --daemon." << endl;
+            return 1;
+        }
+
+        auto configKey = fs::absolute(options.configFilepath).lexically_normal().string();
+        auto& config = this->loadConfig_(options.configFilepath);
         switch (options.taskType()) {
-        case ProgramOptions::TaskType::Build:       builder.build(); break;
-        case ProgramOptions::TaskType::Clean:       builder.clean(); break;
-        case ProgramOptions::TaskType::Rebuild:     builder.rebuild(); break;
-        case ProgramOptions::TaskType::ListupFiles: builder.listupFiles(); break;
-        case ProgramOptions::TaskType::Install:     builder.install(); break;
+        case ProgramOptions::TaskType::Interactive:
+            parser::confirmValueInInteractive(config.result.globalObj);
+            return 0;
+        case ProgramOptions::TaskType::ShowProjects:
+            showProjects(config.result.globalObj);
+            return 0;
         default:
-            cerr << "unknwon task type..." << endl;
-            return 1;
+            break;
         }
-    } catch (...) {
-        ExceptionHandlerSetter::terminate();
+
+        auto& entry = this->loadProject_(config, configKey, options);
+        return ::runTask(options, config.result.globalObj, entry.project, entry.pIncludeGraphCache.get());
+    } catch (boost::exception const& e) {
+        // the daemon keeps serving after the task failed.
+        ExceptionHandlerSetter::handleBoostException(e);
+    } catch (std::exception const& e) {
+        cerr << e.what() << endl;
+    }
+    return 1;
+}
+
+DaemonState::Config const& DaemonState::loadConfig_(std::string const& configFilepath)
+{
+    auto key = fs::absolute(configFilepath).lexically_normal().string();
+    FileStat stat;
+    statFile(key, &stat);
+    auto& pConfig = this->mConfigs[key];
+    if (!pConfig || !(pConfig->stat == stat)) {
+        auto pNewConfig = std::make_unique<Config>();
+        definedBuildInData(pNewConfig->desc.externObj);
+        pNewConfig->result = parser::parse(boost::filesystem::path(configFilepath), pNewConfig->desc);
+        pNewConfig->stat = stat;
+        pNewConfig->generation = ++this->mGeneration;
+        pConfig = std::move(pNewConfig);
+    }
+    return *pConfig;
+}
+
+DaemonState::ProjectEntry& DaemonState::loadProject_(Config const& config, std::string const& configKey, ProgramOptions const& options)
+{
+    // the project has the paths relative to the working directory of the client.
+    boost::system::error_code ec;
+    auto key = configKey + "\n" + options.targetProject + "\n" + options.rootDirectories + "\n" + fs::current_path(ec).string();
+    auto& pEntry = this->mProjects[key];
+
+    bool isValid = pEntry && config.generation == pEntry->configGeneration;
+    if (isValid) {
+        for (auto& [directory, stat] : pEntry->directories) {
+            FileStat current;
+            if (!statFile(directory, &current) || !(current == stat)) {
+                isValid = false;
+                break;
+            }
+        }
+    }
+    if (isValid) {
+        return *pEntry;
+    }
+
+    auto pNewEntry = std::make_unique<ProjectEntry>();
+    pNewEntry->project = createProject(config.result.globalObj, options, &pNewEntry->directories);
+    pNewEntry->configGeneration = config.generation;
+    auto includeGraphCachePath = pNewEntry->project.makeIntermediatePath() / IncludeGraphCache::sFilename;
+    if (pEntry && pEntry->project.makeIntermediatePath() == pNewEntry->project.makeIntermediatePath()) {
+        pNewEntry->pIncludeGraphCache = std::move(pEntry->pIncludeGraphCache);
+    } else {
+        pNewEntry->pIncludeGraphCache = std::make_unique<IncludeGraphCache>(includeGraphCachePath);
+        pNewEntry->pIncludeGraphCache->load();
+    }
+    pEntry = std::move(pNewEntry);
+    return *pEntry;
+}
+
+int runDaemon(watagashi::ProgramOptions const& options)
+{
+    BuildDaemon daemon(BuildDaemon::sMakeSocketPath(options.configFilepath));
+    if (!daemon.open()) {
+        return 1;
+    }
+    DaemonState state;
+    daemon.run([&](std::vector<std::string> const& args) {
+        return state.runTask(args);
+    });
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class ProjectWatcher
+//
+//--------------------------------------------------------------------------------------
+
+// Builds the project whenever its files change.
+// It watches the config file, the directories of the targets and the directories of the dependencies
+// which the compilers reported. A change of the config parses it again, a new or removed source
+// creates the project again, and a change of a source or a dependency builds the project,
+// where the up-to-date check compiles only the affected targets.
+class ProjectWatcher
+{
+public:
+    explicit ProjectWatcher(watagashi::ProgramOptions const& options);
+
+    int run();
+
+private:
+    enum class Change {
+        None,
+        Build,
+        Project,
+        Config,
+    };
+
+    struct Config
+    {
+        // the values refer to the definitions in the desc.
+        parser::ParserDesc desc;
+        parser::ParseResult result;
+    };
+
+    bool load_(Change change);
+    void watchDependencies_();
+    // Build the project, and return the changes while building.
+    Change build_(std::unordered_set<std::string>* pOutTargets);
+    // Classify the changes, and collect the targets whose compiles are outdated by them.
+    Change classify_(std::vector<FileWatcher::Event> const& events, std::unordered_set<std::string>* pOutTargets)const;
+    bool isUnder_(fs::path const& path, fs::path const& directory)const;
+
+private:
+    static int const sQuietMilliseconds = 100;
+    static int const sPollMilliseconds = 100;
+
+    watagashi::ProgramOptions const& mOptions;
+    fs::path mConfigFilepath;
+    FileWatcher mWatcher;
+    std::unique_ptr<Config> mpConfig;
+    data::Project mProject;
+    std::unique_ptr<IncludeGraphCache> mpIncludeGraphCache;
+    fs::path mIntermediateDirectory;
+    fs::path mOutputDirectory;
+    // the absolute and normal paths of the targets, and of the dependencies to the targets which include them.
+    std::unordered_set<std::string> mTargets;
+    std::unordered_map<std::string, std::vector<std::string>> mDependents;
+    std::unordered_set<std::string> mTargetDirectories;
+};
+
+ProjectWatcher::ProjectWatcher(watagashi::ProgramOptions const& options)
+    : mOptions(options)
+    , mConfigFilepath(fs::absolute(options.configFilepath).lexically_normal())
+{}
+
+int ProjectWatcher::run()
+{
+    if (!this->mWatcher.open()) {
         return 1;
     }
 
+    auto change = Change::Config;
+    std::unordered_set<std::string> targets;
+    std::vector<FileWatcher::Event> events;
+    while (true) {
+        bool isBuild = !targets.empty();
+        if (Change::Project <= change) {
+            auto previousTargets = std::move(this->mTargets);
+            if (!this->load_(change)) {
+                // wait for the fix of the config or the sources.
+                cout << "watch: waiting for changes..." << endl;
+                this->mWatcher.wait(-1, sQuietMilliseconds, &events);
+                change = Change::Config;
+                continue;
+            }
+            // the temporary files of editors come and go in the directories of the targets.
+            isBuild |= Change::Config == change || previousTargets != this->mTargets;
+        }
+
+        change = Change::None;
+        targets.clear();
+        if (isBuild) {
+            change = this->build_(&targets);
+        }
+        if (Change::None == change) {
+            cout << "watch: waiting for changes..." << endl;
+            while (Change::None == change) {
+                this->mWatcher.wait(-1, sQuietMilliseconds, &events);
+                change = this->classify_(events, &targets);
+            }
+        }
+    }
     return 0;
 }
 
+bool ProjectWatcher::load_(Change change)
+{
+    this->mWatcher.clear();
+    // the directory is watched, since editors replace the file by a rename.
+    this->mWatcher.addDirectory(this->mConfigFilepath.parent_path());
+    try {
+        if (Change::Config == change || !this->mpConfig) {
+            auto pConfig = std::make_unique<Config>();
+            definedBuildInData(pConfig->desc.externObj);
+            pConfig->result = parser::parse(this->mConfigFilepath, pConfig->desc);
+            this->mpConfig = std::move(pConfig);
+        }
+
+        DirectoryStats directories;
+        auto project = createProject(this->mpConfig->result.globalObj, this->mOptions, &directories);
+        this->mTargetDirectories.clear();
+        for (auto& [directory, stat] : directories) {
+            this->mWatcher.addDirectory(directory);
+            this->mTargetDirectories.insert(fs::absolute(directory).lexically_normal().string());
+        }
+
+        if (!this->mpIncludeGraphCache || project.makeIntermediatePath() != this->mProject.makeIntermediatePath()) {
+            this->mpIncludeGraphCache = std::make_unique<IncludeGraphCache>(project.makeIntermediatePath() / IncludeGraphCache::sFilename);
+            this->mpIncludeGraphCache->load();
+        }
+        this->mProject = std::move(project);
+    } catch (boost::exception const& e) {
+        ExceptionHandlerSetter::handleBoostException(e);
+        return false;
+    } catch (std::exception const& e) {
+        cerr << e.what() << endl;
+        return false;
+    }
+
+    this->mIntermediateDirectory = fs::absolute(this->mProject.makeIntermediatePath()).lexically_normal();
+    this->mOutputDirectory = fs::absolute(this->mProject.makeOutputFilepath().parent_path()).lexically_normal();
+    this->mTargets.clear();
+    for (auto& target : this->mProject.targets) {
+        this->mTargets.insert(fs::absolute(this->mProject.rootDirectory / target).lexically_normal().string());
+    }
+    this->watchDependencies_();
+    return true;
+}
+
+void ProjectWatcher::watchDependencies_()
+{
+    DependencyStore dependencyStore(this->mProject.makeIntermediatePath() / DependencyStore::sFilename);
+    if (!dependencyStore.open()) {
+        return;
+    }
+    this->mDependents.clear();
+    std::vector<std::string> dependencies;
+    auto watch = [&](fs::path const& inputFilepath, fs::path const& outputFilepath) {
+        if (!dependencyStore.find(outputFilepath, &dependencies)) {
+            return;
+        }
+        auto input = fs::absolute(inputFilepath).lexically_normal().string();
+        for (auto& dependency : dependencies) {
+            auto path = fs::absolute(dependency).lexically_normal();
+            if (this->mWatcher.addDirectory(path.parent_path())) {
+                this->mDependents[path.string()].push_back(input);
+            }
+        }
+    };
+    for (auto& target : this->mProject.targets) {
+        watch(this->mProject.rootDirectory / target, this->mProject.makeIntermediatePath(target).replace_extension(".o"));
+    }
+    if (0 < this->mProject.unityCount) {
+        UnityBuild unityBuild(this->mProject, static_cast<size_t>(this->mProject.unityCount));
+        if (unityBuild.load()) {
+            for (auto& unit : unityBuild.units()) {
+                watch(unit.sourceFilepath, unit.outputFilepath);
+            }
+        }
+    }
+    dependencyStore.close();
+}
+
+ProjectWatcher::Change ProjectWatcher::build_(std::unordered_set<std::string>* pOutTargets)
+{
+    Builder builder(this->mProject, this->mOptions);
+    prepareBuilder(builder, this->mpConfig->result.globalObj, this->mpIncludeGraphCache.get());
+
+    std::atomic<bool> isBuilding(true);
+    std::thread buildThread([&]() {
+        try {
+            builder.build();
+        } catch (boost::exception const& e) {
+            ExceptionHandlerSetter::handleBoostException(e);
+        } catch (std::exception const& e) {
+            cerr << e.what() << endl;
+        }
+        isBuilding = false;
+    });
+
+    // a source saved again while it compiles makes the object outdated before it is written.
+    auto change = Change::None;
+    std::vector<FileWatcher::Event> events;
+    while (isBuilding) {
+        if (!this->mWatcher.wait(sPollMilliseconds, 0, &events)) {
+            continue;
+        }
+        std::unordered_set<std::string> targets;
+        change = std::max(change, this->classify_(events, &targets));
+        if (!targets.empty()) {
+            builder.cancelCompiles(targets);
+            pOutTargets->insert(targets.begin(), targets.end());
+        }
+    }
+    buildThread.join();
+
+    this->watchDependencies_();
+    return change;
+}
+
+ProjectWatcher::Change ProjectWatcher::classify_(std::vector<FileWatcher::Event> const& events, std::unordered_set<std::string>* pOutTargets)const
+{
+    auto change = Change::None;
+    for (auto& event : events) {
+        // the watcher lost the changes.
+        if (event.path.empty()) {
+            change = std::max(change, Change::Config);
+            continue;
+        }
+        if (event.path == this->mConfigFilepath) {
+            change = std::max(change, Change::Config);
+            continue;
+        }
+        if (this->isUnder_(event.path, this->mIntermediateDirectory) || this->isUnder_(event.path, this->mOutputDirectory)) {
+            continue;
+        }
+
+        auto key = event.path.string();
+        bool isTarget = 0 < this->mTargets.count(key);
+        if (isTarget) {
+            pOutTargets->insert(key);
+        }
+        auto it = this->mDependents.find(key);
+        if (this->mDependents.end() != it) {
+            pOutTargets->insert(it->second.begin(), it->second.end());
+        }
+        if (isTarget || this->mDependents.end() != it) {
+            change = std::max(change, Change::Build);
+        }
+
+        // a new or removed file in the directories of the targets may change the targets.
+        // a target replaced by a rename still exists.
+        if (event.isStructural
+            && 0 < this->mTargetDirectories.count(event.path.parent_path().string())
+            && (!isTarget || !fs::exists(event.path))) {
+            change = std::max(change, Change::Project);
+        }
+    }
+    return change;
+}
+
+bool ProjectWatcher::isUnder_(fs::path const& path, fs::path const& directory)const
+{
+    auto str = path.string();
+    auto dir = directory.string();
+    return dir.size() < str.size() && 0 == str.compare(0, dir.size(), dir) && '/' == str[dir.size()];
+}
+
+int runWatch(watagashi::ProgramOptions const& options)
+{
+    ProjectWatcher watcher(options);
+    return watcher.run();
+}
+
 void showProjects(parser::Value const& configData)
 {
     cout << "project list" << endl;
@@ -98,7 +575,7 @@ bool checkExtention(const fs::path& path, std::unordered_set<std::string> const&
     return extensions.end() != extensions.find(str.c_str() + 1);
 }
 
-data::Project createProject(parser::Value const& configData, watagashi::ProgramOptions const& options)
+data::Project createProject(parser::Value const& configData, watagashi::ProgramOptions const& options, DirectoryStats* pOutDirectories)
 {
     using namespace parser;
     std::string projectName = options.targetProject;
@@ -135,6 +612,12 @@ data::Project createProject(parser::Value const& configData, watagashi::ProgramO
         }
     };
 
+    auto recordDirectory = [&](fs::path const& directory) {
+        FileStat stat;
+        statFile(directory, &stat);
+        pOutDirectories->emplace_back(directory, stat);
+    };
+
     data::Project project;
     project.name = projectName;
     project.rootDirectory = options.rootDirectories;
@@ -151,6 +634,8 @@ data::Project createProject(parser::Value const& configData, watagashi::ProgramO
     project.version = getNumber("version", static_cast<int>(0), projectValue);
     project.minorNumber = getNumber("minorNumber", static_cast<int>(0), projectValue);
     project.releaseNumber = getNumber("releaseNumber", static_cast<int>(0), projectValue);
+    project.unityCount = getNumber("unityCount", static_cast<int>(0), projectValue);
+    project.precompiledHeaderRatio = getNumber("precompiledHeaderRatio", 0.0, projectValue);
     project.preprocess = getString("preprocess", "", projectValue);
     project.linkPreprocess = getString("linkPreprocess", "", projectValue);
     project.postprocess = getString("postprocess", "", projectValue);
@@ -179,9 +664,16 @@ data::Project createProject(parser::Value const& configData, watagashi::ProgramO
                 }
 
                 boost::filesystem::path path = directory.members["path"].get<Value::string>();
+                if (pOutDirectories) {
+                    recordDirectory(project.rootDirectory / path);
+                }
                 boost::for_each(
                     boost::filesystem::recursive_directory_iterator(project.rootDirectory / path)
                     | boost::adaptors::filtered([&](boost::filesystem::path const& path) {
+                       if (pOutDirectories && fs::is_directory(path)) {
+                           recordDirectory(path);
+                           return false;
+                       }
                        if (!checkExtention(path, extensions)) {
                            return false;
                        }
@@ -217,6 +709,7 @@ data::Project createProject(parser::Value const& configData, watagashi::ProgramO
             fileFilter.targetKeyward = getString("filepath", "", e);
             getStringArray(fileFilter.compileOptions, "compileOptions", e);
             getStringArray(fileFilter.includeDirectories, "includeDirectories", e);
+            fileFilter.unity = e.getChild("unity").get<bool>();
             auto process = getString("preprocess", "", e);
             if (!process.empty()) {
                 data::TaskProcess taskProcess;
@@ -260,6 +753,8 @@ void definedBuildInData(parser::Value& externObj)
     projectDefined.addMember("version", parser::MemberDefined(parser::Value::Type::Number, 0.0));
     projectDefined.addMember("minorNumber", parser::MemberDefined(parser::Value::Type::Number, 0.0));
     projectDefined.addMember("releaseNumber", parser::MemberDefined(parser::Value::Type::Number, 0.0));
+    projectDefined.addMember("unityCount", parser::MemberDefined(parser::Value::Type::Number, 0.0));
+    projectDefined.addMember("precompiledHeaderRatio", parser::MemberDefined(parser::Value::Type::Number, 0.0));
     projectDefined.addMember("preprocess", parser::MemberDefined(parser::Value::Type::String, ""s));
     projectDefined.addMember("linkPreprocess", parser::MemberDefined(parser::Value::Type::String, ""s));
     projectDefined.addMember("postprocess", parser::MemberDefined(parser::Value::Type::String, ""s));
@@ -275,6 +770,7 @@ void definedBuildInData(parser::Value& externObj)
     fileFiltersDefined.addMember("includeDirectories", parser::MemberDefined(parser::Value::Type::Array, parser::Value::array()));
     fileFiltersDefined.addMember("preprocess", parser::MemberDefined(parser::Value::Type::Array, parser::Value::array()));
     fileFiltersDefined.addMember("postprocess", parser::MemberDefined(parser::Value::Type::Array, parser::Value::array()));
+    fileFiltersDefined.addMember("unity", parser::MemberDefined(parser::Value::Type::Bool, true));
 
     externObj.addMember("Project", projectDefined);
     externObj.addMember("Directory", directoryDefiend);
@@ -288,9 +784,15 @@ data::Compiler createClangCppCompiler()
             .setCompileObj(data::Task("clang++")
                 .setInputAndOutputOption("", "-o")
                 .setOptionPrefix("-c")
+                .setDepfileOption("-MMD -MF")
+                .setPchOption("-include")
+                .setModuleOptions("-fmodule-output=", "-fmodule-file=")
                 .setPreprocesses({
                     data::TaskProcess(data::TaskProcess::Type::BuildIn, "checkUpdate")
                     })
+                .setPostprocesses({
+                    data::TaskProcess(data::TaskProcess::Type::BuildIn, "readDepfile")
+                    })
             )
             .setlinkObjs(data::Task("clang++")
                 .setInputAndOutputOption("", "-o")
@@ -300,9 +802,15 @@ data::Compiler createClangCppCompiler()
             .setCompileObj(data::Task("clang++")
                 .setInputAndOutputOption("", "-o")
                 .setCommand("-c")
+                .setDepfileOption("-MMD -MF")
+                .setPchOption("-include")
+                .setModuleOptions("-fmodule-output=", "-fmodule-file=")
                 .setPreprocesses({
                     data::TaskProcess(data::TaskProcess::Type::BuildIn, "checkUpdate")
                     })
+                .setPostprocesses({
+                    data::TaskProcess(data::TaskProcess::Type::BuildIn, "readDepfile")
+                    })
             )
             .setlinkObjs(data::Task("ar")
                 .setInputAndOutputOption("", "-o")
@@ -313,9 +821,15 @@ data::Compiler createClangCppCompiler()
             .setCompileObj(data::Task("clang++")
                 .setInputAndOutputOption("", "-o")
                 .setOptionPrefix("-c -fPIC")
+                .setDepfileOption("-MMD -MF")
+                .setPchOption("-include")
+                .setModuleOptions("-fmodule-output=", "-fmodule-file=")
                 .setPreprocesses({
                     data::TaskProcess(data::TaskProcess::Type::BuildIn, "checkUpdate")
                     })
+                .setPostprocesses({
+                    data::TaskProcess(data::TaskProcess::Type::BuildIn, "readDepfile")
+                    })
             )
             .setlinkObjs(data::Task("clang++")
                 .setInputAndOutputOption("", "-o")
@@ -334,9 +848,15 @@ data::Compiler createGccCppCompiler()
             .setCompileObj(data::Task("g++")
                 .setInputAndOutputOption("", "-o")
                 .setOptionPrefix("-c")
+                .setDepfileOption("-MMD -MF")
+                .setPchOption("-include")
+                .setModuleMapperOption("-fmodules-ts -fmodule-mapper=")
                 .setPreprocesses({
                     data::TaskProcess(data::TaskProcess::Type::BuildIn, "checkUpdate")
                     })
+                .setPostprocesses({
+                    data::TaskProcess(data::TaskProcess::Type::BuildIn, "readDepfile")
+                    })
             )
             .setlinkObjs(data::Task("g++")
                 .setInputAndOutputOption("", "-o")
@@ -346,9 +866,15 @@ data::Compiler createGccCppCompiler()
             .setCompileObj(data::Task("g++")
                 .setInputAndOutputOption("", "-o")
                 .setCommand("-c")
+                .setDepfileOption("-MMD -MF")
+                .setPchOption("-include")
+                .setModuleMapperOption("-fmodules-ts -fmodule-mapper=")
                 .setPreprocesses({
                     data::TaskProcess(data::TaskProcess::Type::BuildIn, "checkUpdate")
                     })
+                .setPostprocesses({
+                    data::TaskProcess(data::TaskProcess::Type::BuildIn, "readDepfile")
+                    })
             )
             .setlinkObjs(data::Task("ar")
                 .setInputAndOutputOption("", "-o")
@@ -359,9 +885,15 @@ data::Compiler createGccCppCompiler()
             .setCompileObj(data::Task("g++")
                 .setInputAndOutputOption("", "-o")
                 .setOptionPrefix("-c -fPIC")
+                .setDepfileOption("-MMD -MF")
+                .setPchOption("-include")
+                .setModuleMapperOption("-fmodules-ts -fmodule-mapper=")
                 .setPreprocesses({
                     data::TaskProcess(data::TaskProcess::Type::BuildIn, "checkUpdate")
                     })
+                .setPostprocesses({
+                    data::TaskProcess(data::TaskProcess::Type::BuildIn, "readDepfile")
+                    })
             )
             .setlinkObjs(data::Task("g++")
                 .setInputAndOutputOption("", "-o")
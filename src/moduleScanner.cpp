@@ -0,0 +1,433 @@
+#include "moduleScanner.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+// the json parser of property_tree includes the old boost/bind.hpp.
+#define BOOST_BIND_GLOBAL_PLACEHOLDERS
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "data.h"
+#include "fileView.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sHeader = "# watagashi modules v1";
+
+char const* const ModuleScanner::sFilename = ".watagashi_modules";
+char const* const ModuleScanner::sDirectoryName = ".watagashi_bmi";
+
+static bool isIdentifierChar(char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || '_' == c;
+}
+
+static bool isSpace(char c)
+{
+    return ' ' == c || '\t' == c || '\r' == c || '\f' == c || '\v' == c || '\n' == c;
+}
+
+// R"delim(...)delim" and its prefixes u8R, uR, UR and LR.
+static bool isRawStringPrefix(char const* pBegin, char const* p)
+{
+    if (p == pBegin || 'R' != p[-1]) {
+        return false;
+    }
+    auto pPrefix = p - 1;
+    if (pBegin < pPrefix && ('u' == pPrefix[-1] || 'U' == pPrefix[-1] || 'L' == pPrefix[-1])) {
+        --pPrefix;
+    } else if (pBegin + 1 < pPrefix && 'u' == pPrefix[-2] && '8' == pPrefix[-1]) {
+        pPrefix -= 2;
+    }
+    return pPrefix == pBegin || !isIdentifierChar(pPrefix[-1]);
+}
+
+// Replace the comments and the literals by a space and drop the preprocessor directives,
+// so that only the declarations are left. the newlines are kept.
+static std::string stripSource(char const* pBegin, char const* pEnd)
+{
+    std::string out;
+    out.reserve(pEnd - pBegin);
+    bool isLineStart = true;
+    bool isDirective = false;
+    for (auto p = pBegin; p < pEnd; ) {
+        auto c = *p;
+        if ('\\' == c && p + 1 < pEnd && '\n' == p[1]) {
+            p += 2;
+            continue;
+        }
+        if ('\n' == c) {
+            out += '\n';
+            isLineStart = true;
+            isDirective = false;
+            ++p;
+            continue;
+        }
+        if ('/' == c && p + 1 < pEnd && '/' == p[1]) {
+            while (p < pEnd && '\n' != *p) {
+                ++p;
+            }
+            continue;
+        }
+        if ('/' == c && p + 1 < pEnd && '*' == p[1]) {
+            for (p += 2; p < pEnd && !('*' == p[0] && p + 1 < pEnd && '/' == p[1]); ++p) {
+                if ('\n' == *p) {
+                    out += '\n';
+                }
+            }
+            p = std::min(p + 2, pEnd);
+            out += ' ';
+            continue;
+        }
+        if ('#' == c && isLineStart) {
+            isDirective = true;
+        }
+        if ('"' == c && isRawStringPrefix(pBegin, p)) {
+            auto pOpen = static_cast<char const*>(std::memchr(p, '(', pEnd - p));
+            if (!pOpen) {
+                break;
+            }
+            auto terminator = ")" + std::string(p + 1, pOpen) + "\"";
+            auto pClose = std::search(pOpen, pEnd, terminator.begin(), terminator.end());
+            for (auto q = p; q < pClose; ++q) {
+                if ('\n' == *q) {
+                    out += '\n';
+                }
+            }
+            p = std::min(pClose + terminator.size(), pEnd);
+            out += ' ';
+            isLineStart = false;
+            continue;
+        }
+        // an apostrophe after a digit is a digit separator like 1'000.
+        if ('"' == c || ('\'' == c && !(pBegin < p && isIdentifierChar(p[-1])))) {
+            for (++p; p < pEnd && c != *p && '\n' != *p; ++p) {
+                if ('\\' == *p) {
+                    ++p;
+                }
+            }
+            p = std::min(p + 1, pEnd);
+            out += ' ';
+            isLineStart = false;
+            continue;
+        }
+        if (!isDirective) {
+            out += c;
+        }
+        if (!isSpace(c)) {
+            isLineStart = false;
+        }
+        ++p;
+    }
+    return out;
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class ModuleDeclarationParser
+//
+//--------------------------------------------------------------------------------------
+
+// Reads the tokens of a declaration which starts a line.
+class ModuleDeclarationParser
+{
+public:
+    ModuleDeclarationParser(std::string const& text, size_t pos)
+        : mText(text)
+        , mPos(pos)
+    {}
+
+    std::string identifier()
+    {
+        this->skipSpace_();
+        auto begin = this->mPos;
+        while (this->mPos < this->mText.size() && isIdentifierChar(this->mText[this->mPos])) {
+            ++this->mPos;
+        }
+        return this->mText.substr(begin, this->mPos - begin);
+    }
+
+    // "name" or "name.name". empty when it isn't a name.
+    std::string moduleName()
+    {
+        auto name = this->identifier();
+        while (!name.empty() && this->consume('.')) {
+            auto part = this->identifier();
+            if (part.empty()) {
+                return "";
+            }
+            name += "." + part;
+        }
+        return name;
+    }
+
+    bool consume(char c)
+    {
+        this->skipSpace_();
+        if (this->mPos < this->mText.size() && c == this->mText[this->mPos]) {
+            ++this->mPos;
+            return true;
+        }
+        return false;
+    }
+
+    bool peek(char c)
+    {
+        this->skipSpace_();
+        return this->mPos < this->mText.size() && c == this->mText[this->mPos];
+    }
+
+    // the attributes may follow the name.
+    bool isEnd()
+    {
+        return this->peek(';') || this->peek('[');
+    }
+
+private:
+    void skipSpace_()
+    {
+        while (this->mPos < this->mText.size() && isSpace(this->mText[this->mPos])) {
+            ++this->mPos;
+        }
+    }
+
+private:
+    std::string const& mText;
+    size_t mPos;
+};
+
+//--------------------------------------------------------------------------------------
+//
+//  class ModuleScanner
+//
+//--------------------------------------------------------------------------------------
+
+ModuleScanner::ModuleScanner(data::Project const& project, data::Task const& task, bool useScanDeps)
+    : mProject(project)
+    , mTask(task)
+    , mUseScanDeps(useScanDeps)
+    , mFilepath(project.makeIntermediatePath() / sFilename)
+    , mIsDirty(false)
+{}
+
+bool ModuleScanner::load()
+{
+    this->mEntries.clear();
+    this->mIsDirty = false;
+
+    std::ifstream in(this->mFilepath.string());
+    std::string line;
+    // clang-scan-deps sees the preprocessor, so the results of another scanner differ.
+    auto header = std::string(sHeader) + (this->mUseScanDeps ? " scan-deps" : " lexical");
+    if (!std::getline(in, line) || header != line) {
+        this->mIsDirty = true;
+        return false;
+    }
+    // <mtime>\t<size>\t<inode>\t<filepath>\t<provide>[\t<import>]...
+    while (std::getline(in, line)) {
+        auto fields = split(line, '\t');
+        if (fields.size() < 4) {
+            continue;
+        }
+        Entry entry;
+        entry.stat.mtime = std::strtoll(fields[0].c_str(), nullptr, 10);
+        entry.stat.size = std::strtoull(fields[1].c_str(), nullptr, 10);
+        entry.stat.inode = std::strtoull(fields[2].c_str(), nullptr, 10);
+        if (5 <= fields.size()) {
+            entry.unit.provide = fields[4];
+            entry.unit.imports.assign(fields.begin() + 5, fields.end());
+        }
+        this->mEntries[fields[3]] = std::move(entry);
+    }
+    return true;
+}
+
+bool ModuleScanner::save()const
+{
+    if (!this->mIsDirty) {
+        return true;
+    }
+    createDirectory(this->mFilepath.parent_path());
+    std::ofstream out(this->mFilepath.string(), std::ios::trunc);
+    out << sHeader << (this->mUseScanDeps ? " scan-deps" : " lexical") << "\n";
+    for (auto& [key, entry] : this->mEntries) {
+        out << entry.stat.mtime << "\t" << entry.stat.size << "\t" << entry.stat.inode << "\t" << key;
+        if (!entry.unit.empty()) {
+            out << "\t" << entry.unit.provide;
+            for (auto& name : entry.unit.imports) {
+                out << "\t" << name;
+            }
+        }
+        out << "\n";
+    }
+    if (!out) {
+        cerr << "warning: failed to write the module cache. path=" << this->mFilepath << endl;
+        return false;
+    }
+    return true;
+}
+
+bool ModuleScanner::scan(boost::filesystem::path const& inputFilepath, data::FileFilter const* pFileFilter, Unit* pOut)
+{
+    *pOut = Unit();
+    auto key = fs::absolute(inputFilepath).lexically_normal().generic_string();
+    FileStat stat;
+    if (!statFile(inputFilepath, &stat)) {
+        return false;
+    }
+    auto it = this->mEntries.find(key);
+    if (this->mEntries.end() != it && stat == it->second.stat) {
+        *pOut = it->second.unit;
+        return true;
+    }
+
+    FileView view;
+    if (!view.open(inputFilepath)) {
+        return false;
+    }
+    // most sources use no module, so they skip clang-scan-deps.
+    std::string_view text(view.data(), view.size());
+    if (std::string_view::npos != text.find("module") || std::string_view::npos != text.find("import")) {
+        if (!this->mUseScanDeps || !this->scanDeps_(inputFilepath, pFileFilter, pOut)) {
+            sScan(view.data(), view.data() + view.size(), pOut);
+        }
+    }
+    view.close();
+
+    auto& entry = this->mEntries[key];
+    entry.stat = stat;
+    entry.unit = *pOut;
+    this->mIsDirty = true;
+    return true;
+}
+
+boost::filesystem::path ModuleScanner::makeModuleFilepath(std::string const& name)const
+{
+    // ':' of a partition isn't allowed in the file names of some platforms.
+    auto filename = name;
+    std::replace(filename.begin(), filename.end(), ':', '-');
+    return this->mProject.makeIntermediatePath() / sDirectoryName / (filename + ".bmi");
+}
+
+void ModuleScanner::sScan(char const* pBegin, char const* pEnd, Unit* pOut)
+{
+    *pOut = Unit();
+    auto text = stripSource(pBegin, pEnd);
+    // the name of the module which the unit belongs to, for "import :partition;".
+    std::string moduleName;
+    for (size_t pos = 0; pos < text.size(); ) {
+        auto lineEnd = text.find('\n', pos);
+        if (std::string::npos == lineEnd) {
+            lineEnd = text.size();
+        }
+        auto lineBegin = text.find_first_not_of(" \t\r\f\v", pos);
+        pos = lineEnd + 1;
+        if (lineEnd <= lineBegin) {
+            continue;
+        }
+        ModuleDeclarationParser parser(text, lineBegin);
+
+        auto keyword = parser.identifier();
+        bool isExport = "export" == keyword;
+        if (isExport) {
+            keyword = parser.identifier();
+        }
+
+        if ("module" == keyword) {
+            // "module;" starts the global module fragment and "module :private;" the private one.
+            if (parser.peek(';') || parser.peek(':')) {
+                continue;
+            }
+            auto name = parser.moduleName();
+            if (name.empty()) {
+                continue;
+            }
+            std::string partition;
+            if (parser.consume(':')) {
+                partition = parser.moduleName();
+                if (partition.empty()) {
+                    continue;
+                }
+            }
+            if (!parser.isEnd()) {
+                continue;
+            }
+            moduleName = name;
+            if (isExport || !partition.empty()) {
+                pOut->provide = partition.empty() ? name : name + ":" + partition;
+            } else {
+                // an implementation unit imports its interface implicitly.
+                pOut->imports.push_back(name);
+            }
+        } else if ("import" == keyword) {
+            // the header units like "import <vector>;" aren't supported.
+            if (parser.consume(':')) {
+                auto partition = parser.moduleName();
+                if (!partition.empty() && !moduleName.empty() && parser.isEnd()) {
+                    pOut->imports.push_back(moduleName + ":" + partition);
+                }
+                continue;
+            }
+            auto name = parser.moduleName();
+            if (!name.empty() && parser.isEnd()) {
+                pOut->imports.push_back(name);
+            }
+        }
+    }
+}
+
+bool ModuleScanner::scanDeps_(boost::filesystem::path const& inputFilepath, data::FileFilter const* pFileFilter, Unit* pOut)const
+{
+    auto directory = this->mProject.makeIntermediatePath() / sDirectoryName;
+    if (!createDirectory(directory)) {
+        return false;
+    }
+    auto task = this->mTask;
+    task.depfileOption.clear();
+    auto outputFilepath = directory / (toHexString(hashString(inputFilepath.generic_string())) + ".p1689.json");
+    auto command = "clang-scan-deps -format=p1689 -- "
+        + data::makeCompileCommand(task, inputFilepath, "watagashi-module-scan.o", this->mProject, pFileFilter)
+        + " > " + outputFilepath.string();
+    Finally removeOutput([&]() {
+        boost::system::error_code ec;
+        fs::remove(outputFilepath, ec);
+    });
+    if (!runCommand(command)) {
+        cerr << "warning: clang-scan-deps failed. scan the source lexically. path=" << inputFilepath << endl;
+        return false;
+    }
+
+    // {"rules": [{"primary-output": ..., "provides": [{"logical-name": ...}], "requires": [{"logical-name": ...}]}]}
+    namespace pt = boost::property_tree;
+    pt::ptree tree;
+    try {
+        pt::read_json(outputFilepath.string(), tree);
+    } catch (pt::json_parser_error& e) {
+        cerr << "warning: failed to read the result of clang-scan-deps. " << e.what() << endl;
+        return false;
+    }
+    *pOut = Unit();
+    for (auto& rule : tree.get_child("rules", pt::ptree())) {
+        for (auto& provide : rule.second.get_child("provides", pt::ptree())) {
+            pOut->provide = provide.second.get<std::string>("logical-name", "");
+        }
+        for (auto& require : rule.second.get_child("requires", pt::ptree())) {
+            auto name = require.second.get<std::string>("logical-name", "");
+            if (!name.empty()) {
+                pOut->imports.push_back(name);
+            }
+        }
+    }
+    return true;
+}
+
+}
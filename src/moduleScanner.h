@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+
+#include "utility.h"
+
+namespace watagashi
+{
+
+namespace data
+{
+struct Task;
+struct Project;
+struct FileFilter;
+}
+
+// Finds the C++20 named modules which each source provides and imports, like the P1689 format,
+// so that the sources which import a module are compiled after the one which exports it.
+// clang-scan-deps answers it when useScanDeps is true, since it runs the preprocessor.
+// Otherwise the source is scanned lexically, which doesn't see the declarations made by macros or in #if.
+// The results are kept in the intermediate directory, and a source is scanned again when its metadata changes.
+class ModuleScanner
+{
+    ModuleScanner(ModuleScanner const&) = delete;
+    ModuleScanner& operator=(ModuleScanner const&) = delete;
+
+public:
+    // the file name in the intermediate directory.
+    static char const* const sFilename;
+    // the directory of the BMIs in the intermediate directory.
+    static char const* const sDirectoryName;
+
+    struct Unit
+    {
+        // the module which the source exports or the partition like "name:partition". empty provides nothing.
+        std::string provide;
+        // the modules which the source imports directly. an implementation unit imports its own module.
+        std::vector<std::string> imports;
+
+        bool empty()const { return this->provide.empty() && this->imports.empty(); }
+    };
+
+public:
+    ModuleScanner(data::Project const& project, data::Task const& task, bool useScanDeps);
+
+    // A missing or unknown file is an empty cache.
+    bool load();
+    // Write the results when they were changed.
+    bool save()const;
+
+    // Return false when the source can't be scanned. the unit is empty then.
+    bool scan(boost::filesystem::path const& inputFilepath, data::FileFilter const* pFileFilter, Unit* pOut);
+    // Return the BMI which the compile of the module writes.
+    boost::filesystem::path makeModuleFilepath(std::string const& name)const;
+
+    static void sScan(char const* pBegin, char const* pEnd, Unit* pOut);
+
+private:
+    struct Entry
+    {
+        FileStat stat;
+        Unit unit;
+    };
+
+    bool scanDeps_(boost::filesystem::path const& inputFilepath, data::FileFilter const* pFileFilter, Unit* pOut)const;
+
+private:
+    data::Project const& mProject;
+    data::Task const& mTask;
+    bool mUseScanDeps;
+    boost::filesystem::path mFilepath;
+    std::unordered_map<std::string, Entry> mEntries;
+    bool mIsDirty;
+};
+
+}
@@ -0,0 +1,603 @@
+#include "objectCache.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include "utility.h"
+#include "includeClosureMemo.h"
+#include "dependencyStore.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sManifestHeader = "# watagashi object manifest v1";
+static char const* const sStatsHeader = "# watagashi object cache stats v1";
+
+// a manifest keeps the objects of this many dependency states. (headers switched back and forth)
+static size_t const sMaxManifestEntryCount = 16;
+// the eviction removes files until the cache is this ratio of the limit, so it doesn't run every build.
+static double const sEvictionRatio = 0.9;
+
+static int currentProcessId()
+{
+#ifdef _WIN32
+    return ::_getpid();
+#else
+    return static_cast<int>(::getpid());
+#endif
+}
+
+// Make the file at "to" with the content of "from" by the cheapest way the file system allows.
+// A hard link shares the last write time too, so it is made only when canHardLink is true.
+static bool materializeFile(fs::path const& from, fs::path const& to, bool canHardLink, bool* pOutIsHardLink = nullptr)
+{
+    if (pOutIsHardLink) {
+        *pOutIsHardLink = false;
+    }
+    boost::system::error_code ec;
+    fs::remove(to, ec);
+
+#if defined(__linux__) && defined(FICLONE)
+    // a reflink shares the blocks but not the inode, so writing one never changes the other.
+    auto fromFd = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (0 <= fromFd) {
+        auto toFd = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        bool isCloned = false;
+        if (0 <= toFd) {
+            isCloned = 0 == ::ioctl(toFd, FICLONE, fromFd);
+            ::close(toFd);
+            if (!isCloned) {
+                fs::remove(to, ec);
+            }
+        }
+        ::close(fromFd);
+        if (isCloned) {
+            return true;
+        }
+    }
+#endif
+
+    // the cached files are read-only, so a tool which writes a hard link in place fails instead of breaking the cache.
+    if (canHardLink) {
+        fs::create_hard_link(from, to, ec);
+        if (!ec) {
+            if (pOutIsHardLink) {
+                *pOutIsHardLink = true;
+            }
+            return true;
+        }
+    }
+    fs::copy_file(from, to, ec);
+    return !ec;
+}
+
+static void touchFile(fs::path const& filepath)
+{
+    boost::system::error_code ec;
+    fs::last_write_time(filepath, std::time(nullptr), ec);
+}
+
+// Escape the path for the make syntax which DependencyStore::sParseDepfile() reads.
+static std::string escapeDepfilePath(std::string const& path)
+{
+    std::string result;
+    result.reserve(path.size());
+    for (auto c : path) {
+        if (' ' == c || '#' == c || '\\' == c) {
+            result += '\\';
+        } else if ('$' == c) {
+            result += '$';
+        }
+        result += c;
+    }
+    return result;
+}
+
+namespace
+{
+
+// Lock the file among the processes while it is alive.
+class FileLock
+{
+public:
+    explicit FileLock(fs::path const& filepath)
+#ifndef _WIN32
+        : mFd(::open(filepath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644))
+#endif
+    {
+#ifndef _WIN32
+        if (0 <= this->mFd) {
+            ::flock(this->mFd, LOCK_EX);
+        }
+#else
+        (void)filepath;
+#endif
+    }
+
+    ~FileLock()
+    {
+#ifndef _WIN32
+        if (0 <= this->mFd) {
+            ::flock(this->mFd, LOCK_UN);
+            ::close(this->mFd);
+        }
+#endif
+    }
+
+private:
+#ifndef _WIN32
+    int mFd;
+#endif
+};
+
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class ObjectCache
+//
+//--------------------------------------------------------------------------------------
+
+ObjectCache::ObjectCache(boost::filesystem::path const& directory, uint64_t maxSize)
+    : mDirectory(directory)
+    , mMaxSize(maxSize)
+    , mIsOpen(false)
+    , mHitCount(0)
+    , mMissCount(0)
+    , mStoreCount(0)
+    , mEvictCount(0)
+    , mStoredSize(0)
+    , mTemporaryIndex(0)
+{}
+
+ObjectCache::~ObjectCache()
+{
+    this->close();
+}
+
+bool ObjectCache::open()
+{
+    for (auto name : { "objects", "manifests", "tmp" }) {
+        boost::system::error_code ec;
+        fs::create_directories(this->mDirectory / name, ec);
+        if (ec) {
+            cerr << "warning: failed to create the object cache. path=" << (this->mDirectory / name) << " " << ec.message() << endl;
+            return false;
+        }
+    }
+    this->mIsOpen = true;
+    return true;
+}
+
+void ObjectCache::close()
+{
+    if (!this->mIsOpen) {
+        return;
+    }
+    this->mIsOpen = false;
+
+    FileLock lock(this->mDirectory / "lock");
+    Stats total;
+    this->loadStats_(&total);
+    total.hitCount += this->mHitCount;
+    total.missCount += this->mMissCount;
+    total.storeCount += this->mStoreCount;
+    total.size += this->mStoredSize;
+    // another build may have evicted the files, so the size is recounted by the eviction.
+    if (this->mMaxSize < total.size) {
+        this->evict_(&total);
+    }
+    this->saveStats_(total);
+}
+
+bool ObjectCache::fetch(
+    uint64_t manifestKey,
+    boost::filesystem::path const& outputFilepath,
+    boost::filesystem::path const& depfilePath,
+    IncludeClosureMemo* pMemo,
+    bool isRetry)
+{
+    std::vector<ManifestEntry> entries;
+    uint64_t objectKey = 0;
+    ManifestEntry const* pEntry = nullptr;
+    if (this->loadManifest_(manifestKey, &entries)) {
+        pEntry = sFindMatchedEntry(manifestKey, entries, pMemo, &objectKey);
+    }
+    // the object may be evicted while the manifest is left.
+    auto objectPath = this->objectPath(objectKey);
+    if (!pEntry || !fs::exists(objectPath)) {
+        if (!isRetry) {
+            ++this->mMissCount;
+        }
+        return false;
+    }
+
+    // the output shares the last write time with a hard link, so link only an object which is newer than
+    // the dependencies. the others are copied, or the output would look outdated.
+    FileStat objectStat;
+    bool canHardLink = statFile(objectPath, &objectStat);
+    for (auto& dependency : pEntry->dependencies) {
+        FileStat dependencyStat;
+        if (!canHardLink) {
+            break;
+        }
+        canHardLink = (pMemo ? pMemo->stat(dependency.second, &dependencyStat) : statFile(dependency.second, &dependencyStat))
+            && dependencyStat.mtime <= objectStat.mtime;
+    }
+    bool isHardLink = false;
+    if (!materializeFile(objectPath, outputFilepath, canHardLink, &isHardLink)) {
+        if (!isRetry) {
+            ++this->mMissCount;
+        }
+        return false;
+    }
+    // touching an object which outputs share would change their last write times too.
+    // the eviction keeps such objects instead.
+    boost::system::error_code ec;
+    if (!isHardLink && 1 == fs::hard_link_count(objectPath, ec)) {
+        touchFile(objectPath);
+    }
+    touchFile(this->manifestPath(manifestKey));
+    if (!depfilePath.empty()) {
+        std::ofstream out(depfilePath.string(), std::ios::trunc);
+        out << escapeDepfilePath(outputFilepath.string()) << ":";
+        for (auto& dependency : pEntry->dependencies) {
+            out << " \\\n " << escapeDepfilePath(dependency.second);
+        }
+        out << "\n";
+    }
+    ++this->mHitCount;
+    if (isRetry) {
+        --this->mMissCount;
+    }
+    return true;
+}
+
+bool ObjectCache::store(
+    uint64_t manifestKey,
+    boost::filesystem::path const& outputFilepath,
+    boost::filesystem::path const& depfilePath,
+    IncludeClosureMemo* pMemo,
+    uint64_t* pOutObjectKey)
+{
+    // the depfile is the only complete list of the files which the object depends on.
+    std::vector<std::string> dependencies;
+    if (depfilePath.empty() || !DependencyStore::sParseDepfile(depfilePath, &dependencies)) {
+        return false;
+    }
+
+    ManifestEntry newEntry;
+    for (auto& dependency : dependencies) {
+        uint64_t hash = 0;
+        if (!(pMemo ? pMemo->contentHash(dependency, &hash) : hashFile(dependency, &hash))) {
+            return false;
+        }
+        newEntry.dependencies.push_back({ hash, dependency });
+    }
+    auto objectKey = sMakeObjectKey(manifestKey, newEntry);
+
+    if (!fs::exists(this->objectPath(objectKey))) {
+        auto temporaryPath = this->makeTemporaryPath();
+        if (!materializeFile(outputFilepath, temporaryPath, true) || !this->addObject_(objectKey, temporaryPath)) {
+            boost::system::error_code ec;
+            fs::remove(temporaryPath, ec);
+            return false;
+        }
+    }
+    if (!this->addManifestEntry_(manifestKey, std::move(newEntry))) {
+        return false;
+    }
+    ++this->mStoreCount;
+    if (pOutObjectKey) {
+        *pOutObjectKey = objectKey;
+    }
+    return true;
+}
+
+bool ObjectCache::import(
+    uint64_t manifestKey,
+    ManifestEntry const& entry,
+    uint64_t objectKey,
+    boost::filesystem::path const& temporaryFilepath)
+{
+    if (!this->addObject_(objectKey, temporaryFilepath)) {
+        boost::system::error_code ec;
+        fs::remove(temporaryFilepath, ec);
+        return false;
+    }
+    return this->addManifestEntry_(manifestKey, entry);
+}
+
+ObjectCache::Stats ObjectCache::stats()const
+{
+    Stats result;
+    result.hitCount = this->mHitCount;
+    result.missCount = this->mMissCount;
+    result.storeCount = this->mStoreCount;
+    result.evictCount = this->mEvictCount;
+    result.size = this->mStoredSize;
+    return result;
+}
+
+ObjectCache::Stats ObjectCache::totalStats()const
+{
+    Stats result;
+    this->loadStats_(&result);
+    return result;
+}
+
+uint64_t ObjectCache::sMakeObjectKey(uint64_t manifestKey, ManifestEntry const& entry)
+{
+    auto key = hashString(toHexString(manifestKey));
+    for (auto& [hash, path] : entry.dependencies) {
+        key = hashString(toHexString(hash) + path + "\n", key);
+    }
+    return key;
+}
+
+bool ObjectCache::sParseManifest(std::istream& in, std::vector<ManifestEntry>* pOut)
+{
+    // e\t<dependency count>
+    // <content hash>\t<path>
+    pOut->clear();
+    std::string line;
+    if (!std::getline(in, line) || sManifestHeader != line) {
+        return false;
+    }
+    while (std::getline(in, line)) {
+        if (line.size() < 3 || 0 != line.compare(0, 2, "e\t")) {
+            return false;
+        }
+        auto count = std::strtoull(line.c_str() + 2, nullptr, 10);
+        ManifestEntry entry;
+        for (unsigned long long i = 0; i < count; ++i) {
+            if (!std::getline(in, line)) {
+                return false;
+            }
+            auto tab = line.find('\t');
+            if (std::string::npos == tab) {
+                return false;
+            }
+            entry.dependencies.push_back({ std::strtoull(line.c_str(), nullptr, 16), line.substr(tab + 1) });
+        }
+        pOut->push_back(std::move(entry));
+    }
+    return true;
+}
+
+void ObjectCache::sWriteManifest(std::ostream& out, std::vector<ManifestEntry> const& entries)
+{
+    out << sManifestHeader << "\n";
+    for (auto& entry : entries) {
+        out << "e\t" << entry.dependencies.size() << "\n";
+        for (auto& [hash, path] : entry.dependencies) {
+            out << toHexString(hash) << "\t" << path << "\n";
+        }
+    }
+}
+
+void ObjectCache::sAddManifestEntry(std::vector<ManifestEntry>* pEntries, ManifestEntry entry)
+{
+    pEntries->erase(std::remove_if(pEntries->begin(), pEntries->end(), [&](ManifestEntry const& e) {
+        return e.dependencies == entry.dependencies;
+    }), pEntries->end());
+    pEntries->insert(pEntries->begin(), std::move(entry));
+    if (sMaxManifestEntryCount < pEntries->size()) {
+        pEntries->resize(sMaxManifestEntryCount);
+    }
+}
+
+ObjectCache::ManifestEntry const* ObjectCache::sFindMatchedEntry(
+    uint64_t manifestKey,
+    std::vector<ManifestEntry> const& entries,
+    IncludeClosureMemo* pMemo,
+    uint64_t* pOutObjectKey)
+{
+    for (auto& entry : entries) {
+        bool isMatch = true;
+        for (auto& [hash, path] : entry.dependencies) {
+            uint64_t currentHash = 0;
+            if (!(pMemo ? pMemo->contentHash(path, &currentHash) : hashFile(path, &currentHash)) || hash != currentHash) {
+                isMatch = false;
+                break;
+            }
+        }
+        if (isMatch) {
+            *pOutObjectKey = sMakeObjectKey(manifestKey, entry);
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+boost::filesystem::path ObjectCache::manifestPath(uint64_t manifestKey)const
+{
+    auto name = toHexString(manifestKey);
+    return this->mDirectory / "manifests" / name.substr(0, 2) / (name + ".manifest");
+}
+
+boost::filesystem::path ObjectCache::objectPath(uint64_t objectKey)const
+{
+    auto name = toHexString(objectKey);
+    return this->mDirectory / "objects" / name.substr(0, 2) / (name + ".o");
+}
+
+boost::filesystem::path ObjectCache::makeTemporaryPath()const
+{
+    auto index = this->mTemporaryIndex++;
+    return this->mDirectory / "tmp" / (std::to_string(currentProcessId()) + "." + std::to_string(index) + ".tmp");
+}
+
+bool ObjectCache::addObject_(uint64_t objectKey, boost::filesystem::path const& temporaryFilepath)
+{
+    boost::system::error_code ec;
+    auto objectPath = this->objectPath(objectKey);
+    fs::create_directories(objectPath.parent_path(), ec);
+    fs::permissions(temporaryFilepath, fs::owner_read | fs::group_read | fs::others_read, ec);
+    // another build may have added the same object.
+    auto prevSize = fs::exists(objectPath, ec) ? fs::file_size(objectPath, ec) : 0;
+    if (ec) {
+        prevSize = 0;
+    }
+    fs::rename(temporaryFilepath, objectPath, ec);
+    if (ec) {
+        return false;
+    }
+    this->mStoredSize += fs::file_size(objectPath, ec);
+    this->mStoredSize -= prevSize;
+    return true;
+}
+
+bool ObjectCache::addManifestEntry_(uint64_t manifestKey, ManifestEntry entry)
+{
+    // the concurrent builds would drop the entries of each other without the lock.
+    FileLock lock(this->mDirectory / "manifest.lock");
+    std::vector<ManifestEntry> entries;
+    this->loadManifest_(manifestKey, &entries);
+    sAddManifestEntry(&entries, std::move(entry));
+    return this->saveManifest_(manifestKey, entries);
+}
+
+bool ObjectCache::loadManifest_(uint64_t manifestKey, std::vector<ManifestEntry>* pOut)const
+{
+    pOut->clear();
+    std::ifstream in(this->manifestPath(manifestKey).string());
+    return in && sParseManifest(in, pOut);
+}
+
+bool ObjectCache::saveManifest_(uint64_t manifestKey, std::vector<ManifestEntry> const& entries)
+{
+    auto manifestPath = this->manifestPath(manifestKey);
+    boost::system::error_code ec;
+    fs::create_directories(manifestPath.parent_path(), ec);
+
+    // replace the manifest at once, so that another build never reads a half written one.
+    auto temporaryPath = this->makeTemporaryPath();
+    {
+        std::ofstream out(temporaryPath.string(), std::ios::trunc);
+        sWriteManifest(out, entries);
+        if (!out) {
+            fs::remove(temporaryPath, ec);
+            return false;
+        }
+    }
+    auto size = fs::file_size(temporaryPath, ec);
+    auto prevSize = fs::exists(manifestPath, ec) ? fs::file_size(manifestPath, ec) : 0;
+    if (ec) {
+        prevSize = 0;
+    }
+    fs::rename(temporaryPath, manifestPath, ec);
+    if (ec) {
+        fs::remove(temporaryPath, ec);
+        return false;
+    }
+    // the manifest replaced the previous one.
+    this->mStoredSize += size;
+    this->mStoredSize -= prevSize;
+    return true;
+}
+
+bool ObjectCache::loadStats_(Stats* pOut)const
+{
+    *pOut = Stats();
+    std::ifstream in((this->mDirectory / "stats").string());
+    std::string line;
+    if (!std::getline(in, line) || sStatsHeader != line) {
+        return false;
+    }
+    std::string name;
+    uint64_t value = 0;
+    while (in >> name >> value) {
+        if ("hit" == name) { pOut->hitCount = static_cast<size_t>(value); }
+        else if ("miss" == name) { pOut->missCount = static_cast<size_t>(value); }
+        else if ("store" == name) { pOut->storeCount = static_cast<size_t>(value); }
+        else if ("evict" == name) { pOut->evictCount = static_cast<size_t>(value); }
+        else if ("size" == name) { pOut->size = value; }
+    }
+    return true;
+}
+
+bool ObjectCache::saveStats_(Stats const& stats)const
+{
+    auto statsPath = this->mDirectory / "stats";
+    auto temporaryPath = this->makeTemporaryPath();
+    {
+        std::ofstream out(temporaryPath.string(), std::ios::trunc);
+        out << sStatsHeader << "\n"
+            << "hit " << stats.hitCount << "\n"
+            << "miss " << stats.missCount << "\n"
+            << "store " << stats.storeCount << "\n"
+            << "evict " << stats.evictCount << "\n"
+            << "size " << stats.size << "\n";
+        if (!out) {
+            return false;
+        }
+    }
+    boost::system::error_code ec;
+    fs::rename(temporaryPath, statsPath, ec);
+    return !ec;
+}
+
+void ObjectCache::evict_(Stats* pStats)
+{
+    struct File
+    {
+        std::time_t mtime;
+        uint64_t size;
+        fs::path path;
+    };
+
+    // the temporary files of crashed builds are evicted like the others.
+    std::vector<File> files;
+    uint64_t totalSize = 0;
+    boost::system::error_code ec;
+    for (auto name : { "objects", "manifests", "tmp" }) {
+        for (fs::recursive_directory_iterator it(this->mDirectory / name, ec), end; !ec && it != end; it.increment(ec)) {
+            if (!fs::is_regular_file(it->path(), ec)) {
+                continue;
+            }
+            File file{ fs::last_write_time(it->path(), ec), fs::file_size(it->path(), ec), it->path() };
+            // an object which outputs share by hard links is in use, and removing it frees nothing.
+            if (1 < fs::hard_link_count(it->path(), ec)) {
+                file.mtime = std::numeric_limits<std::time_t>::max();
+            }
+            totalSize += file.size;
+            files.push_back(std::move(file));
+        }
+    }
+
+    std::sort(files.begin(), files.end(), [](File const& left, File const& right) {
+        return left.mtime < right.mtime;
+    });
+    auto targetSize = static_cast<uint64_t>(static_cast<double>(this->mMaxSize) * sEvictionRatio);
+    for (auto& file : files) {
+        if (totalSize <= targetSize) {
+            break;
+        }
+        if (fs::remove(file.path, ec)) {
+            totalSize -= file.size;
+            ++this->mEvictCount;
+            ++pStats->evictCount;
+        }
+    }
+    pStats->size = totalSize;
+}
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <string>
+#include <iosfwd>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <boost/filesystem.hpp>
+
+namespace watagashi
+{
+
+class IncludeClosureMemo;
+
+// Keeps compiled objects in a directory shared by builds, like ccache, so that the same compile
+// after "clean" or a branch switch copies the object instead of running the compiler.
+//
+// An object is found in two steps. The manifest key is the hash of the compile command,
+// which includes the identity of the compiler, and the content of the source.
+// The manifest of the key lists the dependencies which the depfile had with their content hashes,
+// and the object whose dependencies still have the same content is used.
+//
+// A file is written to a temporary name and renamed, so concurrent builds may share the directory.
+// The last write time of a file is its last use, and the least recently used files are removed
+// when the cache exceeds the size limit.
+class ObjectCache
+{
+    ObjectCache(ObjectCache const&) = delete;
+    ObjectCache& operator=(ObjectCache const&) = delete;
+
+public:
+    struct ManifestEntry
+    {
+        // pairs of the content hash and the path.
+        std::vector<std::pair<uint64_t, std::string>> dependencies;
+        // the SHA-256 of the object. only RemoteCache uses it.
+        std::string objectDigest;
+    };
+
+    // The object is keyed by the manifest key and the content hashes of its dependencies.
+    static uint64_t sMakeObjectKey(uint64_t manifestKey, ManifestEntry const& entry);
+    // The manifest is the same text in the directory and in RemoteCache.
+    static bool sParseManifest(std::istream& in, std::vector<ManifestEntry>* pOut);
+    static void sWriteManifest(std::ostream& out, std::vector<ManifestEntry> const& entries);
+    // Put the entry at the front. The manifest keeps only the newest ones.
+    static void sAddManifestEntry(std::vector<ManifestEntry>* pEntries, ManifestEntry entry);
+    // Return the entry whose dependencies still have the same content with the key of its object, or nullptr.
+    static ManifestEntry const* sFindMatchedEntry(
+        uint64_t manifestKey,
+        std::vector<ManifestEntry> const& entries,
+        IncludeClosureMemo* pMemo,
+        uint64_t* pOutObjectKey);
+
+    struct Stats
+    {
+        size_t hitCount = 0;
+        size_t missCount = 0;
+        size_t storeCount = 0;
+        size_t evictCount = 0;
+        // the total size of the files in bytes.
+        uint64_t size = 0;
+    };
+
+public:
+    ObjectCache(boost::filesystem::path const& directory, uint64_t maxSize);
+    ~ObjectCache();
+
+    // Create the directory. Return false when the cache can't be used.
+    bool open();
+    // Add the stats of this build to the directory and remove old files when the cache is over the limit.
+    void close();
+
+    // Copy the object to outputFilepath and write the depfile of it when depfilePath isn't empty.
+    // The memo shares the content hashes among the processes of the build.
+    // A retry after import() doesn't count the miss again, and a hit of it cancels the first miss.
+    bool fetch(
+        uint64_t manifestKey,
+        boost::filesystem::path const& outputFilepath,
+        boost::filesystem::path const& depfilePath,
+        IncludeClosureMemo* pMemo,
+        bool isRetry = false);
+    // Store the compiled object with the dependencies in the depfile.
+    bool store(
+        uint64_t manifestKey,
+        boost::filesystem::path const& outputFilepath,
+        boost::filesystem::path const& depfilePath,
+        IncludeClosureMemo* pMemo,
+        uint64_t* pOutObjectKey = nullptr);
+    // Add the object which was written to the temporary file, and the manifest entry of it.
+    bool import(
+        uint64_t manifestKey,
+        ManifestEntry const& entry,
+        uint64_t objectKey,
+        boost::filesystem::path const& temporaryFilepath);
+
+    boost::filesystem::path manifestPath(uint64_t manifestKey)const;
+    boost::filesystem::path objectPath(uint64_t objectKey)const;
+    // Return a unique path in the directory, which can be renamed to the others atomically.
+    boost::filesystem::path makeTemporaryPath()const;
+
+    // Return the stats of this build. The size is the one of the stored files.
+    Stats stats()const;
+    // Return the stats of all builds which used the directory. It includes this build after close().
+    Stats totalStats()const;
+
+private:
+    // Move the temporary file to the object path as a read-only file.
+    bool addObject_(uint64_t objectKey, boost::filesystem::path const& temporaryFilepath);
+    bool addManifestEntry_(uint64_t manifestKey, ManifestEntry entry);
+    bool loadManifest_(uint64_t manifestKey, std::vector<ManifestEntry>* pOut)const;
+    bool saveManifest_(uint64_t manifestKey, std::vector<ManifestEntry> const& entries);
+    // Return false when the directory has no stats yet.
+    bool loadStats_(Stats* pOut)const;
+    bool saveStats_(Stats const& stats)const;
+    void evict_(Stats* pStats);
+
+private:
+    boost::filesystem::path mDirectory;
+    uint64_t mMaxSize;
+    bool mIsOpen;
+    std::atomic<size_t> mHitCount;
+    std::atomic<size_t> mMissCount;
+    std::atomic<size_t> mStoreCount;
+    std::atomic<size_t> mEvictCount;
+    std::atomic<uint64_t> mStoredSize;
+    mutable std::atomic<uint64_t> mTemporaryIndex;
+};
+
+}
@@ -7,6 +7,7 @@
 #include <boost/utility/string_view.hpp>
 
 #include "../utility.h"
+#include "../fileView.h"
 
 #include "parserUtility.h"
 #include "source.h"
@@ -27,18 +28,19 @@ namespace parser
 
 ParseResult parse(boost::filesystem::path const& filepath, ParserDesc const& desc)
 {
-    auto source = readFile(filepath);
-    for (int i = static_cast<int>(source.size())-1; 0 <= i; --i) {
-        if ('\0' != source[i]) {
-            source.resize(i+1);
-            break;
-        }
+    // parse the file in place. the result copies the strings, so it doesn't refer to the view.
+    // a file which fails to open is parsed as empty like before.
+    watagashi::FileView view;
+    view.open(filepath);
+    auto length = view.size();
+    while (0 < length && '\0' == view.data()[length - 1]) {
+        --length;
     }
     ParserDesc usedDesc = desc;
     if (usedDesc.location.empty()) {
         usedDesc.location = Location(filepath, 0);
     }
-    return parse(source, usedDesc);
+    return parse(view.data(), length, usedDesc);
 }
 
 bool tryParseLine(Enviroment& env, Line line, std::function<bool()> predicate)
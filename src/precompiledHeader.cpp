@@ -0,0 +1,212 @@
+#include "precompiledHeader.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "utility.h"
+#include "data.h"
+#include "dependencyStore.h"
+#include "includeScanner.h"
+#include "fileView.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sHeaderFilename = "pch.hpp";
+// the hash of the sources which the headers were selected from.
+static char const* const sSourcesFilename = "sources";
+
+char const* const PrecompiledHeader::sDirectoryName = ".watagashi_pch";
+
+static bool writeText(fs::path const& filepath, std::string const& content)
+{
+    std::ofstream out(filepath.string(), std::ios::binary | std::ios::trunc);
+    out << content;
+    return static_cast<bool>(out);
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class PrecompiledHeader
+//
+//--------------------------------------------------------------------------------------
+
+PrecompiledHeader::PrecompiledHeader(data::Project const& project, data::Task const& task, double ratio)
+    : mProject(project)
+    , mTask(task)
+    , mRatio(ratio)
+    , mSignature(0)
+{
+    auto command = data::makeCompileCommand(task, "watagashi-pch.hpp", "watagashi-pch.hpp.gch", project, nullptr);
+    auto directory = project.makeIntermediatePath() / sDirectoryName / toHexString(data::makeCommandSignature(command));
+    this->mHeaderFilepath = directory / sHeaderFilename;
+    // gcc and clang find the precompiled one by this name when the header is included.
+    this->mOutputFilepath = directory / (std::string(sHeaderFilename) + ".gch");
+}
+
+bool PrecompiledHeader::prepare(std::vector<boost::filesystem::path> const& inputFilepaths)
+{
+    if (this->mTask.pchOption.empty() || this->mRatio <= 0.0 || inputFilepaths.empty()) {
+        return false;
+    }
+
+    std::vector<std::string> sources;
+    for (auto& inputFilepath : inputFilepaths) {
+        sources.push_back(inputFilepath.generic_string());
+    }
+    std::sort(sources.begin(), sources.end());
+    uint64_t hash = hashString("");
+    for (auto& source : sources) {
+        hash = hashString(source + "\n", hash);
+    }
+    auto sourcesHash = toHexString(hash);
+
+    auto directory = this->mHeaderFilepath.parent_path();
+    auto sourcesFilepath = directory / sSourcesFilename;
+    if (sourcesHash != readFile(sourcesFilepath) || !fs::exists(this->mHeaderFilepath)) {
+        // the headers of other flags are never used again.
+        boost::system::error_code ec;
+        if (fs::exists(directory.parent_path(), ec)) {
+            for (auto& entry : fs::directory_iterator(directory.parent_path())) {
+                if (entry.path() != directory) {
+                    fs::remove_all(entry.path(), ec);
+                }
+            }
+        }
+
+        std::vector<std::string> headers;
+        this->select_(inputFilepaths, &headers);
+        std::string content = "// generated by watagashi. the headers which most targets include.\n";
+        for (auto& header : headers) {
+            content += "#include " + header + "\n";
+        }
+        // the same headers keep the last write time, so that a new source doesn't compile all again.
+        if (!createDirectory(directory)
+            || (content != readFile(this->mHeaderFilepath) && !writeText(this->mHeaderFilepath, content))
+            || !writeText(sourcesFilepath, sourcesHash)) {
+            cerr << "warning: failed to write the precompiled header. path=" << this->mHeaderFilepath << endl;
+            return false;
+        }
+    }
+    return std::string::npos != readFile(this->mHeaderFilepath).find("#include");
+}
+
+bool PrecompiledHeader::build(DependencyStore* pDependencyStore)
+{
+    bool isUpToDate = fs::exists(this->mOutputFilepath)
+        && pDependencyStore
+        && DependencyStore::State::UpToDate == pDependencyStore->check(this->mOutputFilepath);
+    if (!isUpToDate) {
+        boost::system::error_code ec;
+        fs::remove(this->mOutputFilepath, ec);
+        auto command = data::makeCompileCommand(this->mTask, this->mHeaderFilepath, this->mOutputFilepath, this->mProject, nullptr);
+        cout << "running: " << command << endl;
+        if (!runCommand(command)) {
+            // a header may be removed, so they are selected again by the next build.
+            fs::remove(this->mOutputFilepath, ec);
+            fs::remove(this->mHeaderFilepath.parent_path() / sSourcesFilename, ec);
+            return false;
+        }
+        if (pDependencyStore && !this->mTask.depfileOption.empty()) {
+            pDependencyStore->recordDepfile(this->mOutputFilepath, data::makeDepfilePath(this->mOutputFilepath));
+        }
+    }
+
+    FileStat stat;
+    if (!statFile(this->mOutputFilepath, &stat)) {
+        return false;
+    }
+    this->mSignature = hashBytes(&stat.mtime, sizeof(stat.mtime), hashBytes(&stat.size, sizeof(stat.size)));
+    return true;
+}
+
+boost::filesystem::path const& PrecompiledHeader::headerFilepath()const
+{
+    return this->mHeaderFilepath;
+}
+
+uint64_t PrecompiledHeader::signature()const
+{
+    return this->mSignature;
+}
+
+void PrecompiledHeader::select_(std::vector<boost::filesystem::path> const& inputFilepaths, std::vector<std::string>* pOut)const
+{
+    struct Count
+    {
+        size_t count = 0;
+        // the sum of the orders in the sources, so that the header keeps the usual order.
+        size_t orderSum = 0;
+    };
+    static std::unordered_set<std::string> const sSourceExtensions = { ".c", ".cc", ".cpp", ".cxx", ".C" };
+
+    std::unordered_map<std::string, Count> counts;
+    size_t sourceCount = 0;
+    FileView view;
+    std::vector<IncludeScanner::Include> includes;
+    for (auto& inputFilepath : inputFilepaths) {
+        if (!view.open(inputFilepath)) {
+            continue;
+        }
+        includes.clear();
+        IncludeScanner::sScan(view.data(), view.data() + view.size(), &includes);
+        view.close();
+        ++sourceCount;
+
+        // the headers of the project are included by the absolute paths, and the others like the system headers by <name>.
+        std::unordered_set<std::string> includedHeaders;
+        for (auto& include : includes) {
+            if (0 < sSourceExtensions.count(fs::path(include.path).extension().string())) {
+                continue;
+            }
+            // "..." is looked up next to the source first.
+            std::string header;
+            if (!include.isAngled) {
+                auto path = fs::absolute(inputFilepath.parent_path() / include.path).lexically_normal();
+                if (fs::exists(path)) {
+                    header = "\"" + path.generic_string() + "\"";
+                }
+            }
+            for (auto& includeDirectory : this->mProject.includeDirectories) {
+                if (!header.empty()) {
+                    break;
+                }
+                auto path = fs::absolute(includeDirectory / include.path).lexically_normal();
+                if (fs::exists(path)) {
+                    header = "\"" + path.generic_string() + "\"";
+                }
+            }
+            if (header.empty()) {
+                header = "<" + include.path + ">";
+            }
+            if (!includedHeaders.insert(header).second) {
+                continue;
+            }
+            auto& count = counts[header];
+            ++count.count;
+            count.orderSum += includedHeaders.size();
+        }
+    }
+
+    auto minCount = std::max(size_t(2), static_cast<size_t>(std::ceil(this->mRatio * static_cast<double>(sourceCount))));
+    std::vector<std::pair<double, std::string>> headers;
+    for (auto& [header, count] : counts) {
+        if (minCount <= count.count) {
+            headers.emplace_back(static_cast<double>(count.orderSum) / static_cast<double>(count.count), header);
+        }
+    }
+    std::sort(headers.begin(), headers.end());
+    pOut->clear();
+    for (auto& [order, header] : headers) {
+        pOut->push_back(header);
+    }
+}
+
+}
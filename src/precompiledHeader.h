@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/filesystem.hpp>
+
+namespace watagashi
+{
+
+class DependencyStore;
+
+namespace data
+{
+struct Task;
+struct Project;
+}
+
+// Precompiles the headers which most targets of the project include directly,
+// and lets their compiles include it first.
+// The header lives in a directory named by the signature of the compile command, so that
+// other flags or another compiler use another one. It is compiled again when one of the
+// headers in it changes, which the dependency store knows from its depfile.
+// The headers are selected again when the targets change.
+class PrecompiledHeader
+{
+    PrecompiledHeader(PrecompiledHeader const&) = delete;
+    PrecompiledHeader& operator=(PrecompiledHeader const&) = delete;
+
+public:
+    // the directory in the intermediate directory.
+    static char const* const sDirectoryName;
+
+public:
+    // ratio is the fraction of the targets which must include a header.
+    PrecompiledHeader(data::Project const& project, data::Task const& task, double ratio);
+
+    // Select the headers from the sources and write the header.
+    // Return false when the task can't include it or no header is shared enough.
+    bool prepare(std::vector<boost::filesystem::path> const& inputFilepaths);
+    // Compile the header unless it is up to date. Return false when it failed.
+    bool build(DependencyStore* pDependencyStore);
+
+    boost::filesystem::path const& headerFilepath()const;
+    // It changes whenever the header is compiled, so that the compiles which include it run again.
+    uint64_t signature()const;
+
+private:
+    void select_(std::vector<boost::filesystem::path> const& inputFilepaths, std::vector<std::string>* pOut)const;
+
+private:
+    data::Project const& mProject;
+    data::Task const& mTask;
+    double mRatio;
+    boost::filesystem::path mHeaderFilepath;
+    boost::filesystem::path mOutputFilepath;
+    uint64_t mSignature;
+};
+
+}
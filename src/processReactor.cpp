@@ -0,0 +1,179 @@
+#include "processReactor.h"
+
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "utility.h"
+
+using namespace std;
+
+namespace watagashi
+{
+
+static int openPidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class ProcessReactor
+//
+//--------------------------------------------------------------------------------------
+
+ProcessReactor::ProcessReactor()
+    : mEpoll(::epoll_create1(EPOLL_CLOEXEC))
+    , mIsUsePidfd(0 <= mEpoll)
+{}
+
+ProcessReactor::~ProcessReactor()
+{
+    for (auto& [pid, child] : this->mChildren) {
+        waitCommand(pid);
+        if (0 <= child.pidfd) {
+            ::close(child.pidfd);
+        }
+    }
+    if (0 <= this->mEpoll) {
+        ::close(this->mEpoll);
+    }
+}
+
+bool ProcessReactor::launch(std::string const& command, Process* pProcess)
+{
+    auto pid = spawnCommand(command.c_str());
+    if (pid < 0) {
+        return false;
+    }
+
+    Child child = { pid, -1, pProcess };
+    if (this->mIsUsePidfd) {
+        child.pidfd = openPidfd(pid);
+        if (child.pidfd < 0) {
+            // the kernel is older than 5.3. fall back to polling.
+            this->mIsUsePidfd = false;
+        } else {
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.u64 = static_cast<uint64_t>(pid);
+            if (::epoll_ctl(this->mEpoll, EPOLL_CTL_ADD, child.pidfd, &ev) < 0) {
+                cerr << "Failed to watch child process. " << std::strerror(errno) << endl;
+                ::close(child.pidfd);
+                child.pidfd = -1;
+                this->mIsUsePidfd = false;
+            }
+        }
+    }
+    this->mChildren.insert({ pid, child });
+    return true;
+}
+
+std::vector<ProcessReactor::ExitInfo> ProcessReactor::wait(int timeoutMilliseconds, int wakeupFd)
+{
+    if (this->mChildren.empty()) {
+        if (0 <= wakeupFd) {
+            pollfd pfd = { wakeupFd, POLLIN, 0 };
+            ::poll(&pfd, 1, timeoutMilliseconds);
+        }
+        return {};
+    }
+    if (!this->mIsUsePidfd) {
+        return this->pollChildren_(timeoutMilliseconds, wakeupFd);
+    }
+
+    // pid 0 is never a child, so it marks wakeupFd.
+    if (0 <= wakeupFd) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+        ::epoll_ctl(this->mEpoll, EPOLL_CTL_ADD, wakeupFd, &ev);
+    }
+    std::vector<ExitInfo> result;
+    epoll_event events[64];
+    int count = ::epoll_wait(this->mEpoll, events, static_cast<int>(std::size(events)), timeoutMilliseconds);
+    if (0 <= wakeupFd) {
+        ::epoll_ctl(this->mEpoll, EPOLL_CTL_DEL, wakeupFd, nullptr);
+    }
+    if (count < 0) {
+        if (EINTR != errno) {
+            cerr << "Failed to wait child processes. " << std::strerror(errno) << endl;
+        }
+        return result;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        auto it = this->mChildren.find(static_cast<pid_t>(events[i].data.u64));
+        if (this->mChildren.end() == it) {
+            continue;
+        }
+        auto& child = it->second;
+        ::epoll_ctl(this->mEpoll, EPOLL_CTL_DEL, child.pidfd, nullptr);
+        ::close(child.pidfd);
+        size_t peakMemory = 0;
+        bool isSuccess = waitCommand(child.pid, &peakMemory);
+        result.push_back({ child.pProcess, isSuccess, peakMemory });
+        this->mChildren.erase(it);
+    }
+    return result;
+}
+
+size_t ProcessReactor::runningCount()const
+{
+    return this->mChildren.size();
+}
+
+std::vector<ProcessReactor::ExitInfo> ProcessReactor::pollChildren_(int timeoutMilliseconds, int wakeupFd)
+{
+    using namespace std::chrono;
+    auto const interval = milliseconds(2);
+    auto const limit = steady_clock::now() + milliseconds(timeoutMilliseconds);
+
+    std::vector<ExitInfo> result;
+    while (true) {
+        for (auto it = this->mChildren.begin(); it != this->mChildren.end(); ) {
+            int status = 0;
+            struct rusage usage = {};
+            auto r = ::wait4(it->first, &status, WNOHANG, &usage);
+            if (0 == r) {
+                ++it;
+                continue;
+            }
+            if (0 <= it->second.pidfd) {
+                ::epoll_ctl(this->mEpoll, EPOLL_CTL_DEL, it->second.pidfd, nullptr);
+                ::close(it->second.pidfd);
+            }
+            result.push_back({ it->second.pProcess, 0 < r && isSuccessExitStatus(status), peakMemoryFromUsage(usage) });
+            it = this->mChildren.erase(it);
+        }
+
+        if (!result.empty()
+            || (0 <= timeoutMilliseconds && limit <= steady_clock::now())) {
+            break;
+        }
+        if (0 <= wakeupFd) {
+            pollfd pfd = { wakeupFd, POLLIN, 0 };
+            if (0 < ::poll(&pfd, 1, 0)) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(interval);
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace watagashi
+{
+
+struct Process;
+
+// Launch child processes and reap them from one thread.
+// Children are watched by pidfd and epoll. When the kernel doesn't support pidfd,
+// they are reaped by polling waitpid().
+class ProcessReactor
+{
+    ProcessReactor(ProcessReactor const&) = delete;
+    ProcessReactor& operator=(ProcessReactor const&) = delete;
+
+public:
+    struct ExitInfo
+    {
+        Process* pProcess;
+        bool isSuccess;
+        // the peak resident set size in bytes.
+        size_t peakMemory;
+    };
+
+public:
+    ProcessReactor();
+    ~ProcessReactor();
+
+    // Return false when failed to start the command.
+    bool launch(std::string const& command, Process* pProcess);
+
+    // Block until one or more children exit, wakeupFd becomes readable, or timeout. -1 is infinite.
+    std::vector<ExitInfo> wait(int timeoutMilliseconds, int wakeupFd = -1);
+
+    size_t runningCount()const;
+
+private:
+    struct Child
+    {
+        pid_t pid;
+        int pidfd;
+        Process* pProcess;
+    };
+
+private:
+    std::vector<ExitInfo> pollChildren_(int timeoutMilliseconds, int wakeupFd);
+
+private:
+    int mEpoll;
+    bool mIsUsePidfd;
+    std::unordered_map<pid_t, Child> mChildren;
+};
+
+}
@@ -1,10 +1,25 @@
 #include "processServer.h"
 
 #include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/types.h>
+#endif
 
 #include "utility.h"
 #include "builder.h"
 #include "data.h"
+#include "jobServer.h"
+#include "systemInfo.h"
+#include "buildLog.h"
+#include "objectCache.h"
+#include "remoteCache.h"
+#include "includeClosureMemo.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -12,6 +27,26 @@ namespace fs = boost::filesystem;
 namespace watagashi
 {
 
+// "some avg10" of /proc/pressure/memory above this percentage holds back serving.
+static double const sMemoryPressureLimit = 10.0;
+
+// -MMD leaves the system headers out of the depfile, and the object cache keys an object by the headers in it.
+// an upgraded library header would hit the object which was compiled with the old one.
+static std::string includeSystemHeaders(std::string const& depfileOption)
+{
+    std::string result;
+    for (auto& word : split(depfileOption, ' ')) {
+        result += (result.empty() ? "" : " ") + ("-MMD" == word ? std::string("-MD") : word);
+    }
+    return result;
+}
+
+static uint64_t currentTimeMilliseconds()
+{
+    using namespace std::chrono;
+    return static_cast<uint64_t>(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+
 //--------------------------------------------------------------------------------------
 //
 //  class Process_
@@ -29,24 +64,332 @@ Process::Process(
     , outputFilepath(outputFilepath)
 {}
 
-Process::BuildResult Process::compile()const
+Process::Process(
+    Builder const& builder,
+    data::Compiler const& compiler,
+    Type type)
+    : builder(builder)
+    , compiler(compiler)
+    , type(type)
+{}
+
+Process::BuildResult Process::compile(WorkerClient* pWorkerClient)
+{
+    std::string command;
+    while (this->proceed(&command)) {
+        if (pWorkerClient && this->mCompileStepIndex == this->mStepIndex) {
+            auto result = this->compileRemotely(*pWorkerClient);
+            if (WorkerClient::Result::Unavailable == result) {
+                this->mIsDeferred = true;
+                return this->mResult;
+            }
+            this->notifyCommandResult(WorkerClient::Result::Success == result);
+            continue;
+        }
+        size_t peakMemory = 0;
+        bool isSuccess = this->runTerminal(command, &peakMemory);
+        this->notifyCommandResult(isSuccess, peakMemory);
+    }
+    return this->mResult;
+}
+
+bool Process::proceed(std::string* pOutCommand)
+{
+    if (!this->mIsStarted) {
+        this->mStartTime = currentTimeMilliseconds();
+        this->makeSteps();
+        this->mIsStarted = true;
+    }
+    this->mIsDeferred = false;
+    if (this->mIsCancelled && !this->mIsEnd) {
+        this->endAsCancelled();
+    }
+
+    while (!this->mIsEnd) {
+        if (this->mSteps.size() <= this->mStepIndex) {
+            this->mResult = BuildResult::Success;
+            this->mIsEnd = true;
+            break;
+        }
+
+        auto& step = this->mSteps[this->mStepIndex];
+        if (data::TaskProcess::Type::Terminal == step.type) {
+            if (step.content.empty()) {
+                ++this->mStepIndex;
+                continue;
+            }
+            if (this->mCompileStepIndex == this->mStepIndex) {
+                // remove the old object, because a compiler writing it in place changes its hard links too.
+                boost::system::error_code ec;
+                fs::remove(this->outputFilepath, ec);
+                if (this->fetchObjectCache()) {
+                    cout << "cached: " << this->outputFilepath.string() << endl;
+                    ++this->mStepIndex;
+                    continue;
+                }
+                if (this->mIsDeferred) {
+                    return false;
+                }
+                cout << "running: " << step.content << endl;
+            }
+            *pOutCommand = step.content;
+            return true;
+        }
+
+        switch (step.run(this->mRunData)) {
+        case data::TaskProcess::Result::Success:
+            ++this->mStepIndex;
+            break;
+        case data::TaskProcess::Result::Skip:
+            this->mResult = BuildResult::Skip;
+            this->mIsEnd = true;
+            break;
+        default:
+            this->mResult = BuildResult::Failed;
+            this->mIsEnd = true;
+            break;
+        }
+    }
+    return false;
+}
+
+void Process::notifyCommandResult(bool isSuccess, size_t peakMemory)
+{
+    this->mPeakMemory = std::max(this->mPeakMemory, peakMemory);
+    if (this->mIsCancelled) {
+        // the compiler may be killed halfway, or have read the old source.
+        this->endAsCancelled();
+        return;
+    }
+    if (isSuccess && this->mCompileStepIndex == this->mStepIndex && this->mHasManifestKey) {
+        uint64_t objectKey = 0;
+        if (this->pObjectCache->store(this->mManifestKey, this->outputFilepath, this->mRunData.depfilePath, this->pIncludeClosureMemo, &objectKey)
+            && this->pRemoteCache && !this->mRemoteKey.empty()) {
+            this->pRemoteCache->upload(this->mRemoteKey, this->mManifestKey, objectKey);
+        }
+    }
+    if (isSuccess) {
+        ++this->mStepIndex;
+    } else {
+        this->mResult = BuildResult::Failed;
+        this->mIsEnd = true;
+    }
+}
+
+Process::BuildResult Process::result()const
+{
+    return this->mResult;
+}
+
+size_t Process::peakMemory()const
+{
+    return this->mPeakMemory;
+}
+
+uint64_t Process::startTime()const
+{
+    return this->mStartTime;
+}
+
+uint64_t Process::commandSignature()const
+{
+    return this->mCommandSignature;
+}
+
+bool Process::isCacheHit()const
+{
+    return this->mIsCacheHit;
+}
+
+bool Process::isDeferred()const
+{
+    return this->mIsDeferred;
+}
+
+bool Process::usesModules()const
+{
+    return !this->moduleName.empty() || !this->importedModules.empty();
+}
+
+bool Process::isRemotable()const
+{
+    return Type::Compile == this->type && !this->usesModules();
+}
+
+void Process::cancel()
+{
+    this->mIsCancelled = true;
+#ifndef _WIN32
+    auto pid = static_cast<pid_t>(this->mRunningPid.load());
+    if (0 < pid) {
+        ::kill(pid, SIGTERM);
+    }
+#endif
+}
+
+bool Process::runTerminal(std::string const& command, size_t* pOutPeakMemory)
+{
+#ifdef _WIN32
+    return runCommand(command, pOutPeakMemory);
+#else
+    *pOutPeakMemory = 0;
+    if (command.empty()) {
+        return true;
+    }
+    auto pid = spawnCommand(command.c_str());
+    if (pid < 0) {
+        return false;
+    }
+    this->mRunningPid = pid;
+    // cancel() may have missed the pid.
+    if (this->mIsCancelled) {
+        ::kill(pid, SIGTERM);
+    }
+    bool isSuccess = waitCommand(pid, pOutPeakMemory);
+    this->mRunningPid = 0;
+    return isSuccess;
+#endif
+}
+
+void Process::endAsCancelled()
+{
+    boost::system::error_code ec;
+    fs::remove(this->outputFilepath, ec);
+    this->mResult = BuildResult::Cancelled;
+    this->mIsEnd = true;
+    cout << "cancelled: " << this->inputFilepath.string() << endl;
+}
+
+bool Process::fetchObjectCache()
+{
+    if (!this->pObjectCache) {
+        return false;
+    }
+    if (this->mRemoteLookup.valid()) {
+        // the other processes ran while downloading. don't wait for a slow server much longer than compiling.
+        auto timeout = std::chrono::milliseconds(std::max<size_t>(this->estimatedDuration / 4, 100));
+        if (std::future_status::ready == this->mRemoteLookup.wait_for(timeout) && this->mRemoteLookup.get()) {
+            this->mIsCacheHit = this->pObjectCache->fetch(this->mManifestKey, this->outputFilepath, this->mRunData.depfilePath, this->pIncludeClosureMemo, true);
+        }
+        if (!this->mIsCacheHit) {
+            // the build log measures the compiler, not the queue.
+            this->mStartTime = currentTimeMilliseconds();
+        }
+        return this->mIsCacheHit;
+    }
+    if (this->mHasManifestKey) {
+        // it missed before the remote slot gave the process back.
+        return false;
+    }
+    // the source is hashed only when it is compiled.
+    uint64_t sourceHash = 0;
+    auto sourceFilepath = this->inputFilepath.string();
+    if (!(this->pIncludeClosureMemo ? this->pIncludeClosureMemo->contentHash(sourceFilepath, &sourceHash) : hashFile(sourceFilepath, &sourceHash))) {
+        return false;
+    }
+    // the debug information has the working directory.
+    boost::system::error_code ec;
+    auto key = hashString(fs::current_path(ec).string(), this->mCacheCommandSignature);
+    this->mManifestKey = hashString(std::to_string(sourceHash), key);
+    this->mHasManifestKey = true;
+    this->mIsCacheHit = this->pObjectCache->fetch(this->mManifestKey, this->outputFilepath, this->mRunData.depfilePath, this->pIncludeClosureMemo);
+    if (!this->mIsCacheHit && this->pRemoteCache) {
+        this->mRemoteKey = this->pRemoteCache->makeKey(this->mCacheCommand, this->inputFilepath);
+        if (!this->mRemoteKey.empty()) {
+            this->mRemoteLookup = this->pRemoteCache->lookup(this->mRemoteKey, this->mManifestKey, this->pIncludeClosureMemo);
+            this->mIsDeferred = true;
+        }
+    }
+    return this->mIsCacheHit;
+}
+
+WorkerClient::Result Process::compileRemotely(WorkerClient& client)
 {
-    //cout << "run " << this->inputFilepath << endl;
     auto& project = builder.project();
-    auto& taskBundle = data::getTaskBundle(compiler, project.type);
-    auto& task = taskBundle.compileObj;
+    auto task = this->makeCompileTask();
+
+    // the worker has neither the headers nor the include directories, so the source is preprocessed here.
+    // the preprocessor writes the depfile too. the precompiled header isn't used, since the worker doesn't have it.
+    bool isC = ".c" == this->inputFilepath.extension();
+    auto preprocessedFilepath = fs::path(this->outputFilepath).replace_extension(isC ? ".i" : ".ii");
+    auto preprocessTask = task;
+    preprocessTask.optionSuffix += " -E";
+    auto preprocessCommand = data::makeCompileCommand(preprocessTask, this->inputFilepath, preprocessedFilepath, project, this->mpFileFilter);
+    size_t peakMemory = 0;
+    bool isSuccess = runCommand(preprocessCommand, &peakMemory);
+    this->mPeakMemory = std::max(this->mPeakMemory, peakMemory);
+    if (!isSuccess) {
+        return WorkerClient::Result::Failed;
+    }
+    auto source = readFile(preprocessedFilepath);
+    boost::system::error_code ec;
+    fs::remove(preprocessedFilepath, ec);
+
+    auto compileTask = task;
+    compileTask.depfileOption.clear();
+    auto command = data::makeCompileCommand(
+        compileTask,
+        isC ? WorkerClient::sInputPlaceholderC : WorkerClient::sInputPlaceholderCpp,
+        WorkerClient::sOutputPlaceholder,
+        project,
+        this->mpFileFilter);
+    std::string object;
+    std::string message;
+    auto result = client.compile(command, source, &object, &message);
+    if (!message.empty()) {
+        cerr << message;
+    }
+    if (WorkerClient::Result::Success == result) {
+        std::ofstream out(this->outputFilepath.string(), std::ios::binary | std::ios::trunc);
+        out.write(object.data(), object.size());
+        if (!out) {
+            cerr << "Failed to write the object from " << client.worker().address() << ". path=" << this->outputFilepath.string() << endl;
+            return WorkerClient::Result::Failed;
+        }
+    }
+    return result;
+}
+
+void Process::makeSteps()
+{
+    switch (this->type) {
+    case Type::Link:
+        this->makeLinkSteps();
+        break;
+    case Type::Hook:
+        this->mCompileStepIndex = 0;
+        this->mSteps.emplace_back(data::TaskProcess::Type::Terminal, std::string(this->hookCommand));
+        break;
+    default:
+        this->makeCompileSteps();
+        break;
+    }
+}
+
+data::Task Process::makeCompileTask()const
+{
+    auto task = data::getTaskBundle(compiler, builder.project().type).compileObj;
+    if (this->pObjectCache) {
+        task.depfileOption = includeSystemHeaders(task.depfileOption);
+    }
+    return task;
+}
+
+void Process::makeCompileSteps()
+{
+    auto& project = builder.project();
+    auto task = this->makeCompileTask();
 
     createDirectory(this->outputFilepath.parent_path());
 
-    data::TaskProcess::RunData runData;
-    runData.inputFilepath = this->inputFilepath;
-    runData.outputFilepath = this->outputFilepath;
-    runData.includeDirectories = project.includeDirectories;
-    auto preprocessResult = data::runProcesses(task.preprocesses, runData);
-    if (data::TaskProcess::Result::Success != preprocessResult) {
-        return preprocessResult == data::TaskProcess::Result::Skip
-            ? BuildResult::Skip
-            : BuildResult::Failed;
+    this->mRunData.inputFilepath = this->inputFilepath;
+    this->mRunData.outputFilepath = this->outputFilepath;
+    this->mRunData.includeDirectories = project.includeDirectories;
+    this->mRunData.pIncludeGraphCache = this->pIncludeGraphCache;
+    this->mRunData.pIncludeClosureMemo = this->pIncludeClosureMemo;
+    if (!task.depfileOption.empty()) {
+        this->mRunData.depfilePath = data::makeDepfilePath(this->outputFilepath);
+        this->mRunData.pDependencyStore = this->pDependencyStore;
     }
 
     // check match Filter
@@ -57,38 +400,105 @@ Process::BuildResult Process::compile()const
             break;
         }
     }
+    this->mpFileFilter = pFileFilter;
+
+    auto& steps = this->mSteps;
+    steps.insert(steps.end(), task.preprocesses.begin(), task.preprocesses.end());
     if (pFileFilter) {
-        auto result = data::runProcesses(pFileFilter->preprocess, runData);
-        if (data::TaskProcess::Result::Success != result) {
-            return preprocessResult == data::TaskProcess::Result::Skip
-                ? BuildResult::Skip
-                : BuildResult::Failed;
-        }
+        steps.insert(steps.end(), pFileFilter->preprocess.begin(), pFileFilter->preprocess.end());
     }
 
-    auto cmd = data::makeCompileCommand(taskBundle.compileObj, this->inputFilepath, this->outputFilepath, project, pFileFilter);
-    cout << "running: " << cmd << endl;
-    if (!runCommand(cmd)) {
-        return BuildResult::Failed;
+    this->mCompileStepIndex = steps.size();
+    auto cmd = data::makeCompileCommand(task, this->inputFilepath, this->outputFilepath, project, pFileFilter, this->precompiledHeader);
+    if (this->usesModules()) {
+        if (!this->moduleFilepath.empty()) {
+            createDirectory(this->moduleFilepath.parent_path());
+            // the BMI is an intermediate of the object, so the object is compiled again when the BMI is missing.
+            if (!fs::exists(this->moduleFilepath)) {
+                boost::system::error_code ec;
+                fs::remove(this->outputFilepath, ec);
+            }
+        }
+        cmd += this->makeModuleOptions(task);
+    }
+    this->mCommandSignature = data::makeCommandSignature(cmd);
+    if (!this->precompiledHeader.empty()) {
+        // the object is compiled again with the precompiled header which was compiled again.
+        this->mCommandSignature = hashBytes(&this->precompiledHeaderSignature, sizeof(this->precompiledHeaderSignature), this->mCommandSignature);
+    }
+    // and with the imported BMIs, which their processes wrote before this one is served.
+    for (auto& [name, filepath] : this->importedModules) {
+        FileStat stat;
+        statFile(filepath, &stat);
+        this->mCommandSignature = hashBytes(&stat.mtime, sizeof(stat.mtime), hashBytes(&stat.size, sizeof(stat.size), this->mCommandSignature));
     }
+    if (this->pObjectCache) {
+        auto cacheCmd = data::makeCompileCommand(task, this->inputFilepath, "watagashi-object-cache.o", project, pFileFilter, this->precompiledHeader);
+        this->mCacheCommandSignature = data::makeCommandSignature(cacheCmd);
+        this->mCacheCommand = std::move(cacheCmd);
+    }
+    this->mRunData.commandSignature = this->mCommandSignature;
+    this->mRunData.prevCommandSignature = this->prevCommandSignature;
+    steps.emplace_back(data::TaskProcess::Type::Terminal, std::move(cmd));
 
     if (pFileFilter) {
-        auto result = data::runProcesses(pFileFilter->postprocess, runData);
-        if (data::TaskProcess::Result::Success != result) {
-            return preprocessResult == data::TaskProcess::Result::Skip
-                ? BuildResult::Skip
-                : BuildResult::Failed;
-        }
+        steps.insert(steps.end(), pFileFilter->postprocess.begin(), pFileFilter->postprocess.end());
     }
+    steps.insert(steps.end(), task.postprocesses.begin(), task.postprocesses.end());
+}
+
+void Process::makeLinkSteps()
+{
+    auto& project = builder.project();
+    auto& task = data::getTaskBundle(compiler, project.type).linkObjs;
+
+    createDirectory(this->outputFilepath.parent_path());
+
+    auto cmd = data::makeLinkCommand(task, this->outputFilepath, this->linkInputFilepaths, project);
+    this->mCommandSignature = data::makeCommandSignature(cmd);
+    this->mRunData.outputFilepath = this->outputFilepath;
+    this->mRunData.commandSignature = this->mCommandSignature;
+    this->mRunData.pLinkManifest = this->pLinkManifest;
+    this->mRunData.linkInputFilepaths = this->linkInputFilepaths;
+
+    auto& steps = this->mSteps;
+    steps.emplace_back(data::TaskProcess::Type::BuildIn, "checkLink");
+    // the link preprocess runs only when the link runs.
+    steps.emplace_back(data::TaskProcess::Type::Terminal, std::string(this->hookCommand));
+    this->mCompileStepIndex = steps.size();
+    steps.emplace_back(data::TaskProcess::Type::Terminal, std::move(cmd));
+    steps.emplace_back(data::TaskProcess::Type::BuildIn, "recordLink");
+}
 
-    auto postprocessResult = data::runProcesses(task.postprocesses, runData);
-    if (data::TaskProcess::Result::Success != postprocessResult) {
-        return postprocessResult == data::TaskProcess::Result::Skip
-            ? BuildResult::Skip
-            : BuildResult::Failed;
+std::string Process::makeModuleOptions(data::Task const& task)
+{
+    std::stringstream options;
+    if (!task.moduleMapperOption.empty()) {
+        std::string mapper;
+        if (!this->moduleName.empty()) {
+            mapper += this->moduleName + " " + this->moduleFilepath.string() + "\n";
+        }
+        for (auto& [name, filepath] : this->importedModules) {
+            mapper += name + " " + filepath.string() + "\n";
+        }
+        auto mapperFilepath = fs::path(this->outputFilepath).replace_extension(".modmap");
+        if (mapper != readFile(mapperFilepath)) {
+            std::ofstream out(mapperFilepath.string(), std::ios::trunc);
+            out << mapper;
+        }
+        options << " " << task.moduleMapperOption << mapperFilepath;
+        return options.str();
     }
 
-    return BuildResult::Success;
+    if (!this->moduleName.empty() && !task.moduleOutputOption.empty()) {
+        options << " " << task.moduleOutputOption << this->moduleFilepath;
+    }
+    if (!task.moduleFileOption.empty()) {
+        for (auto& [name, filepath] : this->importedModules) {
+            options << " " << task.moduleFileOption << name << "=" << filepath;
+        }
+    }
+    return options.str();
 }
 
 //--------------------------------------------------------------------------------------
@@ -96,42 +506,313 @@ Process::BuildResult Process::compile()const
 //  class ProcessServer
 //
 //--------------------------------------------------------------------------------------
-ProcessServer::ProcessServer()
-    : mProcessSum(0u)
-    , mEndProcessSum(0u)
+ProcessServer::ProcessServer(size_t workerCount, Scheduler scheduler)
+    : mWorkerCount(std::max(workerCount, size_t(1)))
+    , mScheduler(scheduler)
+    , mpJobServer(nullptr)
+    , mMaxLoadAverage(0.0)
+    , mpBuildLog(nullptr)
+    , mMemoryLimit(0)
+    , mReservedMemory(0)
+    , mLoadAverage(0.0)
+    , mMemoryPressure(0.0)
+    , mSystemStateTime(0)
+    , mNextWorkerQueue(0)
+    , mWaitingCount(0)
+    , mBlockedCount(0)
+    , mRunningCount(0)
+    , mRemoteRunningCount(0)
+    , mSleepingWorkerCount(0)
+    , mSleepingRemoteCount(0)
+    , mIsClosed(false)
+    , mIsAbort(false)
     , mSuccessCount(0)
     , mSkipLinkCount(0)
     , mFailedCount(0)
-{ }
+    , mFailedCompileCount(0)
+    , mCancelCount(0)
+{
+    if (Scheduler::WorkStealing == this->mScheduler) {
+        this->mWorkerQueues.reserve(this->mWorkerCount);
+        for (size_t i = 0; i < this->mWorkerCount; ++i) {
+            this->mWorkerQueues.push_back(std::make_unique<WorkerQueue>());
+        }
+    }
+}
 
 ProcessServer::~ProcessServer()
 {
 }
 
+void ProcessServer::setJobServer(JobServer* pJobServer)
+{
+    this->mpJobServer = pJobServer;
+}
+
+void ProcessServer::setMaxLoadAverage(double maxLoadAverage)
+{
+    this->mMaxLoadAverage = maxLoadAverage;
+}
+
+void ProcessServer::setBuildLog(BuildLog* pBuildLog)
+{
+    this->mpBuildLog = pBuildLog;
+}
+
+void ProcessServer::setMemoryLimit(size_t memoryLimit)
+{
+    this->mMemoryLimit = memoryLimit;
+}
+
 void ProcessServer::addProcess(std::unique_ptr<Process> pProcess)
 {
-    std::lock_guard<std::mutex> lock(this->mMutex);
+    if (this->mIsClosed) {
+        return;
+    }
+    this->applyBuildLog_(*pProcess);
+    this->push_(std::move(pProcess));
+    this->notifyServe_(false);
+}
+
+void ProcessServer::addProcesses(std::vector<std::unique_ptr<Process>> processes)
+{
+    if (this->mIsClosed || processes.empty()) {
+        return;
+    }
+    for (auto& pProcess : processes) {
+        this->applyBuildLog_(*pProcess);
+    }
 
-    this->mpProcess_Queue.emplace(std::move(pProcess));
-    ++this->mProcessSum;
+    std::unordered_map<Process const*, size_t> indices;
+    for (size_t i = 0; i < processes.size(); ++i) {
+        indices[processes[i].get()] = i;
+    }
+    std::vector<std::vector<size_t>> dependents(processes.size());
+    std::vector<size_t> pendingCounts(processes.size(), 0);
+    for (size_t i = 0; i < processes.size(); ++i) {
+        for (auto pDependency : processes[i]->dependencies) {
+            auto it = indices.find(pDependency);
+            if (indices.end() != it && it->first != processes[i].get()) {
+                dependents[it->second].push_back(i);
+                ++pendingCounts[i];
+            }
+        }
+    }
+
+    // sort topologically. the processes left are in a cycle, which the compiler reports.
+    std::vector<size_t> order;
+    order.reserve(processes.size());
+    auto counts = pendingCounts;
+    for (size_t i = 0; i < processes.size(); ++i) {
+        if (0 == counts[i]) {
+            order.push_back(i);
+        }
+    }
+    for (size_t n = 0; n < order.size(); ++n) {
+        for (auto dependent : dependents[order[n]]) {
+            if (0 == --counts[dependent]) {
+                order.push_back(dependent);
+            }
+        }
+    }
+    if (order.size() < processes.size()) {
+        for (size_t i = 0; i < processes.size(); ++i) {
+            if (0 < counts[i]) {
+                cerr << "warning: the dependencies make a cycle. path=" << processes[i]->inputFilepath.string() << endl;
+                for (auto& list : dependents) {
+                    list.erase(std::remove(list.begin(), list.end(), i), list.end());
+                }
+                pendingCounts[i] = 0;
+                order.push_back(i);
+            }
+        }
+    }
+
+    // an unknown duration counts as 1 so that a longer chain goes first.
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        size_t longest = 0;
+        for (auto dependent : dependents[*it]) {
+            longest = std::max(longest, processes[dependent]->criticalPathDuration);
+        }
+        processes[*it]->criticalPathDuration = std::max(processes[*it]->estimatedDuration, size_t(1)) + longest;
+    }
+
+    std::vector<std::unique_ptr<Process>> readyProcesses;
+    readyProcesses.reserve(processes.size());
+    {
+        std::lock_guard<std::mutex> lock(this->mNodeMutex);
+        for (size_t i = 0; i < processes.size(); ++i) {
+            if (!dependents[i].empty()) {
+                auto& node = this->mNodes[processes[i].get()];
+                for (auto dependent : dependents[i]) {
+                    node.dependents.push_back(processes[dependent].get());
+                }
+            }
+        }
+        for (size_t i = 0; i < processes.size(); ++i) {
+            if (0 == pendingCounts[i]) {
+                readyProcesses.push_back(std::move(processes[i]));
+                continue;
+            }
+            auto& node = this->mNodes[processes[i].get()];
+            node.pendingCount = pendingCounts[i];
+            node.pProcess = std::move(processes[i]);
+            ++this->mBlockedCount;
+        }
+    }
+
+    std::stable_sort(readyProcesses.begin(), readyProcesses.end(), [](auto& left, auto& right) {
+        return left->criticalPathDuration > right->criticalPathDuration;
+    });
+    // workers pop the front of the queues, and round-robin keeps each queue of work stealing in the order too.
+    for (auto& pProcess : readyProcesses) {
+        this->push_(std::move(pProcess));
+    }
+    this->notifyServe_(true);
 }
 
-std::unique_ptr<Process> ProcessServer::serveProcess_()
+void ProcessServer::closeProcess()
 {
-    std::lock_guard<std::mutex> lock(this->mMutex);
-    if (!this->mpProcess_Queue.empty()) {
-        auto process = std::move(this->mpProcess_Queue.front());
-        this->mpProcess_Queue.pop();
-        return std::move(process);
-    } else {
+    this->mIsClosed = true;
+    this->notifyServe_(true);
+    this->notifyFinish_();
+}
+
+void ProcessServer::abort()
+{
+    this->mIsAbort = true;
+    this->mIsClosed = true;
+
+    size_t dropCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        dropCount += this->mpProcess_Queue.size();
+        this->mpProcess_Queue.clear();
+    }
+    for (auto& pQueue : this->mWorkerQueues) {
+        std::lock_guard<std::mutex> lock(pQueue->mutex);
+        dropCount += pQueue->processes.size();
+        pQueue->processes.clear();
+    }
+    this->mWaitingCount -= dropCount;
+    {
+        // the released ones are counted down by releaseDependents_().
+        std::lock_guard<std::mutex> lock(this->mNodeMutex);
+        size_t blockedCount = 0;
+        for (auto& [pProcess, node] : this->mNodes) {
+            if (node.pProcess) {
+                ++blockedCount;
+            }
+        }
+        this->mNodes.clear();
+        this->mBlockedCount -= blockedCount;
+    }
+
+    this->notifyServe_(true);
+    this->notifyFinish_();
+}
+
+std::unique_ptr<Process> ProcessServer::serveProcess_(size_t workerIndex, bool isRemote)
+{
+    while (!this->mIsAbort) {
+        bool isHeldBack = false;
+        if (0 < this->mWaitingCount) {
+            if (isRemote) {
+                if (auto pProcess = this->popProcess_(workerIndex, true)) {
+                    return pProcess;
+                }
+                // no waiting process can run remotely.
+                isHeldBack = true;
+            } else if (!this->canLaunch_()) {
+                isHeldBack = true;
+            } else if (this->acquireJobSlot_()) {
+                if (auto pProcess = this->popProcess_(workerIndex, false)) {
+                    return pProcess;
+                }
+                this->releaseJobSlot_();
+                // no waiting process fits the rest of the memory budget.
+                isHeldBack = 0 < this->mWaitingCount;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(this->mMutex);
+        ++this->mSleepingWorkerCount;
+        if (isRemote) {
+            ++this->mSleepingRemoteCount;
+        }
+        if (isHeldBack) {
+            // check again after a while or when a process ends.
+            if (!this->mIsAbort) {
+                this->mServeCV.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        } else {
+            this->mServeCV.wait(lock, [&]() {
+                return this->mIsAbort || this->isDrained_() || 0 < this->mWaitingCount;
+            });
+        }
+        --this->mSleepingWorkerCount;
+        if (isRemote) {
+            --this->mSleepingRemoteCount;
+        }
+        if (this->isDrained_()) {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+std::unique_ptr<Process> ProcessServer::tryServeProcess_(size_t workerIndex)
+{
+    if (this->mIsAbort || 0 == this->mWaitingCount || !this->canLaunch_()) {
+        return nullptr;
+    }
+    if (this->mpJobServer && !this->mpJobServer->tryAcquire()) {
         return nullptr;
     }
+    auto pProcess = this->popProcess_(workerIndex, false);
+    if (!pProcess) {
+        this->releaseJobSlot_();
+    }
+    return pProcess;
 }
 
-void ProcessServer::notifyEndOfProcess(Process::BuildResult result)
+void ProcessServer::notifyEndOfProcess(Process const& process)
 {
-    std::lock_guard<std::mutex> lock(this->mMutex);
-    ++this->mEndProcessSum;
+    auto result = process.result();
+    if (!process.isRemote) {
+        this->releaseJobSlot_();
+        this->mReservedMemory -= process.estimatedPeakMemory;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mRunningMutex);
+        this->mRunningProcesses.erase(const_cast<Process*>(&process));
+    }
+
+    if (this->mpBuildLog && !process.outputFilepath.empty()
+        && Process::BuildResult::Skip != result && Process::BuildResult::Cancelled != result) {
+        BuildLog::Entry prevEntry;
+        this->mpBuildLog->find(process.outputFilepath, &prevEntry);
+
+        BuildLog::Entry entry;
+        entry.startTime = process.startTime();
+        entry.endTime = currentTimeMilliseconds();
+        entry.exitStatus = Process::BuildResult::Success == result ? 0 : 1;
+        boost::system::error_code ec;
+        auto mtime = fs::last_write_time(process.outputFilepath, ec);
+        entry.outputMtime = ec ? 0 : mtime;
+        entry.commandHash = process.commandSignature();
+        // a failed compiler may be killed halfway, so don't lower the estimate by it.
+        entry.peakMemory = Process::BuildResult::Failed == result
+            ? std::max(prevEntry.peakMemory, process.peakMemory())
+            : process.peakMemory();
+        if (process.isCacheHit()) {
+            // the compiler didn't run. keep the estimates for the build which misses the cache.
+            entry.endTime = entry.startTime + prevEntry.duration();
+            entry.peakMemory = prevEntry.peakMemory;
+        }
+        this->mpBuildLog->record(process.outputFilepath, entry);
+    }
 
     switch (result) {
     case Process::BuildResult::Success:
@@ -142,13 +823,364 @@ void ProcessServer::notifyEndOfProcess(Process::BuildResult result)
         break;
     case Process::BuildResult::Failed:
         ++this->mFailedCount;
+        if (Process::Type::Compile == process.type) {
+            ++this->mFailedCompileCount;
+        }
+        break;
+    case Process::BuildResult::Cancelled:
+        ++this->mCancelCount;
         break;
     }
+
+    if (Process::BuildResult::Failed == result) {
+        this->abort();
+    } else {
+        // serve the dependents before counting down running so that the server never looks finished.
+        this->releaseDependents_(process);
+    }
+
+    --this->mRunningCount;
+    if (process.isRemote && 0 == --this->mRemoteRunningCount && this->isDrained_()) {
+        // the workers waiting for a deferred process can leave.
+        this->notifyServe_(true);
+    }
+    if (this->isFinish_()) {
+        this->notifyServe_(true);
+        this->notifyFinish_();
+    } else if (0 < this->mMemoryLimit) {
+        // a held back process may fit the released memory.
+        this->notifyServe_(false);
+    }
+}
+
+void ProcessServer::cancelProcesses(std::function<bool(Process const&)> const& isTarget)
+{
+    std::lock_guard<std::mutex> lock(this->mRunningMutex);
+    for (auto pProcess : this->mRunningProcesses) {
+        if (isTarget(*pProcess)) {
+            pProcess->cancel();
+        }
+    }
+}
+
+void ProcessServer::deferProcess(std::unique_ptr<Process> pProcess)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mRunningMutex);
+        this->mRunningProcesses.erase(pProcess.get());
+    }
+    bool isRemote = pProcess->isRemote;
+    if (!isRemote) {
+        this->releaseJobSlot_();
+        this->mReservedMemory -= pProcess->estimatedPeakMemory;
+    }
+    if (this->mIsAbort) {
+        --this->mRunningCount;
+        if (isRemote) {
+            --this->mRemoteRunningCount;
+        }
+        this->notifyServe_(true);
+        this->notifyFinish_();
+        return;
+    }
+    // push before counting down running so that the server never looks finished.
+    this->push_(std::move(pProcess));
+    --this->mRunningCount;
+    if (isRemote) {
+        --this->mRemoteRunningCount;
+    }
+    this->notifyServe_(false);
+}
+
+void ProcessServer::waitForFinish()
+{
+    std::unique_lock<std::mutex> lock(this->mMutex);
+    this->mFinishCV.wait(lock, [&]() { return this->isFinish_(); });
 }
 
 bool ProcessServer::isFinish()const
 {
-    return this->mProcessSum == this->mEndProcessSum;
+    return this->isFinish_();
+}
+
+bool ProcessServer::isAbort()const
+{
+    return this->mIsAbort;
+}
+
+std::unique_ptr<Process> ProcessServer::popProcess_(size_t workerIndex, bool isRemote)
+{
+    std::unique_ptr<Process> pProcess;
+    switch (this->mScheduler) {
+    case Scheduler::WorkStealing:
+    {
+        auto& queue = *this->mWorkerQueues[workerIndex % this->mWorkerQueues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            auto& processes = queue.processes;
+            for (auto it = processes.begin(); it != processes.end(); ++it) {
+                if (isRemote ? (*it)->isRemotable() : this->reserveMemory_(**it)) {
+                    pProcess = std::move(*it);
+                    processes.erase(it);
+                    break;
+                }
+            }
+        }
+        if (!pProcess) {
+            pProcess = this->stealProcess_(workerIndex, isRemote);
+        }
+        break;
+    }
+    default:
+    {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        // skip the processes which don't fit the memory budget, so that small ones run in the meantime.
+        auto& processes = this->mpProcess_Queue;
+        for (auto it = processes.begin(); it != processes.end(); ++it) {
+            if (isRemote ? (*it)->isRemotable() : this->reserveMemory_(**it)) {
+                pProcess = std::move(*it);
+                processes.erase(it);
+                break;
+            }
+        }
+        break;
+    }
+    }
+
+    if (pProcess) {
+        // count up running before counting down waiting so that both never reach zero at the same time.
+        pProcess->isRemote = isRemote;
+        {
+            std::lock_guard<std::mutex> lock(this->mRunningMutex);
+            this->mRunningProcesses.insert(pProcess.get());
+        }
+        ++this->mRunningCount;
+        if (isRemote) {
+            ++this->mRemoteRunningCount;
+        }
+        --this->mWaitingCount;
+    }
+    return pProcess;
+}
+
+std::unique_ptr<Process> ProcessServer::stealProcess_(size_t workerIndex, bool isRemote)
+{
+    auto queueCount = this->mWorkerQueues.size();
+    for (size_t i = 1; i < queueCount; ++i) {
+        auto& queue = *this->mWorkerQueues[(workerIndex + i) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto& processes = queue.processes;
+        for (auto it = processes.rbegin(); it != processes.rend(); ++it) {
+            if (isRemote ? (*it)->isRemotable() : this->reserveMemory_(**it)) {
+                auto pProcess = std::move(*it);
+                processes.erase(std::next(it).base());
+                return pProcess;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void ProcessServer::applyBuildLog_(Process& process)const
+{
+    if (this->mpBuildLog && !process.outputFilepath.empty()) {
+        process.estimatedPeakMemory = this->mpBuildLog->estimatePeakMemory(process.outputFilepath);
+        process.estimatedDuration = this->mpBuildLog->estimateDuration(process.outputFilepath);
+        BuildLog::Entry entry;
+        if (this->mpBuildLog->find(process.outputFilepath, &entry) && 0 == entry.exitStatus) {
+            process.prevCommandSignature = entry.commandHash;
+        }
+    }
+}
+
+void ProcessServer::push_(std::unique_ptr<Process> pProcess, bool isOrdered)
+{
+    auto insert = [&](std::deque<std::unique_ptr<Process>>& processes) {
+        auto it = processes.end();
+        if (isOrdered) {
+            while (it != processes.begin() && (*std::prev(it))->criticalPathDuration < pProcess->criticalPathDuration) {
+                --it;
+            }
+        }
+        processes.insert(it, std::move(pProcess));
+    };
+
+    ++this->mWaitingCount;
+    switch (this->mScheduler) {
+    case Scheduler::WorkStealing:
+    {
+        auto index = this->mNextWorkerQueue++ % this->mWorkerQueues.size();
+        auto& queue = *this->mWorkerQueues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        insert(queue.processes);
+        break;
+    }
+    default:
+    {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        insert(this->mpProcess_Queue);
+        break;
+    }
+    }
+}
+
+void ProcessServer::releaseDependents_(Process const& process)
+{
+    bool isSucceeded = Process::BuildResult::Success == process.result() || Process::BuildResult::Skip == process.result();
+    std::vector<std::unique_ptr<Process>> readyProcesses;
+    size_t dropCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(this->mNodeMutex);
+        auto it = this->mNodes.find(&process);
+        if (this->mNodes.end() == it) {
+            return;
+        }
+        auto dependents = std::move(it->second.dependents);
+        this->mNodes.erase(it);
+
+        // a dependent of the cancelled process is cancelled too, and so are its dependents.
+        while (!dependents.empty()) {
+            auto pDependent = dependents.back();
+            dependents.pop_back();
+            auto dependentIt = this->mNodes.find(pDependent);
+            if (this->mNodes.end() == dependentIt || !dependentIt->second.pProcess) {
+                continue;
+            }
+            auto& node = dependentIt->second;
+            if (isSucceeded) {
+                if (0 == --node.pendingCount) {
+                    readyProcesses.push_back(std::move(node.pProcess));
+                    if (node.dependents.empty()) {
+                        this->mNodes.erase(dependentIt);
+                    }
+                }
+                continue;
+            }
+            auto& pDropped = node.pProcess;
+            auto name = !pDropped->inputFilepath.empty() ? pDropped->inputFilepath.string()
+                : !pDropped->outputFilepath.empty() ? pDropped->outputFilepath.string()
+                : pDropped->hookCommand;
+            if (!name.empty()) {
+                cout << "cancelled: " << name << endl;
+            }
+            dependents.insert(dependents.end(), node.dependents.begin(), node.dependents.end());
+            this->mNodes.erase(dependentIt);
+            ++dropCount;
+        }
+    }
+
+    // push before counting down blocked so that the server never looks drained.
+    for (auto& pProcess : readyProcesses) {
+        this->push_(std::move(pProcess), true);
+    }
+    this->mBlockedCount -= readyProcesses.size() + dropCount;
+    this->mCancelCount += dropCount;
+    if (!readyProcesses.empty()) {
+        this->notifyServe_(1 < readyProcesses.size());
+    }
+}
+
+bool ProcessServer::reserveMemory_(Process const& process)
+{
+    auto memory = process.estimatedPeakMemory;
+    auto reserved = this->mReservedMemory.load();
+    do {
+        // like the load average, always let one process run so that the build goes on.
+        if (0 < this->mMemoryLimit && 0 < reserved && this->mMemoryLimit < reserved + memory) {
+            return false;
+        }
+    } while (!this->mReservedMemory.compare_exchange_weak(reserved, reserved + memory));
+    return true;
+}
+
+bool ProcessServer::canLaunch_()
+{
+    // like make -l, always let one process run so that the build goes on.
+    if (0 == this->mRunningCount) {
+        return true;
+    }
+
+    if (0.0 < this->mMaxLoadAverage || 0 < this->mMemoryLimit) {
+        this->updateSystemState_();
+    }
+    if (0.0 < this->mMaxLoadAverage && this->mMaxLoadAverage < this->mLoadAverage) {
+        return false;
+    }
+    // the running processes already stall on memory, so a new one makes it worse.
+    if (0 < this->mMemoryLimit && sMemoryPressureLimit < this->mMemoryPressure) {
+        return false;
+    }
+    return true;
+}
+
+void ProcessServer::updateSystemState_()
+{
+    // /proc/loadavg is updated every 5 seconds, so don't read it for each process.
+    auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(100)).count();
+    if (now - this->mSystemStateTime < interval) {
+        return;
+    }
+    this->mSystemStateTime = now;
+    if (0.0 < this->mMaxLoadAverage) {
+        this->mLoadAverage = loadAverage();
+    }
+    if (0 < this->mMemoryLimit) {
+        this->mMemoryPressure = memoryPressure();
+    }
+}
+
+bool ProcessServer::acquireJobSlot_()
+{
+    if (!this->mpJobServer) {
+        return true;
+    }
+    // wake up at times to leave when the server is aborted.
+    while (!this->mpJobServer->acquire(100)) {
+        if (this->mIsAbort) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ProcessServer::releaseJobSlot_()
+{
+    if (this->mpJobServer) {
+        this->mpJobServer->release();
+    }
+}
+
+void ProcessServer::notifyServe_(bool isAll)
+{
+    // Workers increment mSleepingWorkerCount under mMutex before checking mWaitingCount,
+    // so either the worker sees the new process or this sees the sleeping worker.
+    // notify_one() may wake a remote slot which can't run the process, and it doesn't pass the wakeup on.
+    // then the local workers would sleep forever, so all of them are woken while a remote slot sleeps.
+    if (isAll || 0 < this->mSleepingRemoteCount) {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        this->mServeCV.notify_all();
+    } else if (0 < this->mSleepingWorkerCount) {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        this->mServeCV.notify_one();
+    }
+}
+
+void ProcessServer::notifyFinish_()
+{
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    this->mFinishCV.notify_all();
+}
+
+bool ProcessServer::isDrained_()const
+{
+    return this->mIsClosed && 0 == this->mWaitingCount && 0 == this->mBlockedCount && 0 == this->mRemoteRunningCount;
+}
+
+bool ProcessServer::isFinish_()const
+{
+    return (this->mIsAbort || (this->mIsClosed && 0 == this->mWaitingCount && 0 == this->mBlockedCount))
+        && 0 == this->mRunningCount;
 }
 
 }
@@ -1,67 +1,330 @@
 #pragma once
 
-#include <queue>
+#include <deque>
+#include <vector>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <unordered_set>
+#include <unordered_map>
 
 #include <boost/filesystem.hpp>
 
+#include "programOptions.h"
+#include "data.h"
+#include "workerClient.h"
+
 namespace watagashi
 {
 
 class Builder;
-namespace data
-{
-struct Compiler;
-}
+class JobServer;
+class BuildLog;
+class DependencyStore;
+class IncludeGraphCache;
+class IncludeClosureMemo;
+class ObjectCache;
+class RemoteCache;
+class LinkManifest;
 
+// A node of the build. ProcessServer runs it when the processes which it depends on end.
 struct Process
 {
+    enum class Type {
+        // compiles inputFilepath to outputFilepath.
+        Compile,
+        // links linkInputFilepaths to outputFilepath.
+        Link,
+        // runs hookCommand like the preprocess of the project. it has neither an input nor an output.
+        Hook,
+    };
+
     enum class BuildResult {
         Success,
         Skip,
         Failed,
+        // the input changed while compiling. the output is removed and the build isn't aborted.
+        Cancelled,
     };
 
     Builder const& builder;
     data::Compiler const& compiler;
+    Type type = Type::Compile;
     boost::filesystem::path inputFilepath;
     boost::filesystem::path outputFilepath;
+    // the objects which Type::Link links in this order.
+    std::vector<boost::filesystem::path> linkInputFilepaths;
+    // skips Type::Link when the objects are the same as the last link. nullptr links always.
+    LinkManifest* pLinkManifest = nullptr;
+    // the command which Type::Hook runs, or which Type::Link runs before the linker. empty runs nothing.
+    std::string hookCommand;
+    // the peak memory expected from the previous builds. ProcessServer reserves it while running.
+    size_t estimatedPeakMemory = 0;
+    // the duration in milliseconds expected from the previous builds. ProcessServer serves longer ones first.
+    size_t estimatedDuration = 0;
+    // the command signature of the last successful build. 0 when unknown.
+    uint64_t prevCommandSignature = 0;
+    // records the depfile of the compiler. nullptr doesn't use depfiles.
+    DependencyStore* pDependencyStore = nullptr;
+    // caches the includes of the sources which are scanned. nullptr scans them each time.
+    IncludeGraphCache* pIncludeGraphCache = nullptr;
+    // shares the include analysis with the other processes of the build. nullptr shares nothing.
+    IncludeClosureMemo* pIncludeClosureMemo = nullptr;
+    // copies the object from the cache instead of compiling it, and stores the compiled one. nullptr caches nothing.
+    ObjectCache* pObjectCache = nullptr;
+    // looks up the objects which miss pObjectCache, and uploads the compiled ones. nullptr shares nothing.
+    RemoteCache* pRemoteCache = nullptr;
+    // true while a remote slot serves it. ProcessServer reserves neither a job slot nor memory for it.
+    bool isRemote = false;
+    // the header which the compile includes first, and the signature of its precompiled one.
+    // empty includes nothing. see PrecompiledHeader.
+    boost::filesystem::path precompiledHeader;
+    uint64_t precompiledHeaderSignature = 0;
+    // the C++20 named module which the source exports and its BMI. empty exports nothing. see ModuleScanner.
+    std::string moduleName;
+    boost::filesystem::path moduleFilepath;
+    // the modules which the source imports directly or indirectly and their BMIs.
+    std::vector<std::pair<std::string, boost::filesystem::path>> importedModules;
+    // the processes which must end before this one is served, like the ones which write the imported BMIs.
+    // they must be added by the same ProcessServer::addProcesses().
+    std::vector<Process const*> dependencies;
+    // the estimated duration of the longest chain of the processes which wait for this one, including itself.
+    // ProcessServer sets it and serves longer ones first.
+    size_t criticalPathDuration = 0;
 
     Process(
         Builder const& builder,
         data::Compiler const& compiler,
         boost::filesystem::path const& inputFilepath,
         boost::filesystem::path const& outputFilepath);
-    BuildResult compile()const;
+    Process(
+        Builder const& builder,
+        data::Compiler const& compiler,
+        Type type);
+
+    // Run all steps in the current thread.
+    // The source is preprocessed locally and compiled by the worker when pWorkerClient isn't nullptr.
+    // When the worker is unavailable, the process is deferred so that a local slot compiles it.
+    BuildResult compile(WorkerClient* pWorkerClient = nullptr);
+
+    // Run the build-in steps until a terminal command is needed.
+    // Return true with the command when the caller must run it and call notifyCommandResult(),
+    // false when the process ended.
+    bool proceed(std::string* pOutCommand);
+    void notifyCommandResult(bool isSuccess, size_t peakMemory = 0);
+    BuildResult result()const;
+    // Return the largest peak memory of the commands which ran.
+    size_t peakMemory()const;
+    // Return the wall-clock time when the process started in milliseconds since the epoch.
+    uint64_t startTime()const;
+    // Return the signature of the compile command. see data::makeCommandSignature().
+    uint64_t commandSignature()const;
+    // Return true when the object was copied from the object cache.
+    bool isCacheHit()const;
+    // Kill the running compiler and end the process as Cancelled. Any thread may call it.
+    // With the event loop, the compiler isn't killed and its result is dropped.
+    void cancel();
+    // Return true when proceed() stopped to wait for the remote cache.
+    // The caller must give the process back to ProcessServer::deferProcess() and proceed it later.
+    bool isDeferred()const;
+    // Return true when the compile writes or reads a BMI.
+    bool usesModules()const;
+    // Return true when a remote worker can run it. The worker only compiles, and doesn't have the BMIs.
+    bool isRemotable()const;
+
+private:
+    void makeSteps();
+    void makeCompileSteps();
+    void makeLinkSteps();
+    // Return the compile task of the compiler. The depfile of a cached object lists the system headers too.
+    data::Task makeCompileTask()const;
+    // Return the options which write and read the BMIs. The mapper file is written when the task uses it.
+    std::string makeModuleOptions(data::Task const& task);
+    bool fetchObjectCache();
+    WorkerClient::Result compileRemotely(WorkerClient& client);
+    bool runTerminal(std::string const& command, size_t* pOutPeakMemory);
+    void endAsCancelled();
+
+private:
+    // preprocesses of the task and the file filter, the compile command and postprocesses.
+    std::vector<data::TaskProcess> mSteps;
+    size_t mStepIndex = 0;
+    // the step which runs the compiler, the linker or the hook.
+    size_t mCompileStepIndex = 0;
+    data::FileFilter const* mpFileFilter = nullptr;
+    bool mIsStarted = false;
+    bool mIsEnd = false;
+    BuildResult mResult = BuildResult::Failed;
+    size_t mPeakMemory = 0;
+    uint64_t mStartTime = 0;
+    uint64_t mCommandSignature = 0;
+    // the signature of the compile command whose output path is replaced, so that it is the same in any directory.
+    uint64_t mCacheCommandSignature = 0;
+    std::string mCacheCommand;
+    uint64_t mManifestKey = 0;
+    // the key of RemoteCache. empty when the remote cache isn't used.
+    std::string mRemoteKey;
+    bool mHasManifestKey = false;
+    bool mIsCacheHit = false;
+    bool mIsDeferred = false;
+    std::atomic<bool> mIsCancelled{ false };
+    // the pid of the compiler run by compile(). 0 while nothing runs.
+    std::atomic<int64_t> mRunningPid{ 0 };
+    std::shared_future<bool> mRemoteLookup;
+    data::TaskProcess::RunData mRunData;
 };
 
 class ProcessServer
 {
 public:
-    ProcessServer();
+    using Scheduler = ProgramOptions::SchedulerType;
+
+public:
+    explicit ProcessServer(size_t workerCount = 1, Scheduler scheduler = Scheduler::Queue);
     ~ProcessServer();
+
+    // Acquire a job slot from the jobserver for each served process.
+    void setJobServer(JobServer* pJobServer);
+    // Hold back serving while the load average is above this and a process is running. 0 is no limit.
+    void setMaxLoadAverage(double maxLoadAverage);
+    // Estimate the cost of processes by the log, and record the measured cost to it.
+    void setBuildLog(BuildLog* pBuildLog);
+    // Serve a process only when its estimated peak memory fits the rest of this budget,
+    // and hold back serving while the system stalls on memory. 0 is no limit.
+    void setMemoryLimit(size_t memoryLimit);
     
     void addProcess(std::unique_ptr<Process> pProcess);
-    std::unique_ptr<Process> serveProcess_();
-    void notifyEndOfProcess(Process::BuildResult result);
+    // Add the processes in the order of the critical path, longest first,
+    // so that a long chain doesn't start at the end and leave the other workers idle.
+    // A process which has dependencies is held until all of them end, and dropped as cancelled when one of them
+    // doesn't succeed. The dependencies of a cycle are ignored.
+    void addProcesses(std::vector<std::unique_ptr<Process>> processes);
+    // Tell the server that no more process is added.
+    // Workers leave serveProcess_() once the queue is drained.
+    void closeProcess();
+    // Drop the waiting processes and wake up all workers.
+    void abort();
+
+    // Block until a process is served.
+    // Return nullptr when the server is closed and empty, or aborted.
+    // A remote slot takes a process without the job slot, the memory budget and the load check,
+    // because it compiles on another machine.
+    std::unique_ptr<Process> serveProcess_(size_t workerIndex = 0, bool isRemote = false);
+    // Return nullptr instead of blocking when no process is waiting or no job slot is free.
+    std::unique_ptr<Process> tryServeProcess_(size_t workerIndex = 0);
+    void notifyEndOfProcess(Process const& process);
+    // Cancel the running processes which match. see Process::cancel().
+    void cancelProcesses(std::function<bool(Process const&)> const& isTarget);
+    // Release the resources of the deferred process and put it back to the end of the queue.
+    void deferProcess(std::unique_ptr<Process> pProcess);
+
+    // Block until every served process ends and no process is left.
+    void waitForFinish();
 
     bool isFinish()const;
+    bool isAbort()const;
 
 public:
+    size_t workerCount()const { return this->mWorkerCount; }
+    size_t waitingCount()const { return this->mWaitingCount; }
+    size_t blockedCount()const { return this->mBlockedCount; }
+    JobServer* jobServer()const { return this->mpJobServer; }
+    Scheduler scheduler()const { return this->mScheduler; }
     size_t successCount()const { return this->mSuccessCount; }
     size_t skipCount()const { return this->mSkipLinkCount; }
     size_t failedCount()const { return this->mFailedCount; }
+    // the failed ones of Process::Type::Compile. the others are the link and the hooks.
+    size_t failedCompileCount()const { return this->mFailedCompileCount; }
+    size_t cancelCount()const { return this->mCancelCount; }
     
 private:
-    std::mutex mMutex;
-    std::queue<std::unique_ptr<Process>> mpProcess_Queue;
-    size_t mProcessSum;
-    size_t mEndProcessSum;
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<std::unique_ptr<Process>> processes;
+    };
+
+    // a process which others depend on or which waits for others.
+    struct Node
+    {
+        // the process while it waits for its dependencies.
+        std::unique_ptr<Process> pProcess;
+        size_t pendingCount = 0;
+        std::vector<Process const*> dependents;
+    };
+
+private:
+    std::unique_ptr<Process> popProcess_(size_t workerIndex, bool isRemote);
+    std::unique_ptr<Process> stealProcess_(size_t workerIndex, bool isRemote);
+    // Reserve the estimated peak memory of the process and return true when it fits the budget.
+    bool reserveMemory_(Process const& process);
+    // Set the estimates and the previous signature of the process from the build log.
+    void applyBuildLog_(Process& process)const;
+    // isOrdered puts it before the processes of a shorter critical path instead of the end of the queue.
+    void push_(std::unique_ptr<Process> pProcess, bool isOrdered = false);
+    // Serve the dependents whose dependencies all ended, or drop them when the process didn't succeed.
+    void releaseDependents_(Process const& process);
+    bool canLaunch_();
+    void updateSystemState_();
+    bool acquireJobSlot_();
+    void releaseJobSlot_();
+    void notifyServe_(bool isAll);
+    void notifyFinish_();
+    // Return true when no process is left to serve and no remote slot may give one back.
+    bool isDrained_()const;
+    bool isFinish_()const;
+
+private:
+    size_t const mWorkerCount;
+    Scheduler const mScheduler;
+    JobServer* mpJobServer;
+    double mMaxLoadAverage;
+    BuildLog* mpBuildLog;
+    size_t mMemoryLimit;
+    std::atomic<size_t> mReservedMemory;
+    std::atomic<double> mLoadAverage;
+    std::atomic<double> mMemoryPressure;
+    std::atomic<std::chrono::steady_clock::rep> mSystemStateTime;
+
+    // mMutex guards mpProcess_Queue and the sleep of workers.
+    mutable std::mutex mMutex;
+    std::condition_variable mServeCV;
+    std::condition_variable mFinishCV;
+    std::deque<std::unique_ptr<Process>> mpProcess_Queue;
+
+    // used by Scheduler::WorkStealing. a worker pops the front of own queue and steals the back of others.
+    std::vector<std::unique_ptr<WorkerQueue>> mWorkerQueues;
+    std::atomic<size_t> mNextWorkerQueue;
+
+    std::atomic<size_t> mWaitingCount;
+    // the processes held in mNodes until their dependencies end.
+    std::atomic<size_t> mBlockedCount;
+    std::atomic<size_t> mRunningCount;
+    // the processes of the remote slots, which may come back to the queue when the worker fails.
+    std::atomic<size_t> mRemoteRunningCount;
+    std::atomic<size_t> mSleepingWorkerCount;
+    // the remote slots in mSleepingWorkerCount. they can't run a link, a hook or a module unit.
+    std::atomic<size_t> mSleepingRemoteCount;
+    std::atomic<bool> mIsClosed;
+    std::atomic<bool> mIsAbort;
     
-    size_t mSuccessCount;
-    size_t mSkipLinkCount;
-    size_t mFailedCount;
+    std::atomic<size_t> mSuccessCount;
+    std::atomic<size_t> mSkipLinkCount;
+    std::atomic<size_t> mFailedCount;
+    std::atomic<size_t> mFailedCompileCount;
+    std::atomic<size_t> mCancelCount;
+
+    // the served processes, which cancelProcesses() looks up.
+    std::mutex mRunningMutex;
+    std::unordered_set<Process*> mRunningProcesses;
+
+    // mNodeMutex guards mNodes. it is never locked with mMutex.
+    std::mutex mNodeMutex;
+    std::unordered_map<Process const*, Node> mNodes;
 };
 
 }
@@ -1,13 +1,16 @@
 #include "programOptions.h"
  
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <sstream>
+#include <cstdlib>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <boost/range/algorithm/transform.hpp>
 
 #include "utility.h"
+#include "systemInfo.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -15,12 +18,69 @@ namespace fs = boost::filesystem;
 namespace watagashi
 {
 
+// Parse a size like "8G" or "512M" into bytes.
+// When pFraction isn't nullptr, a number without the unit like "0.8" is a fraction and is returned by it instead.
+static bool parseSize(std::string const& str, uint64_t* pOut, double* pFraction = nullptr)
+{
+    char* pEnd = nullptr;
+    double value = std::strtod(str.c_str(), &pEnd);
+    if (str.c_str() == pEnd || value < 0.0) {
+        return false;
+    }
+    std::string unit = pEnd;
+    boost::range::transform(unit, unit.begin(), [](char c){ return static_cast<char>(::toupper(c)); });
+    if (pFraction && unit.empty() && std::string::npos != str.find('.')) {
+        if (1.0 < value) {
+            return false;
+        }
+        *pFraction = value;
+        return true;
+    } else if (!unit.empty()) {
+        static const std::unordered_map<std::string, double> sUnitTable = {
+            {"K", 1024.0}, {"M", 1024.0 * 1024.0}, {"G", 1024.0 * 1024.0 * 1024.0}, {"T", 1024.0 * 1024.0 * 1024.0 * 1024.0},
+        };
+        if (1 < unit.size() && 'B' == unit.back()) {
+            unit.pop_back();
+        }
+        auto it = sUnitTable.find(unit);
+        if (sUnitTable.end() == it) {
+            return false;
+        }
+        value *= it->second;
+    }
+    *pOut = static_cast<uint64_t>(value);
+    return true;
+}
+
+// Parse a size like "8G", "512M" or a fraction of MemAvailable like "0.8" into bytes.
+static bool parseMemoryLimit(std::string const& str, size_t* pOut)
+{
+    uint64_t size = 0;
+    double fraction = -1.0;
+    if (!parseSize(str, &size, &fraction)) {
+        return false;
+    }
+    if (0.0 <= fraction) {
+        auto available = availableMemory();
+        if (0 == available) {
+            cerr << "warning: MemAvailable is unknown. --memory-limit is ignored." << endl;
+        }
+        size = static_cast<uint64_t>(fraction * static_cast<double>(available));
+    }
+    *pOut = static_cast<size_t>(size);
+    return true;
+}
+
 bool ProgramOptions::parse(int argv, char** args)
 {
     namespace po = boost::program_options;
     
     try {
         std::vector<std::string> variables;
+        std::string threadCountStr;
+        std::string memoryLimitStr;
+        std::string objectCacheSizeStr;
+        std::string workersTokenFilepath;
         
         po::options_description installOptions(
             R"("install" task options)" "\n"
@@ -42,10 +102,21 @@ bool ProgramOptions::parse(int argv, char** args)
         );
         all.add_options()
             ("help,h", "show this.")
-            ("task", po::value<std::string>(&this->task)->default_value("build"), R"(run task. choose to "build", "clean", "rebuild", "listup", "show", "install" or "interactive".)")
+            ("task", po::value<std::string>(&this->task)->default_value("build"), R"(run task. choose to "build", "clean", "rebuild", "listup", "show", "install", "interactive", "daemon" or "watch". "daemon" serves the tasks of --daemon until it is interrupted. "watch" builds whenever the config, a source or an included file changes until it is interrupted. (Linux only))")
             ("config,c", po::value<std::string>(&this->configFilepath)->default_value("build.watagashi"), "use config file.")
             ("project,p", po::value<std::string>(&this->targetProject), "target project name")
-            ("thread-count,t", po::value<int>(&this->threadCount)->default_value(1), "thread count.")
+            ("thread-count,t", po::value<std::string>(&threadCountStr)->default_value("1"), R"(thread count. "auto" uses the count of CPUs allowed by the affinity and the cgroup quota.)")
+            ("load-average,l", po::value<double>(&this->maxLoadAverage)->default_value(0.0), "don't start a new job while the load average is above this. 0 is no limit.")
+            ("memory-limit", po::value<std::string>(&memoryLimitStr)->default_value("0"), R"(memory budget of the running compilers. a size like "8G" and "512M", or a fraction of MemAvailable like "0.8". a job starts only when its peak memory recorded in the previous builds fits the rest. 0 is no limit.)")
+            ("scheduler", po::value<std::string>(&this->scheduler)->default_value("queue"), R"(job scheduler. choose to "queue" or "work-stealing".)")
+            ("event-loop", po::bool_switch(&this->useEventLoop), "run compilers from one event loop thread instead of one thread per job. --thread-count is the count of compilers running at once. (Linux only)")
+            ("jobserver", po::bool_switch(&this->useJobServer), "act as a make jobserver which has --thread-count slots, so nested make or watagashi invocations in hooks share them. the jobserver in MAKEFLAGS is always joined.")
+            ("object-cache", po::value<std::string>(&this->objectCacheDirectory), "copy the objects compiled before with the same command and contents from this directory instead of compiling them. the directory may be shared by the builds of any project.")
+            ("object-cache-size", po::value<std::string>(&objectCacheSizeStr)->default_value("5G"), R"(size limit of --object-cache like "5G". the least recently used objects are removed over it.)")
+            ("remote-cache", po::value<std::string>(&this->remoteCacheUrl), R"(share --object-cache with other machines through an HTTP cache server like "http://host:8080/project". watagashi-cache-server serves it.)")
+            ("workers", po::value<std::string>(&this->workers), R"(compile on watagashi-worker daemons too, like "host1:3633,host2:3633". their slots are added to --thread-count. the sources are preprocessed locally, and compiled locally when the workers can't be reached.)")
+            ("workers-token-file", po::value<std::string>(&workersTokenFilepath), "file of the token which the --token-file of the workers has.")
+            ("daemon", po::bool_switch(&this->useDaemon), R"(run the task in the daemon of the config, which keeps the config, the project and the include graph in memory. the task runs in this process when no daemon is started.)")
             ("variable,V", po::value<std::vector<std::string>>(&variables), "define variable. this option can be multiple. the defined variable is applied with the highest priority.")
         ;
         all.add(installOptions)
@@ -66,12 +137,57 @@ bool ProgramOptions::parse(int argv, char** args)
         
         if (!vm.count("project")
             && TaskType::ShowProjects != this->taskType()
-            && TaskType::Interactive != this->taskType()) {
+            && TaskType::Interactive != this->taskType()
+            && TaskType::Daemon != this->taskType()) {
             cerr << "error: must specify --project(-p) option" << endl;
             return false;
         }
         
         boost::range::transform(this->task, this->task.begin(), [](char c){ return static_cast<char>(::tolower(c)); });
+
+        if ("auto" == threadCountStr) {
+            this->threadCount = static_cast<int>(detectJobCount());
+        } else {
+            if (threadCountStr.empty() || std::string::npos != threadCountStr.find_first_not_of("0123456789")) {
+                cerr << "error: --thread-count(-t) must be a number or \"auto\"" << endl;
+                return false;
+            }
+            this->threadCount = std::stoi(threadCountStr);
+            if (this->threadCount <= 0) {
+                this->threadCount = static_cast<int>(detectJobCount());
+            }
+        }
+
+        if (!parseMemoryLimit(memoryLimitStr, &this->memoryLimit)) {
+            cerr << "error: --memory-limit must be a size like \"8G\" or a fraction like \"0.8\"" << endl;
+            return false;
+        }
+
+        if (!parseSize(objectCacheSizeStr, &this->objectCacheSize)) {
+            cerr << "error: --object-cache-size must be a size like \"5G\"" << endl;
+            return false;
+        }
+
+        if (!this->remoteCacheUrl.empty() && this->objectCacheDirectory.empty()) {
+            // the downloaded objects are kept in the object cache.
+            cerr << "warning: --remote-cache needs --object-cache. it is ignored." << endl;
+            this->remoteCacheUrl.clear();
+        }
+
+        this->workersToken.clear();
+        if (!workersTokenFilepath.empty()) {
+            std::ifstream in(workersTokenFilepath);
+            std::getline(in, this->workersToken);
+            if (this->workersToken.empty()) {
+                cerr << "error: failed to read --workers-token-file. path=" << workersTokenFilepath << endl;
+                return false;
+            }
+        }
+
+        if (SchedulerType::Unknown == this->schedulerType()) {
+            cerr << "error: unknown scheduler '" << this->scheduler << "'" << endl;
+            return false;
+        }
         
         this->rootDirectories = fs::path(this->configFilepath).parent_path().string();
         if(this->rootDirectories.empty()) {
@@ -112,7 +228,9 @@ ProgramOptions::TaskType ProgramOptions::taskType()const
         {"listup", TaskType::ListupFiles},
         {"install", TaskType::Install},
         {"show", TaskType::ShowProjects},
-        {"interactive", TaskType::Interactive}
+        {"interactive", TaskType::Interactive},
+        {"daemon", TaskType::Daemon},
+        {"watch", TaskType::Watch},
     };
     auto it = sTable.find(this->task);
     if(sTable.end() == it) {
@@ -121,4 +239,17 @@ ProgramOptions::TaskType ProgramOptions::taskType()const
     return it->second;
 }
 
+ProgramOptions::SchedulerType ProgramOptions::schedulerType()const
+{
+    static const std::unordered_map<std::string, SchedulerType> sTable = {
+        {"queue", SchedulerType::Queue},
+        {"work-stealing", SchedulerType::WorkStealing},
+    };
+    auto it = sTable.find(this->scheduler);
+    if(sTable.end() == it) {
+        return SchedulerType::Unknown;
+    }
+    return it->second;
+}
+
 }
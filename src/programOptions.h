@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 #include <unordered_map>
 
 namespace watagashi
@@ -11,6 +12,17 @@ struct ProgramOptions
     std::string configFilepath;
     std::string targetProject;
     int threadCount;
+    double maxLoadAverage;
+    size_t memoryLimit;
+    std::string scheduler;
+    bool useEventLoop;
+    bool useJobServer;
+    bool useDaemon;
+    std::string objectCacheDirectory;
+    uint64_t objectCacheSize;
+    std::string remoteCacheUrl;
+    std::string workers;
+    std::string workersToken;
     std::unordered_map<std::string, std::string> userDefinedVaraibles;
     std::string installPath;
     
@@ -27,8 +39,18 @@ struct ProgramOptions
         Install,
         ShowProjects,
         Interactive,
+        Daemon,
+        Watch,
     };
     
     TaskType taskType()const;
+
+    enum class SchedulerType {
+        Unknown,
+        Queue,
+        WorkStealing,
+    };
+
+    SchedulerType schedulerType()const;
 };    
 }
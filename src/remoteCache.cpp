@@ -0,0 +1,403 @@
+#include "remoteCache.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+
+#include "data.h"
+#include "fileView.h"
+#include "httpClient.h"
+#include "sha256.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+// the count of the connections to the server.
+static size_t const sConnectionCount = 4;
+static int const sTimeoutMilliseconds = 10 * 1000;
+
+static char const* const sKeyVersion = "watagashi remote key v2";
+static char const* const sManifestHeader = "# watagashi remote manifest v2";
+
+static bool hashFileSha256(fs::path const& filepath, std::string* pOut)
+{
+    FileView view;
+    if (!view.open(filepath)) {
+        return false;
+    }
+    *pOut = Sha256::sHash(view.data(), view.size());
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class RemoteCache
+//
+//--------------------------------------------------------------------------------------
+
+RemoteCache::RemoteCache(std::string const& url, ObjectCache& objectCache, boost::filesystem::path const& rootDirectory)
+    : mUrl(url)
+    , mObjectCache(objectCache)
+    , mIsClosing(false)
+    , mIsAvailable(true)
+    , mHitCount(0)
+    , mMissCount(0)
+    , mUploadCount(0)
+    , mErrorCount(0)
+{
+    boost::system::error_code ec;
+    this->mRootDirectory = fs::canonical(rootDirectory, ec);
+    if (ec) {
+        this->mRootDirectory = fs::absolute(rootDirectory).lexically_normal();
+    }
+}
+
+RemoteCache::~RemoteCache()
+{
+    this->close();
+}
+
+bool RemoteCache::open()
+{
+    if (!HttpClient::sParseUrl(this->mUrl, &this->mHost, &this->mPort, &this->mPrefix)) {
+        cerr << "warning: the remote cache must be \"http://host[:port][/prefix]\". url=" << this->mUrl << endl;
+        return false;
+    }
+    for (size_t i = 0; i < sConnectionCount; ++i) {
+        this->mThreads.emplace_back(&RemoteCache::runWorker_, this);
+    }
+    return true;
+}
+
+void RemoteCache::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        if (this->mIsClosing) {
+            return;
+        }
+        this->mIsClosing = true;
+    }
+    this->mCV.notify_all();
+    for (auto& thread : this->mThreads) {
+        thread.join();
+    }
+    this->mThreads.clear();
+}
+
+std::string RemoteCache::makeKey(std::string const& command, boost::filesystem::path const& sourceFilepath)
+{
+    std::vector<std::string> args;
+    if (!splitCommandArguments(command, &args) || args.empty()) {
+        return "";
+    }
+    auto compilerDigest = this->compilerDigest_(args.front());
+    std::string sourceDigest;
+    if (compilerDigest.empty() || !hashFileSha256(sourceFilepath, &sourceDigest)) {
+        return "";
+    }
+
+    // the other checkouts have the other root.
+    auto root = this->mRootDirectory.generic_string() + "/";
+    std::string portableCommand;
+    for (size_t begin = 0; begin < command.size();) {
+        auto pos = command.find(root, begin);
+        if (std::string::npos == pos) {
+            portableCommand.append(command, begin, std::string::npos);
+            break;
+        }
+        portableCommand.append(command, begin, pos - begin);
+        begin = pos + root.size();
+    }
+
+    Sha256 sha;
+    auto add = [&](std::string const& str) {
+        sha.update(str.data(), str.size());
+        sha.update("\n", 1);
+    };
+    add(sKeyVersion);
+    add(compilerDigest);
+    add(portableCommand);
+    add(sourceDigest);
+    // the debug information has the working directory, so it can't be shared among the directories.
+    bool hasDebugInformation = std::any_of(args.begin(), args.end(), [](std::string const& arg) {
+        return 0 == arg.compare(0, 2, "-g") && "-g0" != arg;
+    });
+    if (hasDebugInformation) {
+        boost::system::error_code ec;
+        add(fs::current_path(ec).generic_string());
+    }
+    return sha.finish();
+}
+
+std::shared_future<bool> RemoteCache::lookup(std::string const& key, uint64_t manifestKey, IncludeClosureMemo* pMemo)
+{
+    auto pPromise = std::make_shared<std::promise<bool>>();
+    std::shared_future<bool> result = pPromise->get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        if (this->mIsClosing || this->mThreads.empty()) {
+            pPromise->set_value(false);
+            return result;
+        }
+        this->mLookups.push_back([this, pPromise, key, manifestKey, pMemo](HttpClient& client) {
+            pPromise->set_value(this->lookup_(client, key, manifestKey, pMemo));
+        });
+    }
+    this->mCV.notify_one();
+    return result;
+}
+
+void RemoteCache::upload(std::string const& key, uint64_t manifestKey, uint64_t objectKey)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mMutex);
+        if (this->mIsClosing || this->mThreads.empty()) {
+            return;
+        }
+        this->mUploads.push_back([this, key, manifestKey, objectKey](HttpClient& client) {
+            this->upload_(client, key, manifestKey, objectKey);
+        });
+    }
+    this->mCV.notify_one();
+}
+
+RemoteCache::Stats RemoteCache::stats()const
+{
+    Stats result;
+    result.hitCount = this->mHitCount;
+    result.missCount = this->mMissCount;
+    result.uploadCount = this->mUploadCount;
+    result.errorCount = this->mErrorCount;
+    return result;
+}
+
+void RemoteCache::runWorker_()
+{
+    HttpClient client(this->mHost, this->mPort, sTimeoutMilliseconds);
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(this->mMutex);
+            this->mCV.wait(lock, [&]() {
+                return this->mIsClosing || !this->mLookups.empty() || !this->mUploads.empty();
+            });
+            auto& tasks = this->mLookups.empty() ? this->mUploads : this->mLookups;
+            if (tasks.empty()) {
+                break;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task(client);
+    }
+}
+
+bool RemoteCache::lookup_(HttpClient& client, std::string const& key, uint64_t manifestKey, IncludeClosureMemo* pMemo)
+{
+    // the build doesn't wait for the lookups which start after close().
+    if (!this->mIsAvailable || this->mIsClosing) {
+        ++this->mMissCount;
+        return false;
+    }
+
+    std::string body;
+    auto status = client.get(this->mPrefix + "/ac/" + key, &body);
+    if (200 != status) {
+        this->notifyError_(status);
+        ++this->mMissCount;
+        return false;
+    }
+    std::vector<ObjectCache::ManifestEntry> entries;
+    std::istringstream in(body);
+    uint64_t objectKey = 0;
+    ObjectCache::ManifestEntry const* pEntry = nullptr;
+    if (this->parseManifest_(in, &entries)) {
+        pEntry = ObjectCache::sFindMatchedEntry(manifestKey, entries, pMemo, &objectKey);
+    }
+    if (!pEntry) {
+        ++this->mMissCount;
+        return false;
+    }
+
+    status = client.get(this->mPrefix + "/cas/" + pEntry->objectDigest, &body);
+    if (200 != status) {
+        this->notifyError_(status);
+        ++this->mMissCount;
+        return false;
+    }
+    // the server may keep a broken or a forged object.
+    if (Sha256::sHash(body) != pEntry->objectDigest) {
+        ++this->mErrorCount;
+        ++this->mMissCount;
+        return false;
+    }
+    auto temporaryPath = this->mObjectCache.makeTemporaryPath();
+    {
+        std::ofstream out(temporaryPath.string(), std::ios::binary | std::ios::trunc);
+        out.write(body.data(), body.size());
+        if (!out) {
+            ++this->mMissCount;
+            return false;
+        }
+    }
+    if (!this->mObjectCache.import(manifestKey, *pEntry, objectKey, temporaryPath)) {
+        ++this->mMissCount;
+        return false;
+    }
+    ++this->mHitCount;
+    return true;
+}
+
+bool RemoteCache::upload_(HttpClient& client, std::string const& key, uint64_t manifestKey, uint64_t objectKey)
+{
+    if (!this->mIsAvailable) {
+        return false;
+    }
+
+    // find the entry of the object in the local manifest. another build may have replaced it.
+    std::vector<ObjectCache::ManifestEntry> localEntries;
+    ObjectCache::ManifestEntry const* pEntry = nullptr;
+    {
+        std::ifstream in(this->mObjectCache.manifestPath(manifestKey).string());
+        if (in && ObjectCache::sParseManifest(in, &localEntries)) {
+            for (auto& entry : localEntries) {
+                if (objectKey == ObjectCache::sMakeObjectKey(manifestKey, entry)) {
+                    pEntry = &entry;
+                    break;
+                }
+            }
+        }
+    }
+    FileView object;
+    if (!pEntry || !object.open(this->mObjectCache.objectPath(objectKey))) {
+        return false;
+    }
+    auto entry = *pEntry;
+    entry.objectDigest = Sha256::sHash(object.data(), object.size());
+
+    // the object goes first, so that the others never find an entry without its object.
+    auto status = client.put(this->mPrefix + "/cas/" + entry.objectDigest, std::string(object.data(), object.size()));
+    if (status < 200 || 300 <= status) {
+        this->notifyError_(status);
+        return false;
+    }
+
+    // merge the entries of the other machines. a concurrent upload may drop one, which only causes a miss.
+    auto manifestTarget = this->mPrefix + "/ac/" + key;
+    std::string body;
+    std::vector<ObjectCache::ManifestEntry> entries;
+    if (200 == client.get(manifestTarget, &body)) {
+        std::istringstream in(body);
+        this->parseManifest_(in, &entries);
+    }
+    ObjectCache::sAddManifestEntry(&entries, std::move(entry));
+    std::ostringstream out;
+    this->writeManifest_(out, entries);
+    status = client.put(manifestTarget, out.str());
+    if (status < 200 || 300 <= status) {
+        this->notifyError_(status);
+        return false;
+    }
+    ++this->mUploadCount;
+    return true;
+}
+
+bool RemoteCache::parseManifest_(std::istream& in, std::vector<ObjectCache::ManifestEntry>* pOut)const
+{
+    // e\t<dependency count>\t<object digest>
+    // <content hash>\t<path>
+    pOut->clear();
+    std::string line;
+    if (!std::getline(in, line) || sManifestHeader != line) {
+        return false;
+    }
+    while (std::getline(in, line)) {
+        auto fields = split(line, '\t');
+        if (3 != fields.size() || "e" != fields[0] || !Sha256::sIsDigest(fields[2])) {
+            return false;
+        }
+        auto count = std::strtoull(fields[1].c_str(), nullptr, 10);
+        ObjectCache::ManifestEntry entry;
+        entry.objectDigest = fields[2];
+        for (unsigned long long i = 0; i < count; ++i) {
+            if (!std::getline(in, line)) {
+                return false;
+            }
+            auto tab = line.find('\t');
+            if (std::string::npos == tab) {
+                return false;
+            }
+            entry.dependencies.push_back({ std::strtoull(line.c_str(), nullptr, 16), this->toLocalPath_(line.substr(tab + 1)) });
+        }
+        pOut->push_back(std::move(entry));
+    }
+    return true;
+}
+
+void RemoteCache::writeManifest_(std::ostream& out, std::vector<ObjectCache::ManifestEntry> const& entries)const
+{
+    out << sManifestHeader << "\n";
+    for (auto& entry : entries) {
+        out << "e\t" << entry.dependencies.size() << "\t" << entry.objectDigest << "\n";
+        for (auto& [hash, path] : entry.dependencies) {
+            out << toHexString(hash) << "\t" << this->toPortablePath_(path) << "\n";
+        }
+    }
+}
+
+std::string RemoteCache::toPortablePath_(std::string const& path)const
+{
+    auto absolutePath = fs::absolute(path).lexically_normal().generic_string();
+    auto root = this->mRootDirectory.generic_string() + "/";
+    if (0 == absolutePath.compare(0, root.size(), root)) {
+        return absolutePath.substr(root.size());
+    }
+    return absolutePath;
+}
+
+std::string RemoteCache::toLocalPath_(std::string const& path)const
+{
+    if (fs::path(path).is_absolute()) {
+        return path;
+    }
+    return (this->mRootDirectory / path).generic_string();
+}
+
+std::string RemoteCache::compilerDigest_(std::string const& program)
+{
+    // the driver is the same file on the machines which have the same version of the compiler.
+    auto filepath = data::findProgram(program);
+    FileStat stat;
+    if (filepath.empty() || !statFile(filepath, &stat)) {
+        return "";
+    }
+    std::lock_guard<std::mutex> lock(this->mCompilerMutex);
+    auto& digest = this->mCompilerDigests[filepath.string()];
+    if (digest.second.empty() || digest.first != stat) {
+        digest.first = stat;
+        if (!hashFileSha256(filepath, &digest.second)) {
+            digest.second.clear();
+        }
+    }
+    return digest.second;
+}
+
+void RemoteCache::notifyError_(int status)
+{
+    // 404 is a miss.
+    if (404 == status) {
+        return;
+    }
+    ++this->mErrorCount;
+    if (0 == status && this->mIsAvailable.exchange(false)) {
+        cerr << "warning: the remote cache can't be reached. it is disabled in this build. url=" << this->mUrl << endl;
+    }
+}
+
+}
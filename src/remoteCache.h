@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+#include <boost/filesystem.hpp>
+
+#include "utility.h"
+#include "objectCache.h"
+
+namespace watagashi
+{
+
+class IncludeClosureMemo;
+class HttpClient;
+
+// Shares the objects of ObjectCache with other machines through an HTTP server like watagashi-cache-server.
+// The paths look like the HTTP cache of Bazel, but the manifest is the one of watagashi:
+//   GET/PUT <prefix>/ac/<key>        the manifest. the key is the SHA-256 of the compiler, the command and the source.
+//   GET/PUT <prefix>/cas/<digest>    the object. the digest is the SHA-256 of its content and is checked after a download.
+// The paths under the root directory are relative in the key and the manifest,
+// so the checkouts at different directories share the entries.
+// A found object is imported to the local cache, so the remote cache is always behind the local one.
+//
+// The requests run on background threads. A process starts a lookup and lets the worker compile
+// other files in the meantime, so a slow server never holds back the build.
+class RemoteCache
+{
+    RemoteCache(RemoteCache const&) = delete;
+    RemoteCache& operator=(RemoteCache const&) = delete;
+
+public:
+    struct Stats
+    {
+        size_t hitCount = 0;
+        size_t missCount = 0;
+        size_t uploadCount = 0;
+        size_t errorCount = 0;
+    };
+
+public:
+    RemoteCache(std::string const& url, ObjectCache& objectCache, boost::filesystem::path const& rootDirectory);
+    ~RemoteCache();
+
+    // Return false when the url isn't "http://host[:port][/prefix]".
+    bool open();
+    // Finish the uploads and stop the threads. The lookups which haven't started are missed.
+    void close();
+
+    // Return the key of the compile command whose output is a placeholder,
+    // or an empty string when the compiler or the source can't be read.
+    std::string makeKey(std::string const& command, boost::filesystem::path const& sourceFilepath);
+    // Start to download the manifest and the object which matches the current contents of the dependencies.
+    // The future becomes true when the object is imported to the object cache by the manifest key.
+    std::shared_future<bool> lookup(std::string const& key, uint64_t manifestKey, IncludeClosureMemo* pMemo);
+    // Upload the object and its manifest entry in the object cache.
+    void upload(std::string const& key, uint64_t manifestKey, uint64_t objectKey);
+
+    Stats stats()const;
+
+private:
+    using Task = std::function<void(HttpClient&)>;
+
+    void runWorker_();
+    bool lookup_(HttpClient& client, std::string const& key, uint64_t manifestKey, IncludeClosureMemo* pMemo);
+    bool upload_(HttpClient& client, std::string const& key, uint64_t manifestKey, uint64_t objectKey);
+    // The manifest has the paths relative to the root, and the entries in memory have the local ones.
+    bool parseManifest_(std::istream& in, std::vector<ObjectCache::ManifestEntry>* pOut)const;
+    void writeManifest_(std::ostream& out, std::vector<ObjectCache::ManifestEntry> const& entries)const;
+    std::string toPortablePath_(std::string const& path)const;
+    std::string toLocalPath_(std::string const& path)const;
+    // Return the digest of the compiler. It is hashed again when its metadata changes.
+    std::string compilerDigest_(std::string const& program);
+    // Count the error and stop using the server when it can't be reached.
+    void notifyError_(int status);
+
+private:
+    std::string mUrl;
+    std::string mHost;
+    std::string mPort;
+    std::string mPrefix;
+    ObjectCache& mObjectCache;
+    boost::filesystem::path mRootDirectory;
+
+    std::mutex mCompilerMutex;
+    std::unordered_map<std::string, std::pair<FileStat, std::string>> mCompilerDigests;
+
+    std::mutex mMutex;
+    std::condition_variable mCV;
+    // lookups go first because a worker may wait for them.
+    std::deque<Task> mLookups;
+    std::deque<Task> mUploads;
+    std::vector<std::thread> mThreads;
+    std::atomic<bool> mIsClosing;
+    std::atomic<bool> mIsAvailable;
+
+    std::atomic<size_t> mHitCount;
+    std::atomic<size_t> mMissCount;
+    std::atomic<size_t> mUploadCount;
+    std::atomic<size_t> mErrorCount;
+};
+
+}
@@ -0,0 +1,135 @@
+#include "sha256.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace watagashi
+{
+
+static uint32_t const sRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotateRight(uint32_t value, int count)
+{
+    return (value >> count) | (value << (32 - count));
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class Sha256
+//
+//--------------------------------------------------------------------------------------
+
+Sha256::Sha256()
+    : mState{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+    , mBuffer{}
+    , mBufferSize(0)
+    , mLength(0)
+{}
+
+void Sha256::update(void const* pData, size_t size)
+{
+    auto p = static_cast<unsigned char const*>(pData);
+    this->mLength += size;
+    if (0 < this->mBufferSize) {
+        auto count = std::min(size, sizeof(this->mBuffer) - this->mBufferSize);
+        std::memcpy(this->mBuffer + this->mBufferSize, p, count);
+        this->mBufferSize += count;
+        p += count;
+        size -= count;
+        if (this->mBufferSize < sizeof(this->mBuffer)) {
+            return;
+        }
+        this->transform_(this->mBuffer);
+        this->mBufferSize = 0;
+    }
+    for (; sizeof(this->mBuffer) <= size; p += sizeof(this->mBuffer), size -= sizeof(this->mBuffer)) {
+        this->transform_(p);
+    }
+    std::memcpy(this->mBuffer, p, size);
+    this->mBufferSize = size;
+}
+
+std::string Sha256::finish()
+{
+    // '1' bit, zeros and the length in bits as big endian.
+    auto bitLength = this->mLength * 8;
+    unsigned char padding[72] = { 0x80 };
+    auto paddingSize = (this->mBufferSize < 56 ? 56 : 120) - this->mBufferSize;
+    for (int i = 0; i < 8; ++i) {
+        padding[paddingSize + i] = static_cast<unsigned char>(bitLength >> (56 - 8 * i));
+    }
+    this->update(padding, paddingSize + 8);
+
+    static char const* const sDigits = "0123456789abcdef";
+    std::string result;
+    result.reserve(64);
+    for (auto word : this->mState) {
+        for (int shift = 28; 0 <= shift; shift -= 4) {
+            result += sDigits[(word >> shift) & 0xf];
+        }
+    }
+    return result;
+}
+
+std::string Sha256::sHash(void const* pData, size_t size)
+{
+    Sha256 sha;
+    sha.update(pData, size);
+    return sha.finish();
+}
+
+std::string Sha256::sHash(std::string const& data)
+{
+    return sHash(data.data(), data.size());
+}
+
+bool Sha256::sIsDigest(std::string const& str)
+{
+    return 64 == str.size() && std::string::npos == str.find_first_not_of("0123456789abcdef");
+}
+
+void Sha256::transform_(unsigned char const* pBlock)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t(pBlock[i * 4]) << 24) | (uint32_t(pBlock[i * 4 + 1]) << 16)
+            | (uint32_t(pBlock[i * 4 + 2]) << 8) | uint32_t(pBlock[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+        auto s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        auto s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto a = this->mState[0], b = this->mState[1], c = this->mState[2], d = this->mState[3];
+    auto e = this->mState[4], f = this->mState[5], g = this->mState[6], h = this->mState[7];
+    for (int i = 0; i < 64; ++i) {
+        auto s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+        auto ch = (e & f) ^ (~e & g);
+        auto t1 = h + s1 + ch + sRoundConstants[i] + w[i];
+        auto s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+        auto maj = (a & b) ^ (a & c) ^ (b & c);
+        auto t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    this->mState[0] += a; this->mState[1] += b; this->mState[2] += c; this->mState[3] += d;
+    this->mState[4] += e; this->mState[5] += f; this->mState[6] += g; this->mState[7] += h;
+}
+
+}
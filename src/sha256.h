@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace watagashi
+{
+
+// SHA-256 for the keys which are shared with other machines.
+// hashString() is enough for the files of one user, but a shared cache needs the keys
+// which nobody can make collide with another entry.
+class Sha256
+{
+public:
+    Sha256();
+
+    void update(void const* pData, size_t size);
+    // Return the digest as 64 lowercase hex digits. Don't update it after this.
+    std::string finish();
+
+    static std::string sHash(void const* pData, size_t size);
+    static std::string sHash(std::string const& data);
+    // Return true for 64 lowercase hex digits.
+    static bool sIsDigest(std::string const& str);
+
+private:
+    void transform_(unsigned char const* pBlock);
+
+private:
+    uint32_t mState[8];
+    unsigned char mBuffer[64];
+    size_t mBufferSize;
+    uint64_t mLength;
+};
+
+}
@@ -0,0 +1,110 @@
+#include "systemInfo.h"
+
+#include <thread>
+#include <string>
+#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+#ifdef __linux__
+// Return the CPU count allowed by cpu.max of the cgroup v2 hierarchy, or 0 when it is unlimited.
+static size_t cgroupCpuLimit()
+{
+    std::ifstream cgroup("/proc/self/cgroup");
+    std::string line;
+    fs::path groupPath;
+    while (std::getline(cgroup, line)) {
+        // cgroup v2 has only the line "0::<path>".
+        if (0 == line.compare(0, 3, "0::")) {
+            groupPath = line.substr(3);
+            break;
+        }
+    }
+    if (groupPath.empty()) {
+        return 0;
+    }
+
+    size_t limit = 0;
+    fs::path const root = "/sys/fs/cgroup";
+    // a parent group can be stricter than the own group.
+    for (auto path = root / groupPath.relative_path(); ; path = path.parent_path()) {
+        std::ifstream in((path / "cpu.max").string());
+        std::string quota;
+        double period = 0.0;
+        if (in >> quota >> period && "max" != quota && 0.0 < period) {
+            auto count = static_cast<size_t>(std::ceil(std::atof(quota.c_str()) / period));
+            count = std::max(count, size_t(1));
+            limit = 0 == limit ? count : std::min(limit, count);
+        }
+        if (path == root || !path.has_parent_path()) {
+            break;
+        }
+    }
+    return limit;
+}
+#endif
+
+size_t detectJobCount()
+{
+    size_t count = std::max(std::thread::hardware_concurrency(), 1u);
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (0 == sched_getaffinity(0, sizeof(cpuset), &cpuset)) {
+        count = std::min(count, static_cast<size_t>(std::max(CPU_COUNT(&cpuset), 1)));
+    }
+    if (auto limit = cgroupCpuLimit()) {
+        count = std::min(count, limit);
+    }
+#endif
+    return count;
+}
+
+double loadAverage()
+{
+#ifdef _WIN32
+    return -1.0;
+#else
+    double load = 0.0;
+    return 1 == ::getloadavg(&load, 1) ? load : -1.0;
+#endif
+}
+
+size_t availableMemory()
+{
+    std::ifstream in("/proc/meminfo");
+    std::string name;
+    size_t size = 0;
+    std::string unit;
+    while (in >> name >> size >> unit) {
+        if ("MemAvailable:" == name) {
+            return size * 1024;
+        }
+    }
+    return 0;
+}
+
+double memoryPressure()
+{
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    std::ifstream in("/proc/pressure/memory");
+    std::string kind, avg10;
+    if (!(in >> kind >> avg10) || "some" != kind || 0 != avg10.compare(0, 6, "avg10=")) {
+        return -1.0;
+    }
+    return std::atof(avg10.c_str() + 6);
+}
+
+}
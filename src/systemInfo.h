@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+namespace watagashi
+{
+
+// Return the count of CPUs this process can use.
+// It is the smallest of the hardware threads, the CPU affinity (cpuset) and the cgroup CPU quota.
+size_t detectJobCount();
+
+// Return the 1 minute load average of the system. Return a negative value when unknown.
+double loadAverage();
+
+// Return MemAvailable of /proc/meminfo in bytes. Return 0 when unknown.
+size_t availableMemory();
+
+// Return "some avg10" of /proc/pressure/memory, the percentage of the last 10 seconds
+// in which some tasks stalled on memory. Return a negative value when unknown.
+double memoryPressure();
+
+}
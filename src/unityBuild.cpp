@@ -0,0 +1,318 @@
+#include "unityBuild.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <cstdlib>
+#include <cstring>
+
+#include "utility.h"
+#include "data.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace watagashi
+{
+
+static char const* const sHeader = "# watagashi unity v2";
+static char const* const sGroupsFilename = "groups";
+static char const* const sIsolatedPrefix = "isolated ";
+
+char const* const UnityBuild::sDirectoryName = ".watagashi_unity";
+
+//--------------------------------------------------------------------------------------
+//
+//  class UnityBuild
+//
+//--------------------------------------------------------------------------------------
+
+UnityBuild::UnityBuild(data::Project const& project, size_t groupCount)
+    : mProject(project)
+    , mGroupCount(std::max(groupCount, size_t(1)))
+    , mDirectory(project.makeIntermediatePath() / sDirectoryName)
+{}
+
+bool UnityBuild::load()
+{
+    this->mGroups.clear();
+    this->mIsolated.clear();
+    this->mUnits.clear();
+    this->mIsolatedTargets.clear();
+
+    std::ifstream in((this->mDirectory / sGroupsFilename).string());
+    std::string line;
+    if (!std::getline(in, line) || sHeader != line) {
+        return false;
+    }
+    // other counts make other groups.
+    if (!std::getline(in, line) || "count " + std::to_string(this->mGroupCount) != line) {
+        return false;
+    }
+    // "<group> <target>", or "isolated <group> <target>" for the target which left the group.
+    while (std::getline(in, line)) {
+        bool isIsolated = 0 == line.compare(0, std::strlen(sIsolatedPrefix), sIsolatedPrefix);
+        if (isIsolated) {
+            line.erase(0, std::strlen(sIsolatedPrefix));
+        }
+        auto space = line.find(' ');
+        if (std::string::npos == space) {
+            continue;
+        }
+        auto group = static_cast<int>(std::strtol(line.c_str(), nullptr, 10));
+        auto key = line.substr(space + 1);
+        this->mGroups[key] = group;
+        if (isIsolated) {
+            this->mIsolated.insert(key);
+        }
+    }
+    this->makeUnits_();
+    return true;
+}
+
+bool UnityBuild::prepare(std::vector<boost::filesystem::path> const& targets)
+{
+    if (this->load()) {
+        this->isolate_(this->keepGroups_(targets));
+    } else {
+        this->group_(targets);
+        this->isolate_({});
+    }
+    if (this->mGroups.size() < this->mIsolated.size() * 2) {
+        cout << "regrouped the unity sources." << endl;
+        this->group_(targets);
+    }
+    this->makeUnits_();
+
+    if (!createDirectory(this->mDirectory)) {
+        return false;
+    }
+    for (auto& unit : this->mUnits) {
+        if (!this->writeSource_(unit)) {
+            return false;
+        }
+    }
+    return this->save_();
+}
+
+std::vector<UnityBuild::Unit> const& UnityBuild::units()const
+{
+    return this->mUnits;
+}
+
+std::vector<boost::filesystem::path> const& UnityBuild::isolatedTargets()const
+{
+    return this->mIsolatedTargets;
+}
+
+void UnityBuild::group_(std::vector<boost::filesystem::path> const& targets)
+{
+    // a unity source includes the targets of one extension, so that it is compiled as C or C++.
+    std::map<std::string, std::vector<std::pair<uint64_t, fs::path>>> extensions;
+    for (auto& target : targets) {
+        FileStat stat;
+        statFile(this->mProject.rootDirectory / target, &stat);
+        extensions[target.extension().string()].emplace_back(stat.size, target);
+    }
+
+    // balance the groups by the sizes of the targets. the larger ones go first to the lightest group.
+    this->mGroups.clear();
+    this->mIsolated.clear();
+    int groupOffset = 0;
+    for (auto& [extension, files] : extensions) {
+        std::sort(files.begin(), files.end(), [](auto const& left, auto const& right) {
+            if (left.first != right.first) {
+                return right.first < left.first;
+            }
+            return left.second < right.second;
+        });
+        std::vector<uint64_t> sizes(std::min(this->mGroupCount, files.size()), 0);
+        for (auto& [size, target] : files) {
+            auto it = std::min_element(sizes.begin(), sizes.end());
+            *it += std::max(size, uint64_t(1));
+            this->mGroups[target.generic_string()] = groupOffset + static_cast<int>(it - sizes.begin());
+        }
+        groupOffset += static_cast<int>(sizes.size());
+    }
+}
+
+std::unordered_set<int> UnityBuild::keepGroups_(std::vector<boost::filesystem::path> const& targets)
+{
+    std::unordered_map<std::string, int> groups;
+    std::unordered_set<std::string> isolated;
+    std::vector<fs::path> newTargets;
+    for (auto& target : targets) {
+        auto key = target.generic_string();
+        auto it = this->mGroups.find(key);
+        if (this->mGroups.end() == it) {
+            newTargets.push_back(target);
+            continue;
+        }
+        groups[key] = it->second;
+        if (this->mIsolated.count(key)) {
+            isolated.insert(key);
+        }
+    }
+    // a removed target changes the unity source of its group.
+    std::unordered_set<int> changedGroups;
+    std::map<int, std::pair<std::string, uint64_t>> groupSizes;
+    int nextGroup = 0;
+    for (auto& [key, group] : this->mGroups) {
+        nextGroup = std::max(nextGroup, group + 1);
+        if (!groups.count(key)) {
+            changedGroups.insert(group);
+            continue;
+        }
+        FileStat stat;
+        statFile(this->mProject.rootDirectory / key, &stat);
+        auto& groupSize = groupSizes[group];
+        groupSize.first = fs::path(key).extension().string();
+        groupSize.second += std::max(stat.size, uint64_t(1));
+    }
+
+    // a new target joins the lightest group of its extension, and is isolated until the group is compiled again.
+    // the first target of an extension makes a new group.
+    for (auto& target : newTargets) {
+        FileStat stat;
+        statFile(this->mProject.rootDirectory / target, &stat);
+        auto extension = target.extension().string();
+        auto lightest = groupSizes.end();
+        for (auto it = groupSizes.begin(); groupSizes.end() != it; ++it) {
+            if (extension == it->second.first && (groupSizes.end() == lightest || it->second.second < lightest->second.second)) {
+                lightest = it;
+            }
+        }
+        if (groupSizes.end() == lightest) {
+            lightest = groupSizes.emplace(nextGroup++, std::make_pair(extension, uint64_t(0))).first;
+        }
+        lightest->second.second += std::max(stat.size, uint64_t(1));
+        auto key = target.generic_string();
+        groups[key] = lightest->first;
+        isolated.insert(key);
+    }
+    this->mGroups = std::move(groups);
+    this->mIsolated = std::move(isolated);
+    return changedGroups;
+}
+
+void UnityBuild::isolate_(std::unordered_set<int> const& changedGroups)
+{
+    std::map<int, std::vector<std::string>> groups;
+    for (auto& [key, group] : this->mGroups) {
+        groups[group].push_back(key);
+    }
+    for (auto& [group, keys] : groups) {
+        std::sort(keys.begin(), keys.end());
+        FileStat objectStat;
+        auto objectPath = this->makeSourcePath_(group, fs::path(keys.front()).extension().string()).replace_extension(".o");
+        bool hasObject = statFile(objectPath, &objectStat);
+        // the targets which changed after the group was compiled, and the isolated ones which didn't.
+        std::vector<std::string> changedKeys;
+        std::vector<std::string> unchangedIsolatedKeys;
+        for (auto& key : keys) {
+            FileStat stat;
+            bool isChanged = hasObject && statFile(this->mProject.rootDirectory / key, &stat) && objectStat.mtime < stat.mtime;
+            if (this->mIsolated.count(key)) {
+                if (!isChanged) {
+                    unchangedIsolatedKeys.push_back(key);
+                }
+            } else if (isChanged) {
+                changedKeys.push_back(key);
+            }
+        }
+
+        // when most of the group changed, like after a checkout, the group is compiled again as it is.
+        auto groupedCount = static_cast<size_t>(std::count_if(keys.begin(), keys.end(), [&](auto const& key) {
+            return !this->mIsolated.count(key);
+        }));
+        if (!changedKeys.empty() && groupedCount >= changedKeys.size() * 2) {
+            for (auto& key : changedKeys) {
+                cout << "isolated: " << key << endl;
+                this->mIsolated.insert(key);
+            }
+        }
+
+        // rejoining costs nothing when the group is compiled anyway.
+        bool isCompiled = !hasObject || 0 == groupedCount || !changedKeys.empty() || changedGroups.count(group);
+        if (!isCompiled) {
+            continue;
+        }
+        for (auto& key : unchangedIsolatedKeys) {
+            cout << "rejoined: " << key << endl;
+            this->mIsolated.erase(key);
+        }
+    }
+}
+
+boost::filesystem::path UnityBuild::makeSourcePath_(int group, std::string const& extension)const
+{
+    return this->mDirectory / ("unity" + std::to_string(group) + extension);
+}
+
+void UnityBuild::makeUnits_()
+{
+    this->mUnits.clear();
+    this->mIsolatedTargets.clear();
+
+    // the order of the includes stays the same between builds.
+    std::vector<std::pair<std::string, int>> sortedGroups(this->mGroups.begin(), this->mGroups.end());
+    std::sort(sortedGroups.begin(), sortedGroups.end());
+    std::map<int, Unit> units;
+    for (auto& [target, group] : sortedGroups) {
+        if (this->mIsolated.count(target)) {
+            this->mIsolatedTargets.emplace_back(target);
+        } else {
+            units[group].targets.emplace_back(target);
+        }
+    }
+    for (auto& [group, unit] : units) {
+        unit.sourceFilepath = this->makeSourcePath_(group, unit.targets.front().extension().string());
+        unit.outputFilepath = unit.sourceFilepath;
+        unit.outputFilepath.replace_extension(".o");
+        this->mUnits.push_back(std::move(unit));
+    }
+}
+
+bool UnityBuild::writeSource_(Unit const& unit)const
+{
+    std::string content = "// generated by watagashi for the unity build.\n";
+    for (auto& target : unit.targets) {
+        content += "#include \"" + fs::absolute(this->mProject.rootDirectory / target).lexically_normal().generic_string() + "\"\n";
+    }
+
+    // an unchanged source keeps its last write time, so that the up-to-date check skips it.
+    {
+        std::ifstream in(unit.sourceFilepath.string(), std::ios::binary);
+        std::string current((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (current == content) {
+            return true;
+        }
+    }
+    std::ofstream out(unit.sourceFilepath.string(), std::ios::binary | std::ios::trunc);
+    out << content;
+    if (!out) {
+        cerr << "warning: failed to write the unity source. path=" << unit.sourceFilepath << endl;
+        return false;
+    }
+    return true;
+}
+
+bool UnityBuild::save_()const
+{
+    std::ofstream out((this->mDirectory / sGroupsFilename).string(), std::ios::trunc);
+    out << sHeader << "\n";
+    out << "count " << this->mGroupCount << "\n";
+    std::vector<std::pair<std::string, int>> sortedGroups(this->mGroups.begin(), this->mGroups.end());
+    std::sort(sortedGroups.begin(), sortedGroups.end());
+    for (auto& [target, group] : sortedGroups) {
+        out << (this->mIsolated.count(target) ? sIsolatedPrefix : "") << group << " " << target << "\n";
+    }
+    if (!out) {
+        cerr << "warning: failed to write the unity groups. path=" << this->mDirectory / sGroupsFilename << endl;
+        return false;
+    }
+    return true;
+}
+
+}
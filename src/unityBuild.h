@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+
+namespace watagashi
+{
+
+namespace data
+{
+struct Project;
+}
+
+// Groups the targets into unity sources which include several targets, so that a header is parsed
+// once per group instead of once per target.
+// The groups are kept in the intermediate directory so that the unity sources stay the same between builds.
+// A target which changes after its group was compiled is isolated. It leaves the group and is compiled
+// alone, so that editing it again compiles only itself. It rejoins the group when the group is compiled
+// again anyway and it didn't change since, like after "clean". A new target belongs to the lightest group
+// of its extension, and waits alone in the same way. When the isolated targets outnumber the grouped ones,
+// the groups are made again.
+class UnityBuild
+{
+    UnityBuild(UnityBuild const&) = delete;
+    UnityBuild& operator=(UnityBuild const&) = delete;
+
+public:
+    // the directory of the unity sources and the groups in the intermediate directory.
+    static char const* const sDirectoryName;
+
+    struct Unit
+    {
+        boost::filesystem::path sourceFilepath;
+        boost::filesystem::path outputFilepath;
+        // relative to the root directory like data::Project::targets.
+        std::vector<boost::filesystem::path> targets;
+    };
+
+public:
+    // groupCount is the count of the unity sources for each extension.
+    UnityBuild(data::Project const& project, size_t groupCount);
+
+    // Load the groups of the previous build. Return false when they are unknown.
+    bool load();
+    // Group the targets, isolate the changed ones and write the unity sources.
+    // The targets are relative to the root directory. Return false when the unity sources can't be written.
+    bool prepare(std::vector<boost::filesystem::path> const& targets);
+
+    std::vector<Unit> const& units()const;
+    // the targets which are compiled alone.
+    std::vector<boost::filesystem::path> const& isolatedTargets()const;
+
+private:
+    void group_(std::vector<boost::filesystem::path> const& targets);
+    // Keep the groups of the previous build. Return the groups which lost a target.
+    std::unordered_set<int> keepGroups_(std::vector<boost::filesystem::path> const& targets);
+    // Isolate the targets which changed after their group was compiled, and put back the isolated ones
+    // into the groups which are compiled anyway.
+    void isolate_(std::unordered_set<int> const& changedGroups);
+    boost::filesystem::path makeSourcePath_(int group, std::string const& extension)const;
+    void makeUnits_();
+    bool writeSource_(Unit const& unit)const;
+    bool save_()const;
+
+private:
+    data::Project const& mProject;
+    size_t mGroupCount;
+    boost::filesystem::path mDirectory;
+    // the group of each target. an isolated target keeps the group which it rejoins.
+    std::unordered_map<std::string, int> mGroups;
+    // the targets which left their groups.
+    std::unordered_set<std::string> mIsolated;
+    std::vector<Unit> mUnits;
+    std::vector<boost::filesystem::path> mIsolatedTargets;
+};
+
+}
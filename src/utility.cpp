@@ -3,12 +3,26 @@
 #include <sstream>
 #include <iostream>
 #include <regex>
+#include <cstring>
+#include <cstdio>
+#include <cinttypes>
+#include <unordered_set>
+
+#include "fileView.h"
 
 #ifdef _WIN32
 #include <Windows.h>
 #include <Dbghelp.h>
 #pragma comment(lib, "Dbghelp.lib")
 
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <cxxabi.h>
+
+extern char** environ;
 #endif
 
 namespace fs = boost::filesystem;
@@ -16,18 +30,12 @@ using namespace std;
 
 std::string readFile(const fs::path& filepath)
 {
-    if(!fs::exists(filepath)) {
+    // for a caller which modifies the content. use watagashi::FileView to only read it.
+    watagashi::FileView view;
+    if(!view.open(filepath)) {
         return "";
     }
-    
-    std::uintmax_t length = fs::file_size(filepath);    
-    std::string buf;
-    buf.resize(length);
-    
-    std::ifstream in(filepath.string());
-    in.read(&buf[0], length);
-    
-    return buf;
+    return std::string(view.data(), view.size());
 }
 
 bool createDirectory(const fs::path& path)
@@ -52,13 +60,232 @@ std::vector<std::string> split(const std::string& str, char delimiter)
     return result;
 }
 
-bool runCommand(char const* command)
+bool splitCommandArguments(std::string const& command, std::vector<std::string>* pOut)
 {
+    // the words which only the shell can run.
+    static const std::unordered_set<std::string> sShellWords = {
+        "!", ".", ":", "alias", "break", "case", "cd", "continue", "eval", "exec", "exit", "export",
+        "for", "function", "if", "readonly", "return", "set", "shift", "source", "trap", "ulimit",
+        "umask", "unalias", "unset", "until", "wait", "while", "{",
+    };
+
+    pOut->clear();
+    std::string arg;
+    bool hasArg = false;
+    enum class Quote { None, Single, Double } quote = Quote::None;
+    for (size_t i = 0; i < command.size(); ++i) {
+        auto c = command[i];
+        switch (quote) {
+        case Quote::Single:
+            if ('\'' == c) {
+                quote = Quote::None;
+            } else {
+                arg += c;
+            }
+            continue;
+        case Quote::Double:
+            if ('"' == c) {
+                quote = Quote::None;
+            } else if ('$' == c || '`' == c) {
+                return false;
+            } else if ('\\' == c && i + 1 < command.size() && std::strchr("\"\\$`", command[i + 1])) {
+                arg += command[++i];
+            } else {
+                arg += c;
+            }
+            continue;
+        default:
+            break;
+        }
+
+        switch (c) {
+        case ' ': case '\t':
+            if (hasArg) {
+                pOut->push_back(std::move(arg));
+                arg.clear();
+                hasArg = false;
+            }
+            break;
+        case '\'':
+            quote = Quote::Single;
+            hasArg = true;
+            break;
+        case '"':
+            quote = Quote::Double;
+            hasArg = true;
+            break;
+        case '\\':
+            if (command.size() <= i + 1 || '\n' == command[i + 1]) {
+                return false;
+            }
+            arg += command[++i];
+            hasArg = true;
+            break;
+        case '#': case '~':
+            if (!hasArg) {
+                return false;
+            }
+            arg += c;
+            break;
+        case '=':
+            if (pOut->empty()) {
+                return false; // variable assignment
+            }
+            arg += c;
+            hasArg = true;
+            break;
+        case '\n': case '|': case '&': case ';': case '<': case '>': case '(': case ')':
+        case '$': case '`': case '*': case '?': case '[': case ']': case '{': case '}':
+            return false;
+        default:
+            arg += c;
+            hasArg = true;
+            break;
+        }
+    }
+    if (Quote::None != quote) {
+        return false;
+    }
+    if (hasArg) {
+        pOut->push_back(std::move(arg));
+    }
+    return pOut->empty() || 0 == sShellWords.count(pOut->front());
+}
+
+bool runCommand(char const* command, size_t* pOutPeakMemory)
+{
+    if (pOutPeakMemory) {
+        *pOutPeakMemory = 0;
+    }
     if ('\0' == command[0]) {
         return true;
-    } else {
-        return 0 == std::system(command);
     }
+#ifdef _WIN32
+    return 0 == std::system(command);
+#else
+    auto pid = spawnCommand(command);
+    if (pid < 0) {
+        return false;
+    }
+    return waitCommand(pid, pOutPeakMemory);
+#endif
+}
+
+#ifndef _WIN32
+pid_t spawnCommand(char const* command)
+{
+    std::vector<std::string> args;
+    if (!splitCommandArguments(command, &args) || args.empty()) {
+        args = { "/bin/sh", "-c", command };
+    }
+
+    std::vector<char*> argv;
+    argv.reserve(args.size() + 1);
+    for (auto& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    auto error = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+    if (0 != error) {
+        cerr << "Failed to run '" << argv[0] << "': " << std::strerror(error) << endl;
+        return -1;
+    }
+    return pid;
+}
+
+bool waitCommand(pid_t pid, size_t* pOutPeakMemory)
+{
+    int status = 0;
+    struct rusage usage = {};
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (EINTR != errno) {
+            return false;
+        }
+    }
+    if (pOutPeakMemory) {
+        *pOutPeakMemory = peakMemoryFromUsage(usage);
+    }
+    return isSuccessExitStatus(status);
+}
+
+size_t peakMemoryFromUsage(struct rusage const& usage)
+{
+    // Linux reports the largest of the child and its reaped descendants (e.g. cc1plus under g++) in kilobytes.
+    // macOS reports it in bytes.
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+bool isSuccessExitStatus(int status)
+{
+    return WIFEXITED(status) && 0 == WEXITSTATUS(status);
+}
+#endif
+
+bool statFile(boost::filesystem::path const& filepath, FileStat* pOut)
+{
+#ifdef _WIN32
+    boost::system::error_code ec;
+    auto mtime = fs::last_write_time(filepath, ec);
+    if (ec) {
+        return false;
+    }
+    pOut->mtime = static_cast<int64_t>(mtime) * 1000000000;
+    pOut->size = fs::file_size(filepath, ec);
+    pOut->inode = 0;
+    return true;
+#else
+    struct stat st;
+    if (::stat(filepath.c_str(), &st) < 0) {
+        return false;
+    }
+#ifdef __APPLE__
+    pOut->mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    pOut->mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    pOut->size = static_cast<uint64_t>(st.st_size);
+    pOut->inode = static_cast<uint64_t>(st.st_ino);
+    return true;
+#endif
+}
+
+uint64_t hashString(std::string const& str, uint64_t hash)
+{
+    return hashBytes(str.data(), str.size(), hash);
+}
+
+uint64_t hashBytes(void const* pData, size_t size, uint64_t hash)
+{
+    auto p = static_cast<unsigned char const*>(pData);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool hashFile(boost::filesystem::path const& filepath, uint64_t* pOut)
+{
+    thread_local watagashi::FileView tFileView;
+    if (!tFileView.open(filepath)) {
+        return false;
+    }
+    *pOut = hashBytes(tFileView.data(), tFileView.size());
+    tFileView.close();
+    return true;
+}
+
+std::string toHexString(uint64_t value)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%016" PRIx64, value);
+    return buf;
 }
 
 bool matchFilepath(
@@ -106,17 +333,17 @@ std::string demangle(char const* name)
     return result;
 #else
     int status;
-    char* p = abi::__cxa_demangle(ti.name(), nullptr, nullptr, &status);
+    char* p = abi::__cxa_demangle(name, nullptr, nullptr, &status);
     if (!p) {
         switch (status) {
-        case -1: cerr << ("A memory allocation failure occurred.") << endl;
-        case -2: cerr << (std::string(name) + " is not a valid name under the C++ ABI mangling rules.") << endl;
-        case -3: cerr << ("demangle(): One of the arguments is invalid.") << endl;
-        default: cerr << ("demangle(): unknown error.") << endl;
+        case -1: cerr << ("A memory allocation failure occurred.") << endl; break;
+        case -2: cerr << (std::string(name) + " is not a valid name under the C++ ABI mangling rules.") << endl; break;
+        case -3: cerr << ("demangle(): One of the arguments is invalid.") << endl; break;
+        default: cerr << ("demangle(): unknown error.") << endl; break;
         }
         return "";
     }
-std:string result = p;
+    std::string result = p;
     free(p);
     return result;
 #endif
@@ -2,18 +2,63 @@
 
 #include <string>
 #include <fstream>
+#include <cstdint>
 #include <boost/filesystem.hpp>
 
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/resource.h>
+#endif
+
 std::string readFile(const boost::filesystem::path& filepath);
 bool createDirectory(const boost::filesystem::path& path);
 
 std::vector<std::string> split(const std::string& str, char delimiter);
 
-bool runCommand(char const* command);
+// Split the command into arguments like the shell does.
+// Return false when the command needs the shell. (pipe, redirect, variable, glob, builtin and etc.)
+bool splitCommandArguments(std::string const& command, std::vector<std::string>* pOut);
+// pOutPeakMemory receives the peak resident set size in bytes of the command and its children when it isn't nullptr.
+bool runCommand(char const* command, size_t* pOutPeakMemory = nullptr);
+
+#ifndef _WIN32
+// Start the command without waiting for it. Return -1 when failed to start.
+pid_t spawnCommand(char const* command);
+// Wait for the child process and return whether it exited successfully.
+bool waitCommand(pid_t pid, size_t* pOutPeakMemory = nullptr);
+// Return the peak resident set size in bytes from the rusage of wait4().
+size_t peakMemoryFromUsage(struct rusage const& usage);
+bool isSuccessExitStatus(int status);
+#endif
+struct FileStat
+{
+    // the last write time in nanoseconds since the epoch.
+    int64_t mtime = 0;
+    uint64_t size = 0;
+    // 0 when the platform has no inode.
+    uint64_t inode = 0;
+
+    bool operator==(FileStat const& right)const {
+        return this->mtime == right.mtime && this->size == right.size && this->inode == right.inode;
+    }
+    bool operator!=(FileStat const& right)const { return !(*this == right); }
+};
+
+// Return false when the file doesn't exist.
+bool statFile(boost::filesystem::path const& filepath, FileStat* pOut);
+
+// Return the 64 bit FNV-1a hash. Pass the previous hash to combine strings.
+uint64_t hashString(std::string const& str, uint64_t hash = 14695981039346656037ull);
+uint64_t hashBytes(void const* pData, size_t size, uint64_t hash = 14695981039346656037ull);
+// Hash the content of the file by hashBytes(). Return false when the file can't be read.
+bool hashFile(boost::filesystem::path const& filepath, uint64_t* pOut);
+// Return the 16 digits hex of the hash.
+std::string toHexString(uint64_t value);
+
 bool matchFilepath(const std::string& patternStr, const boost::filesystem::path& filepath, const boost::filesystem::path& standardPath);
 
-inline bool runCommand(std::string const& command) {
-    return runCommand(command.c_str());
+inline bool runCommand(std::string const& command, size_t* pOutPeakMemory = nullptr) {
+    return runCommand(command.c_str(), pOutPeakMemory);
 }
 
 class Finally
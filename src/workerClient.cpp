@@ -0,0 +1,112 @@
+#include "workerClient.h"
+
+#include <iostream>
+#include <cstdlib>
+
+#include "httpClient.h"
+
+using namespace std;
+
+namespace watagashi
+{
+
+// a compile is waited much longer than a cache request.
+// a worker which doesn't answer by then is hung, so the source is compiled locally instead.
+static int const sTimeoutMilliseconds = 10 * 60 * 1000;
+
+char const* const WorkerClient::sInputPlaceholderC = "watagashi-worker-input.i";
+char const* const WorkerClient::sInputPlaceholderCpp = "watagashi-worker-input.ii";
+char const* const WorkerClient::sOutputPlaceholder = "watagashi-worker-output.o";
+
+//--------------------------------------------------------------------------------------
+//
+//  struct RemoteWorker
+//
+//--------------------------------------------------------------------------------------
+
+bool RemoteWorker::sParse(std::string const& address, RemoteWorker* pOut)
+{
+    auto colon = address.rfind(':');
+    if (std::string::npos == colon) {
+        pOut->host = address;
+        pOut->port = "3633";
+    } else {
+        pOut->host = address.substr(0, colon);
+        pOut->port = address.substr(colon + 1);
+    }
+    return !pOut->host.empty()
+        && !pOut->port.empty()
+        && std::string::npos == pOut->port.find_first_not_of("0123456789");
+}
+
+//--------------------------------------------------------------------------------------
+//
+//  class WorkerClient
+//
+//--------------------------------------------------------------------------------------
+
+WorkerClient::WorkerClient(RemoteWorker& worker)
+    : mWorker(worker)
+    , mpHttpClient(std::make_unique<HttpClient>(worker.host, worker.port, sTimeoutMilliseconds))
+{
+    this->mpHttpClient->setBearerToken(worker.token);
+}
+
+WorkerClient::~WorkerClient()
+{}
+
+bool WorkerClient::queryStatus()
+{
+    std::string body;
+    if (200 != this->mpHttpClient->get("/status", &body)) {
+        this->mWorker.isAvailable = false;
+        return false;
+    }
+    static std::string const sSlots = "slots ";
+    if (0 != body.compare(0, sSlots.size(), sSlots)) {
+        this->mWorker.isAvailable = false;
+        return false;
+    }
+    this->mWorker.slotCount = std::strtoul(body.c_str() + sSlots.size(), nullptr, 10);
+    return 0 < this->mWorker.slotCount;
+}
+
+WorkerClient::Result WorkerClient::compile(std::string const& command, std::string const& source, std::string* pOutObject, std::string* pOutMessage)
+{
+    if (!this->mWorker.isAvailable) {
+        return Result::Unavailable;
+    }
+
+    std::string body;
+    body.reserve(command.size() + 1 + source.size());
+    body += command;
+    body += '\n';
+    body += source;
+    std::string response;
+    auto status = this->mpHttpClient->post("/compile", body, &response);
+    if (200 != status && 422 != status) {
+        // the others are the errors of the worker, not of the source. compile it locally.
+        if (this->mWorker.isAvailable.exchange(false)) {
+            if (0 == status) {
+                cerr << "warning: the worker " << this->mWorker.address() << " didn't answer in "
+                    << sTimeoutMilliseconds / 1000 << " seconds or was disconnected. it is not used in this build." << endl;
+            } else {
+                cerr << "warning: the worker " << this->mWorker.address() << " failed. status=" << status
+                    << ". it is not used in this build." << endl;
+            }
+        }
+        return Result::Unavailable;
+    }
+
+    auto newline = response.find('\n');
+    size_t messageSize = std::string::npos == newline ? 0 : std::strtoull(response.c_str(), nullptr, 10);
+    if (std::string::npos == newline || response.size() - newline - 1 < messageSize) {
+        this->mWorker.isAvailable = false;
+        return Result::Unavailable;
+    }
+    pOutMessage->assign(response, newline + 1, messageSize);
+    pOutObject->assign(response, newline + 1 + messageSize, std::string::npos);
+    return 200 == status ? Result::Success : Result::Failed;
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <memory>
+
+namespace watagashi
+{
+
+class HttpClient;
+
+// A watagashi-worker daemon which compiles the preprocessed sources sent by the builder.
+struct RemoteWorker
+{
+    std::string host;
+    std::string port;
+    // the count of the compilers which the worker runs at once.
+    size_t slotCount = 0;
+    // the token of the --token-file of the worker. empty sends nothing.
+    std::string token;
+    // false after a request failed to reach the worker. its slots stop serving.
+    std::atomic<bool> isAvailable{ true };
+
+    // Parse "host:port". The port is 3633 when it is omitted.
+    static bool sParse(std::string const& address, RemoteWorker* pOut);
+
+    std::string address()const { return this->host + ":" + this->port; }
+};
+
+// Sends the compile requests of one slot to a RemoteWorker.
+// The protocol is HTTP:
+//   GET /status    "slots <count>"
+//   POST /compile  the command line, '\n' and the preprocessed source.
+//                  the response is the length of the compiler message, '\n', the message and the object.
+//                  200 when the compiler succeeded, 422 when it failed.
+//                  403 when the worker doesn't allow the command.
+//   every request has "Authorization: Bearer <token>" when the worker has a token.
+class WorkerClient
+{
+    WorkerClient(WorkerClient const&) = delete;
+    WorkerClient& operator=(WorkerClient const&) = delete;
+
+public:
+    // the placeholders in the command which the worker replaces with its own files.
+    static char const* const sInputPlaceholderC;
+    static char const* const sInputPlaceholderCpp;
+    static char const* const sOutputPlaceholder;
+
+    enum class Result {
+        Success,
+        Failed,
+        Unavailable,
+    };
+
+public:
+    explicit WorkerClient(RemoteWorker& worker);
+    ~WorkerClient();
+
+    // Ask the slot count of the worker. Return false when it can't be reached.
+    bool queryStatus();
+    // Compile the preprocessed source with the command which has the placeholders.
+    // pOutMessage receives the output of the compiler.
+    // Unavailable when the worker fails or doesn't answer by the deadline. the worker isn't used after it,
+    // and the caller compiles the source locally.
+    Result compile(std::string const& command, std::string const& source, std::string* pOutObject, std::string* pOutMessage);
+
+    RemoteWorker& worker()const { return this->mWorker; }
+
+private:
+    RemoteWorker& mWorker;
+    std::unique_ptr<HttpClient> mpHttpClient;
+};
+
+}
@@ -0,0 +1,111 @@
+#include "buildLog.h"
+
+#include <fstream>
+
+#include "testing.h"
+
+using namespace watagashi;
+namespace fs = boost::filesystem;
+
+static BuildLog::Entry makeEntry(uint64_t startTime, uint64_t endTime, int exitStatus, size_t peakMemory)
+{
+    BuildLog::Entry entry;
+    entry.startTime = startTime;
+    entry.endTime = endTime;
+    entry.exitStatus = exitStatus;
+    entry.outputMtime = 1234;
+    entry.commandHash = 0xabcdef0123456789;
+    entry.peakMemory = peakMemory;
+    return entry;
+}
+
+static void testRoundTrip()
+{
+    testing::TemporaryDirectory directory;
+    auto filepath = directory.path() / BuildLog::sFilename;
+    {
+        BuildLog log(filepath);
+        CHECK(log.open());
+        log.record("a.o", makeEntry(1000, 1100, 0, 300));
+        log.record("b.o", makeEntry(1000, 1300, 1, 500));
+        // the last entry wins.
+        log.record("a.o", makeEntry(2000, 2200, 0, 100));
+        log.close();
+    }
+
+    BuildLog log(filepath);
+    CHECK(log.open());
+    CHECK(2 == log.entryCount());
+    BuildLog::Entry entry;
+    CHECK(log.find("a.o", &entry));
+    CHECK(2000 == entry.startTime && 2200 == entry.endTime && 0 == entry.exitStatus);
+    CHECK(1234 == entry.outputMtime && 0xabcdef0123456789 == entry.commandHash && 100 == entry.peakMemory);
+    CHECK(log.find("b.o", &entry));
+    CHECK(1 == entry.exitStatus && 500 == entry.peakMemory);
+    CHECK(!log.find("c.o", &entry));
+
+    // an unknown file is estimated by the average. a failed process has no duration.
+    CHECK(200 == log.estimateDuration("a.o"));
+    CHECK(200 == log.estimateDuration("b.o"));
+    CHECK(200 == log.estimateDuration("c.o"));
+    CHECK(500 == log.estimatePeakMemory("b.o"));
+    CHECK(300 == log.estimatePeakMemory("c.o"));
+    log.close();
+}
+
+static void testTornTail()
+{
+    testing::TemporaryDirectory directory;
+    auto filepath = directory.path() / BuildLog::sFilename;
+    {
+        BuildLog log(filepath);
+        CHECK(log.open());
+        log.record("a.o", makeEntry(1000, 1100, 0, 300));
+        log.close();
+    }
+    // an interrupted build leaves a part of the last line.
+    {
+        std::ofstream out(filepath.string(), std::ios::binary | std::ios::app);
+        out << "1000\t1200\t0\t1234\tff\t";
+    }
+
+    {
+        BuildLog log(filepath);
+        CHECK(log.open());
+        CHECK(1 == log.entryCount());
+        log.record("b.o", makeEntry(3000, 3400, 0, 700));
+        log.close();
+    }
+
+    BuildLog log(filepath);
+    CHECK(log.open());
+    CHECK(2 == log.entryCount());
+    BuildLog::Entry entry;
+    CHECK(log.find("a.o", &entry));
+    CHECK(100 == entry.duration());
+    CHECK(log.find("b.o", &entry));
+    CHECK(3000 == entry.startTime && 3400 == entry.endTime && 700 == entry.peakMemory);
+    log.close();
+}
+
+static void testUnknownFile()
+{
+    testing::TemporaryDirectory directory;
+    auto filepath = directory.path() / BuildLog::sFilename;
+    {
+        std::ofstream out(filepath.string());
+        out << "# watagashi build log v0\n1\t2\t0\t0\t0\t0\ta.o\n";
+    }
+    BuildLog log(filepath);
+    CHECK(log.open());
+    CHECK(0 == log.entryCount());
+    log.close();
+}
+
+int main()
+{
+    testRoundTrip();
+    testTornTail();
+    testUnknownFile();
+    return testing::result();
+}
@@ -0,0 +1,94 @@
+#include "dependencyStore.h"
+
+#include <fstream>
+
+#include "testing.h"
+
+using namespace watagashi;
+namespace fs = boost::filesystem;
+
+static void testRoundTrip()
+{
+    testing::TemporaryDirectory directory;
+    auto filepath = directory.path() / DependencyStore::sFilename;
+    {
+        DependencyStore store(filepath);
+        CHECK(store.open());
+        store.record("a.o", { "a.cpp", "common.h" });
+        store.record("b.o", { "b.cpp", "common.h", "b.h" });
+        // the last record wins.
+        store.record("a.o", { "a.cpp", "a.h" });
+        store.close();
+    }
+
+    DependencyStore store(filepath);
+    CHECK(store.open());
+    std::vector<std::string> dependencies;
+    CHECK(store.find("a.o", &dependencies));
+    CHECK((std::vector<std::string>{ "a.cpp", "a.h" }) == dependencies);
+    CHECK(store.find("b.o", &dependencies));
+    CHECK((std::vector<std::string>{ "b.cpp", "common.h", "b.h" }) == dependencies);
+    CHECK(!store.find("c.o", &dependencies));
+    store.close();
+}
+
+static void testTornTail()
+{
+    testing::TemporaryDirectory directory;
+    auto filepath = directory.path() / DependencyStore::sFilename;
+    {
+        DependencyStore store(filepath);
+        CHECK(store.open());
+        store.record("a.o", { "a.cpp", "a.h" });
+        store.close();
+    }
+    // an interrupted build leaves a part of the last line.
+    auto size = fs::file_size(filepath);
+    {
+        std::ofstream out(filepath.string(), std::ios::binary | std::ios::app);
+        out << "p\tb.cpp\nd\tb.o\t0\t";
+    }
+
+    {
+        DependencyStore store(filepath);
+        CHECK(store.open());
+        std::vector<std::string> dependencies;
+        CHECK(store.find("a.o", &dependencies));
+        CHECK((std::vector<std::string>{ "a.cpp", "a.h" }) == dependencies);
+        CHECK(!store.find("b.o", &dependencies));
+        // the records after the torn line are read by the next build.
+        store.record("c.o", { "c.cpp", "a.h" });
+        store.close();
+    }
+    CHECK(size < fs::file_size(filepath));
+
+    DependencyStore store(filepath);
+    CHECK(store.open());
+    std::vector<std::string> dependencies;
+    CHECK(store.find("a.o", &dependencies));
+    CHECK((std::vector<std::string>{ "a.cpp", "a.h" }) == dependencies);
+    CHECK(store.find("c.o", &dependencies));
+    CHECK((std::vector<std::string>{ "c.cpp", "a.h" }) == dependencies);
+    store.close();
+}
+
+static void testParseDepfile()
+{
+    testing::TemporaryDirectory directory;
+    auto depfilePath = directory.path() / "a.d";
+    {
+        std::ofstream out(depfilePath.string());
+        out << "a.o: a.cpp a\\ b.h \\\n  c.h\n";
+    }
+    std::vector<std::string> dependencies;
+    CHECK(DependencyStore::sParseDepfile(depfilePath, &dependencies));
+    CHECK((std::vector<std::string>{ "a.cpp", "a b.h", "c.h" }) == dependencies);
+}
+
+int main()
+{
+    testRoundTrip();
+    testTornTail();
+    testParseDepfile();
+    return testing::result();
+}
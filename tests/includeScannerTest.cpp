@@ -0,0 +1,108 @@
+#include "includeScanner.h"
+
+#include "testing.h"
+
+using namespace watagashi;
+
+static std::vector<IncludeScanner::Include> scan(std::string const& source)
+{
+    std::vector<IncludeScanner::Include> result;
+    IncludeScanner::sScan(source.data(), source.data() + source.size(), &result);
+    return result;
+}
+
+static bool isSame(std::vector<IncludeScanner::Include> const& includes, std::vector<std::string> const& paths)
+{
+    if (includes.size() != paths.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (includes[i].path != paths[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testDirectives()
+{
+    auto includes = scan(
+        "#include <vector>\n"
+        "  #  include \"a.h\"\n"
+        "#include_next <no.h>\n"
+        "#define X #include \"no.h\"\n"
+        "#include MACRO\n"
+        "#include <>\n"
+        "int x; #include \"no.h\"\n"
+        "#include \"last.h\"");
+    CHECK(isSame(includes, { "vector", "a.h", "last.h" }));
+    CHECK(3 == includes.size() && includes[0].isAngled && !includes[1].isAngled);
+    CHECK(scan("").empty());
+    CHECK(scan("int main() { return 0; }\n").empty());
+}
+
+static void testComments()
+{
+    auto includes = scan(
+        "// #include \"line.h\"\n"
+        "// continued \\\n"
+        "#include \"continued.h\"\n"
+        "/* #include \"block.h\"\n"
+        "#include \"block2.h\" */\n"
+        "/**/#include \"after.h\"\n"
+        "#include \"yes.h\" // #include \"no.h\"\n");
+    CHECK(isSame(includes, { "yes.h" }));
+}
+
+static void testLiterals()
+{
+    auto includes = scan(
+        "char const* s = \"\\\"\n"
+        "#include \\\"no.h\\\"\";\n"
+        "char c = '\"';\n"
+        "#include \"yes.h\"\n");
+    CHECK(isSame(includes, { "yes.h" }));
+}
+
+static void testRawStrings()
+{
+    auto includes = scan(
+        "auto a = R\"(\n"
+        "#include \"no1.h\"\n"
+        ")\";\n"
+        "auto b = u8R\"x(\n"
+        ")\"\n"
+        "#include \"no2.h\"\n"
+        ")x\";\n"
+        "auto c = LR\"--(\n"
+        "#include \"no3.h\"\n"
+        ")--\";\n"
+        "#include \"yes.h\"\n"
+        "auto BAR\"(\";\n"
+        "#include \"after.h\"\n");
+    CHECK(isSame(includes, { "yes.h", "after.h" }));
+}
+
+static void testDigitSeparators()
+{
+    // without the separators, the apostrophes hide the comment.
+    auto includes = scan(
+        "int a = 1'000'000; /* '\n"
+        "#include \"no.h\"\n"
+        "*/\n"
+        "double b = 0x1'ffp1'0, c = 1.0'5;\n"
+        "#include \"yes.h\"\n"
+        "char d = '\\'';\n"
+        "#include \"after.h\"\n");
+    CHECK(isSame(includes, { "yes.h", "after.h" }));
+}
+
+int main()
+{
+    testDirectives();
+    testComments();
+    testLiterals();
+    testRawStrings();
+    testDigitSeparators();
+    return testing::result();
+}
@@ -0,0 +1,80 @@
+#include "jobServer.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "testing.h"
+
+using namespace watagashi;
+
+static void testTokens()
+{
+    auto pServer = JobServer::sCreate(3);
+    CHECK(pServer);
+    if (!pServer) {
+        return;
+    }
+    CHECK(!pServer->isClient());
+    auto pMakeflags = std::getenv("MAKEFLAGS");
+    CHECK(pMakeflags && std::strstr(pMakeflags, "-j3") && std::strstr(pMakeflags, "--jobserver-auth="));
+
+    // the implicit slot and the two tokens.
+    CHECK(pServer->tryAcquire());
+    CHECK(pServer->tryAcquire());
+    CHECK(pServer->tryAcquire());
+    CHECK(!pServer->tryAcquire());
+    CHECK(!pServer->acquire(10));
+    pServer->release();
+    CHECK(pServer->tryAcquire());
+    CHECK(!pServer->tryAcquire());
+
+    // a client shares the tokens through MAKEFLAGS and has its own implicit slot.
+    auto pClient = JobServer::sJoinFromEnvironment();
+    CHECK(pClient);
+    if (!pClient) {
+        return;
+    }
+    CHECK(pClient->isClient());
+    CHECK(pClient->tryAcquire());
+    CHECK(!pClient->tryAcquire());
+    pServer->release();
+    CHECK(pClient->tryAcquire());
+    CHECK(!pServer->tryAcquire());
+
+    // a client returns the tokens which it holds when it ends.
+    pClient.reset();
+    CHECK(pServer->tryAcquire());
+    CHECK(!pServer->tryAcquire());
+
+    // releasing all slots returns the tokens to the pipe, and the implicit slot last.
+    pServer->release();
+    pServer->release();
+    pServer->release();
+    CHECK(pServer->tryAcquire());
+    CHECK(pServer->tryAcquire());
+    CHECK(pServer->tryAcquire());
+    CHECK(!pServer->tryAcquire());
+}
+
+static void testSingleJob()
+{
+    auto pServer = JobServer::sCreate(1);
+    CHECK(pServer);
+    if (!pServer) {
+        return;
+    }
+    CHECK(pServer->tryAcquire());
+    CHECK(!pServer->tryAcquire());
+    pServer->release();
+    CHECK(pServer->acquire(-1));
+}
+
+int main()
+{
+    // the jobserver of the parent make isn't used by the tests.
+    ::unsetenv("MAKEFLAGS");
+    testTokens();
+    CHECK(nullptr == std::getenv("MAKEFLAGS"));
+    testSingleJob();
+    return testing::result();
+}
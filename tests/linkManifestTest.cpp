@@ -0,0 +1,85 @@
+#include "linkManifest.h"
+
+#include <fstream>
+
+#include "testing.h"
+
+using namespace watagashi;
+namespace fs = boost::filesystem;
+
+static void writeFile(fs::path const& filepath, std::string const& content)
+{
+    std::ofstream out(filepath.string(), std::ios::binary | std::ios::trunc);
+    out << content;
+}
+
+// Check the objects and record them like the link does when they are outdated.
+static bool link(fs::path const& manifestPath, fs::path const& outputFilepath, uint64_t signature, std::vector<fs::path> const& inputs)
+{
+    LinkManifest manifest(manifestPath);
+    manifest.load();
+    auto isOutdated = manifest.isOutdated(outputFilepath, signature, inputs);
+    if (isOutdated) {
+        writeFile(outputFilepath, "linked");
+    }
+    manifest.save(outputFilepath);
+    return isOutdated;
+}
+
+static void testIsOutdated()
+{
+    testing::TemporaryDirectory directory;
+    auto manifestPath = directory.path() / "intermediate" / LinkManifest::sFilename;
+    auto outputFilepath = directory.path() / "a.out";
+    auto a = directory.path() / "a.o";
+    auto b = directory.path() / "b.o";
+    writeFile(a, "object a");
+    writeFile(b, "object b");
+
+    // nothing was linked.
+    CHECK(link(manifestPath, outputFilepath, 1, { a, b }));
+    CHECK(!link(manifestPath, outputFilepath, 1, { a, b }));
+
+    // an object compiled again to the same bytes.
+    writeFile(a, "object a");
+    fs::last_write_time(a, fs::last_write_time(a) + 10);
+    CHECK(!link(manifestPath, outputFilepath, 1, { a, b }));
+
+    // the content, the order, the count of the objects or the command changed.
+    writeFile(a, "object a changed");
+    CHECK(link(manifestPath, outputFilepath, 1, { a, b }));
+    CHECK(link(manifestPath, outputFilepath, 1, { b, a }));
+    CHECK(link(manifestPath, outputFilepath, 1, { b }));
+    CHECK(link(manifestPath, outputFilepath, 1, { b, a }));
+    CHECK(link(manifestPath, outputFilepath, 2, { b, a }));
+    CHECK(!link(manifestPath, outputFilepath, 2, { b, a }));
+
+    // the output was written by another tool or removed.
+    writeFile(outputFilepath, "other");
+    CHECK(link(manifestPath, outputFilepath, 2, { b, a }));
+    fs::remove(outputFilepath);
+    CHECK(link(manifestPath, outputFilepath, 2, { b, a }));
+    CHECK(!link(manifestPath, outputFilepath, 2, { b, a }));
+
+    // a missing object links, and the linker reports it.
+    LinkManifest manifest(manifestPath);
+    CHECK(manifest.load());
+    CHECK(manifest.isOutdated(outputFilepath, 2, { b, a, directory.path() / "missing.o" }));
+}
+
+static void testUnknownFile()
+{
+    testing::TemporaryDirectory directory;
+    auto manifestPath = directory.path() / LinkManifest::sFilename;
+    writeFile(manifestPath, "# watagashi link v0\n");
+    LinkManifest manifest(manifestPath);
+    CHECK(!manifest.load());
+    CHECK(!LinkManifest(directory.path() / "missing").load());
+}
+
+int main()
+{
+    testIsOutdated();
+    testUnknownFile();
+    return testing::result();
+}
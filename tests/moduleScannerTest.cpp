@@ -0,0 +1,70 @@
+#include "moduleScanner.h"
+
+#include "testing.h"
+
+using namespace watagashi;
+
+static ModuleScanner::Unit scan(std::string const& source)
+{
+    ModuleScanner::Unit unit;
+    ModuleScanner::sScan(source.data(), source.data() + source.size(), &unit);
+    return unit;
+}
+
+static void testInterface()
+{
+    auto unit = scan(
+        "module;\n"
+        "#include <vector>\n"
+        "export module app.core;\n"
+        "import std.io;\n"
+        "export import :detail;\n"
+        "import <string>;\n"
+        "module :private;\n");
+    CHECK("app.core" == unit.provide);
+    CHECK((std::vector<std::string>{ "std.io", "app.core:detail" }) == unit.imports);
+}
+
+static void testPartitionAndImplementation()
+{
+    auto partition = scan("export module app.core:detail;\nimport :util;\n");
+    CHECK("app.core:detail" == partition.provide);
+    CHECK((std::vector<std::string>{ "app.core:util" }) == partition.imports);
+
+    auto internalPartition = scan("module app.core:util;\n");
+    CHECK("app.core:util" == internalPartition.provide);
+    CHECK(internalPartition.imports.empty());
+
+    // an implementation unit imports its interface.
+    auto implementation = scan("module app.core;\nimport other;\n");
+    CHECK(implementation.provide.empty());
+    CHECK((std::vector<std::string>{ "app.core", "other" }) == implementation.imports);
+}
+
+static void testIgnored()
+{
+    auto unit = scan(
+        "// export module no.comment;\n"
+        "/* import no.block;\n"
+        "*/\n"
+        "char const* s = \"import no.string;\";\n"
+        "auto r = R\"(\n"
+        "import no.raw;\n"
+        ")\";\n"
+        "int x = 1'000; import no.middle;\n"
+        "import no.semicolon\n"
+        "importer a;\n"
+        "import a.b.c;\n");
+    CHECK(unit.provide.empty());
+    CHECK((std::vector<std::string>{ "a.b.c" }) == unit.imports);
+    CHECK(scan("int main() { return 0; }\n").empty());
+    CHECK(scan("").empty());
+}
+
+int main()
+{
+    testInterface();
+    testPartitionAndImplementation();
+    testIgnored();
+    return testing::result();
+}
@@ -0,0 +1,79 @@
+#include "objectCache.h"
+
+#include <fstream>
+
+#include "builder.h"
+#include "processServer.h"
+#include "programOptions.h"
+#include "testing.h"
+
+using namespace watagashi;
+namespace fs = boost::filesystem;
+
+static void writeFile(fs::path const& filepath, std::string const& content)
+{
+    std::ofstream out(filepath.string(), std::ios::binary | std::ios::trunc);
+    out << content;
+}
+
+static data::Compiler makeCompiler()
+{
+    return data::Compiler("g++")
+        .setExe(data::TaskBundle()
+            .setCompileObj(data::Task("g++")
+                .setInputAndOutputOption("", "-o")
+                .setOptionPrefix("-c")
+                .setDepfileOption("-MMD -MF")
+            )
+        );
+}
+
+// Compile the source with the cache, and return true when the object came from the cache.
+static bool compile(Builder const& builder, data::Compiler const& compiler, ObjectCache& cache, fs::path const& inputFilepath, fs::path const& outputFilepath)
+{
+    boost::system::error_code ec;
+    fs::remove(outputFilepath, ec);
+    Process process(builder, compiler, inputFilepath, outputFilepath);
+    process.pObjectCache = &cache;
+    CHECK(Process::BuildResult::Success == process.compile());
+    CHECK(fs::exists(outputFilepath));
+    return process.isCacheHit();
+}
+
+// A header of a system include directory, which -MMD leaves out of the depfile, is a dependency of the cached object.
+static void testSystemHeader()
+{
+    testing::TemporaryDirectory directory;
+    auto systemDirectory = directory.path() / "system";
+    fs::create_directories(systemDirectory);
+    writeFile(systemDirectory / "library.h", "#define LIBRARY_VERSION 1\n");
+    auto inputFilepath = directory.path() / "a.cpp";
+    writeFile(inputFilepath, "#include <library.h>\nint version() { return LIBRARY_VERSION; }\n");
+    auto outputFilepath = directory.path() / "obj" / "a.o";
+
+    data::Project project;
+    project.name = "app";
+    project.type = data::Project::Type::Exe;
+    project.rootDirectory = directory.path();
+    project.compileOptions.insert("-isystem " + systemDirectory.string());
+    ProgramOptions options;
+    Builder builder(project, options);
+    auto compiler = makeCompiler();
+    ObjectCache cache(directory.path() / "cache", 64 * 1024 * 1024);
+    CHECK(cache.open());
+
+    CHECK(!compile(builder, compiler, cache, inputFilepath, outputFilepath));
+    CHECK(compile(builder, compiler, cache, inputFilepath, outputFilepath));
+
+    // only the system header changed, like after upgrading the library.
+    writeFile(systemDirectory / "library.h", "#define LIBRARY_VERSION 20\n");
+    CHECK(!compile(builder, compiler, cache, inputFilepath, outputFilepath));
+    CHECK(compile(builder, compiler, cache, inputFilepath, outputFilepath));
+    cache.close();
+}
+
+int main()
+{
+    testSystemHeader();
+    return testing::result();
+}
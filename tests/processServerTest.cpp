@@ -0,0 +1,92 @@
+#include "processServer.h"
+
+#include <thread>
+#include <future>
+
+#include "builder.h"
+#include "programOptions.h"
+#include "testing.h"
+
+using namespace watagashi;
+
+// a hook which runs nothing. a remote slot can't run it like a link.
+static std::unique_ptr<Process> makeHook(Builder const& builder, data::Compiler const& compiler)
+{
+    return std::make_unique<Process>(builder, compiler, Process::Type::Hook);
+}
+
+static void runProcess(ProcessServer& processServer, std::unique_ptr<Process> pProcess)
+{
+    pProcess->compile();
+    processServer.notifyEndOfProcess(*pProcess);
+}
+
+// The dependent which a remote slot can't run is served to the local worker,
+// even when every worker sleeps while the dependency ends.
+static void testNonRemotableDependent()
+{
+    data::Project project;
+    ProgramOptions options;
+    Builder builder(project, options);
+    data::Compiler compiler;
+
+    for (int i = 0; i < 10; ++i) {
+        ProcessServer processServer(1);
+        auto pDependency = makeHook(builder, compiler);
+        auto pDependent = makeHook(builder, compiler);
+        pDependent->dependencies.push_back(pDependency.get());
+        std::vector<std::unique_ptr<Process>> processes;
+        processes.push_back(std::move(pDependency));
+        processes.push_back(std::move(pDependent));
+        processServer.addProcesses(std::move(processes));
+        processServer.closeProcess();
+
+        // take the dependency before the workers start, so that they sleep until it ends.
+        auto pRunning = processServer.serveProcess_(0);
+        CHECK(pRunning);
+        if (!pRunning) {
+            return;
+        }
+        size_t localCount = 0;
+        std::vector<std::thread> threads;
+        // the remote slots sleep first, so that notify_one() would wake one of them.
+        for (size_t remoteIndex = 0; remoteIndex < 2; ++remoteIndex) {
+            threads.emplace_back([&]() {
+                while (auto pProcess = processServer.serveProcess_(0, true)) {
+                    runProcess(processServer, std::move(pProcess));
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        threads.emplace_back([&]() {
+            while (auto pProcess = processServer.serveProcess_(0)) {
+                ++localCount;
+                runProcess(processServer, std::move(pProcess));
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        runProcess(processServer, std::move(pRunning));
+
+        auto finish = std::async(std::launch::async, [&]() { processServer.waitForFinish(); });
+        bool isFinished = std::future_status::ready == finish.wait_for(std::chrono::seconds(5));
+        CHECK(isFinished);
+        if (!isFinished) {
+            processServer.abort();
+        }
+        finish.wait();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(1 == localCount);
+        CHECK(2 == processServer.successCount());
+        if (!isFinished) {
+            return;
+        }
+    }
+}
+
+int main()
+{
+    testNonRemotableDependent();
+    return testing::result();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <boost/filesystem.hpp>
+
+// A failed check prints the expression and the test returns testing::result() at the end of main().
+// it is variadic for the commas in the braces like CHECK(f({ 1, 2 })).
+#define CHECK(...) \
+    do { \
+        if (!(__VA_ARGS__)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": failed: " << #__VA_ARGS__ << std::endl; \
+            ++watagashi::testing::sFailedCount; \
+        } \
+    } while (false)
+
+namespace watagashi::testing
+{
+
+inline int sFailedCount = 0;
+
+inline int result()
+{
+    if (0 < sFailedCount) {
+        std::cerr << sFailedCount << " checks failed." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// A new directory which is removed with its files when this is destroyed.
+class TemporaryDirectory
+{
+    TemporaryDirectory(TemporaryDirectory const&) = delete;
+    TemporaryDirectory& operator=(TemporaryDirectory const&) = delete;
+
+public:
+    TemporaryDirectory()
+        : mPath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("watagashi-test-%%%%-%%%%-%%%%"))
+    {
+        boost::filesystem::create_directories(this->mPath);
+    }
+
+    ~TemporaryDirectory()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(this->mPath, ec);
+    }
+
+    boost::filesystem::path const& path()const { return this->mPath; }
+
+private:
+    boost::filesystem::path mPath;
+};
+
+}
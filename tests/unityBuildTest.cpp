@@ -0,0 +1,194 @@
+#include "unityBuild.h"
+
+#include <fstream>
+
+#include "data.h"
+#include "testing.h"
+
+using namespace watagashi;
+namespace fs = boost::filesystem;
+
+static void writeFile(fs::path const& filepath, std::string const& content)
+{
+    std::ofstream out(filepath.string(), std::ios::binary | std::ios::trunc);
+    out << content;
+}
+
+static std::vector<std::string> toStrings(std::vector<fs::path> const& paths)
+{
+    std::vector<std::string> result;
+    for (auto& path : paths) {
+        result.push_back(path.generic_string());
+    }
+    return result;
+}
+
+static data::Project makeProject(fs::path const& rootDirectory)
+{
+    data::Project project;
+    project.name = "app";
+    project.type = data::Project::Type::Exe;
+    project.rootDirectory = rootDirectory;
+    project.intermediatePath = "obj";
+    return project;
+}
+
+static void testGrouping()
+{
+    testing::TemporaryDirectory directory;
+    writeFile(directory.path() / "a.cpp", std::string(100, ' '));
+    writeFile(directory.path() / "b.cpp", std::string(50, ' '));
+    writeFile(directory.path() / "c.cpp", std::string(30, ' '));
+    writeFile(directory.path() / "d.c", std::string(10, ' '));
+    writeFile(directory.path() / "e.c", std::string(10, ' '));
+    auto project = makeProject(directory.path());
+    std::vector<fs::path> targets = { "e.c", "c.cpp", "a.cpp", "d.c", "b.cpp" };
+
+    // the groups are balanced by the sizes, and a unity source has the targets of one extension.
+    UnityBuild unityBuild(project, 2);
+    CHECK(!unityBuild.load());
+    CHECK(unityBuild.prepare(targets));
+    auto& units = unityBuild.units();
+    CHECK(4 == units.size());
+    if (4 == units.size()) {
+        CHECK((std::vector<std::string>{ "d.c" }) == toStrings(units[0].targets));
+        CHECK((std::vector<std::string>{ "e.c" }) == toStrings(units[1].targets));
+        CHECK((std::vector<std::string>{ "a.cpp" }) == toStrings(units[2].targets));
+        CHECK((std::vector<std::string>{ "b.cpp", "c.cpp" }) == toStrings(units[3].targets));
+        CHECK(".c" == units[1].sourceFilepath.extension() && ".cpp" == units[3].sourceFilepath.extension());
+        CHECK(".o" == units[3].outputFilepath.extension());
+        CHECK(fs::exists(units[3].sourceFilepath));
+    }
+    CHECK(unityBuild.isolatedTargets().empty());
+
+    // the next build keeps the groups, and a new target joins the lightest group of its extension.
+    // the group isn't compiled yet, so it joins at once.
+    writeFile(directory.path() / "f.cpp", std::string(1000, ' '));
+    targets.push_back("f.cpp");
+    UnityBuild nextBuild(project, 2);
+    CHECK(nextBuild.prepare(targets));
+    CHECK(4 == nextBuild.units().size());
+    if (4 == nextBuild.units().size()) {
+        CHECK((std::vector<std::string>{ "b.cpp", "c.cpp", "f.cpp" }) == toStrings(nextBuild.units()[3].targets));
+    }
+    CHECK(nextBuild.isolatedTargets().empty());
+
+    // other counts make other groups.
+    UnityBuild otherBuild(project, 1);
+    CHECK(!otherBuild.load());
+    CHECK(otherBuild.prepare(targets));
+    CHECK(2 == otherBuild.units().size());
+    CHECK(otherBuild.isolatedTargets().empty());
+}
+
+static void testIsolation()
+{
+    testing::TemporaryDirectory directory;
+    for (auto name : { "a.cpp", "b.cpp", "c.cpp", "d.cpp" }) {
+        writeFile(directory.path() / name, "int x;\n");
+    }
+    auto project = makeProject(directory.path());
+    std::vector<fs::path> targets = { "a.cpp", "b.cpp", "c.cpp", "d.cpp" };
+    UnityBuild unityBuild(project, 1);
+    CHECK(unityBuild.prepare(targets));
+    CHECK(1 == unityBuild.units().size());
+    if (1 != unityBuild.units().size()) {
+        return;
+    }
+
+    // a target which changed after its group was compiled leaves the group.
+    auto objectPath = unityBuild.units()[0].outputFilepath;
+    writeFile(objectPath, "object");
+    auto time = fs::last_write_time(objectPath);
+    for (auto& target : targets) {
+        fs::last_write_time(directory.path() / target, time - 10);
+    }
+    fs::last_write_time(directory.path() / "b.cpp", time + 10);
+    UnityBuild nextBuild(project, 1);
+    CHECK(nextBuild.prepare(targets));
+    CHECK((std::vector<std::string>{ "b.cpp" }) == toStrings(nextBuild.isolatedTargets()));
+    CHECK(1 == nextBuild.units().size() && 3 == nextBuild.units()[0].targets.size());
+
+    // when most of the group changed, it is compiled again as it is.
+    UnityBuild checkoutBuild(project, 1);
+    for (auto& target : targets) {
+        fs::last_write_time(directory.path() / target, time + 10);
+    }
+    CHECK(checkoutBuild.prepare(targets));
+    CHECK((std::vector<std::string>{ "b.cpp" }) == toStrings(checkoutBuild.isolatedTargets()));
+    CHECK(1 == checkoutBuild.units().size() && 3 == checkoutBuild.units()[0].targets.size());
+}
+
+static void testRejoin()
+{
+    testing::TemporaryDirectory directory;
+    std::vector<fs::path> targets = { "a.cpp", "b.cpp", "c.cpp", "d.cpp" };
+    for (auto& target : targets) {
+        writeFile(directory.path() / target, "int x;\n");
+    }
+    auto project = makeProject(directory.path());
+    auto prepare = [&]() {
+        UnityBuild unityBuild(project, 1);
+        CHECK(unityBuild.prepare(targets));
+        CHECK(1 == unityBuild.units().size());
+        return std::make_pair(
+            unityBuild.units().empty() ? std::vector<std::string>() : toStrings(unityBuild.units()[0].targets),
+            toStrings(unityBuild.isolatedTargets()));
+    };
+    auto grouped = prepare().first;
+    CHECK(4 == grouped.size());
+
+    // b.cpp changed after the group was compiled, and the group was compiled without it.
+    auto objectPath = project.makeIntermediatePath() / UnityBuild::sDirectoryName / "unity0.o";
+    writeFile(objectPath, "object");
+    auto time = fs::last_write_time(objectPath);
+    for (auto& target : targets) {
+        fs::last_write_time(directory.path() / target, time - 10);
+    }
+    fs::last_write_time(directory.path() / "b.cpp", time + 10);
+    CHECK((std::vector<std::string>{ "b.cpp" }) == prepare().second);
+    fs::last_write_time(objectPath, time + 20);
+
+    // an isolated target and a new one are compiled alone while the group isn't compiled again.
+    writeFile(directory.path() / "e.cpp", "int y;\n");
+    fs::last_write_time(directory.path() / "e.cpp", time + 10);
+    targets.push_back("e.cpp");
+    auto [waitingGroup, waitingTargets] = prepare();
+    CHECK((std::vector<std::string>{ "a.cpp", "c.cpp", "d.cpp" }) == waitingGroup);
+    CHECK((std::vector<std::string>{ "b.cpp", "e.cpp" }) == waitingTargets);
+    CHECK((std::vector<std::string>{ "b.cpp", "e.cpp" }) == prepare().second);
+
+    // another change compiles the group again, and the unchanged ones rejoin it.
+    fs::last_write_time(directory.path() / "a.cpp", time + 30);
+    auto [rejoinedGroup, isolatedTargets] = prepare();
+    CHECK((std::vector<std::string>{ "b.cpp", "c.cpp", "d.cpp", "e.cpp" }) == rejoinedGroup);
+    CHECK((std::vector<std::string>{ "a.cpp" }) == isolatedTargets);
+
+    // "clean" removes the object, and everything rejoins.
+    fs::remove(objectPath);
+    auto [cleanGroup, cleanTargets] = prepare();
+    CHECK(5 == cleanGroup.size());
+    CHECK(cleanTargets.empty());
+
+    // when the isolated targets outnumber the grouped ones, the groups are made again.
+    writeFile(objectPath, "object");
+    fs::last_write_time(objectPath, time + 40);
+    for (auto name : { "f.cpp", "g.cpp", "h.cpp", "i.cpp", "j.cpp" }) {
+        writeFile(directory.path() / name, "int z;\n");
+        targets.push_back(name);
+    }
+    CHECK(5 == prepare().second.size());
+    writeFile(directory.path() / "k.cpp", "int w;\n");
+    targets.push_back("k.cpp");
+    auto [regroupedGroup, regroupedTargets] = prepare();
+    CHECK(11 == regroupedGroup.size());
+    CHECK(regroupedTargets.empty());
+}
+
+int main()
+{
+    testGrouping();
+    testIsolation();
+    testRejoin();
+    return testing::result();
+}
@@ -0,0 +1,55 @@
+#include "utility.h"
+
+#include "testing.h"
+
+using namespace watagashi;
+
+static bool isSplit(std::string const& command, std::vector<std::string> const& expected)
+{
+    std::vector<std::string> args;
+    return splitCommandArguments(command, &args) && expected == args;
+}
+
+static bool needsShell(std::string const& command)
+{
+    std::vector<std::string> args;
+    return !splitCommandArguments(command, &args);
+}
+
+static void testSplitCommandArguments()
+{
+    CHECK(isSplit("", {}));
+    CHECK(isSplit("  \t ", {}));
+    CHECK(isSplit("g++ -c a.cpp -o a.o", { "g++", "-c", "a.cpp", "-o", "a.o" }));
+    CHECK(isSplit("  g++\t-c   a.cpp  ", { "g++", "-c", "a.cpp" }));
+    CHECK(isSplit("echo 'a b' \"c d\" e\\ f", { "echo", "a b", "c d", "e f" }));
+    CHECK(isSplit("echo '' \"\"", { "echo", "", "" }));
+    CHECK(isSplit("echo 'a\"b' \"a'b\" \"\\\"\\\\\\a\"", { "echo", "a\"b", "a'b", "\"\\\\a" }));
+    CHECK(isSplit("g++ -DNAME=\"a b\" a#b", { "g++", "-DNAME=a b", "a#b" }));
+    CHECK(isSplit("echo a~ '$HOME' '*'", { "echo", "a~", "$HOME", "*" }));
+
+    // the commands which only the shell runs.
+    CHECK(needsShell("echo a | cat"));
+    CHECK(needsShell("echo a > b"));
+    CHECK(needsShell("echo a && echo b"));
+    CHECK(needsShell("echo a; echo b"));
+    CHECK(needsShell("echo $HOME"));
+    CHECK(needsShell("echo \"$HOME\""));
+    CHECK(needsShell("echo `date`"));
+    CHECK(needsShell("echo *.cpp"));
+    CHECK(needsShell("echo ~"));
+    CHECK(needsShell("echo a # comment"));
+    CHECK(needsShell("CC=gcc make"));
+    CHECK(needsShell("cd src"));
+    CHECK(needsShell("export A=1"));
+    CHECK(needsShell("echo 'a"));
+    CHECK(needsShell("echo \"a"));
+    CHECK(needsShell("echo a\\"));
+    CHECK(needsShell("echo a\nb"));
+}
+
+int main()
+{
+    testSplitCommandArguments();
+    return testing::result();
+}